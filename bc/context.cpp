@@ -23,12 +23,17 @@
  */
 
 #include "context.hpp"
+#include "value.hpp"
+#include <assert.h>
 #include <stdlib.h>
 
 namespace LLVMBC
 {
 LLVMContext::LLVMContext()
 {
+	// Like LLVM's fixed kinds, these always exist, so the converter can query them without interning.
+	getMDKindID("dx.precise");
+	getMDKindID("dx.nonuniform");
 }
 
 LLVMContext::~LLVMContext()
@@ -39,6 +44,35 @@ LLVMContext::~LLVMContext()
 		dxil_spv::free_in_thread(raw_allocations[i - 1]);
 }
 
+void LLVMContext::assign_dense_id(Value *value)
+{
+	value->set_dense_id(next_dense_id++);
+}
+
+unsigned LLVMContext::getMDKindID(const String &name)
+{
+	auto itr = md_kind_ids.find(name);
+	if (itr != md_kind_ids.end())
+		return itr->second;
+
+	unsigned id = unsigned(md_kind_names.size());
+	md_kind_ids[name] = id;
+	md_kind_names.push_back(name);
+	return id;
+}
+
+unsigned LLVMContext::findMDKindID(const String &name) const
+{
+	auto itr = md_kind_ids.find(name);
+	return itr != md_kind_ids.end() ? itr->second : UINT32_MAX;
+}
+
+const String &LLVMContext::getMDKindName(unsigned id) const
+{
+	assert(id < md_kind_names.size());
+	return md_kind_names[id];
+}
+
 void *LLVMContext::allocate_from_chain(uintptr_t size, uintptr_t align)
 {
 	current_block = (current_block + align - 1) & ~(align - 1);
@@ -62,18 +96,12 @@ void LLVMContext::allocate_new_chain(size_t size, size_t align)
 	if (min_size < 64 * 1024)
 		min_size = 64 * 1024;
 
-	void *ptr = dxil_spv::allocate_in_thread(min_size);
-	if (ptr)
-	{
-		raw_allocations.push_back(ptr);
-		current_block = reinterpret_cast<uintptr_t>(ptr);
-		current_block_end = current_block + min_size;
-	}
-	else
-	{
-		current_block = 0;
-		current_block_end = 0;
-	}
+	// The parser has no way to fail an allocation. It is bounded by the size of the module,
+	// so going over the memory limit is fine, and the conversion bails out afterwards.
+	void *ptr = dxil_spv::allocate_in_thread_or_abort(min_size);
+	raw_allocations.push_back(ptr);
+	current_block = reinterpret_cast<uintptr_t>(ptr);
+	current_block_end = current_block + min_size;
 }
 
 void *LLVMContext::allocate(size_t size, size_t align)
@@ -32,6 +32,7 @@
 namespace LLVMBC
 {
 class Type;
+class Value;
 
 class LLVMContext
 {
@@ -45,9 +46,8 @@ public:
 	T *construct(U &&... u)
 	{
 		T *mem = static_cast<T *>(allocate(sizeof(T), alignof(T)));
-		if (!mem)
-			std::terminate();
 		T *t = new (mem) T(std::forward<U>(u)...);
+		assign_dense_id(t);
 
 		if (!std::is_trivially_destructible<T>::value)
 			append_typed_destructor(t);
@@ -58,21 +58,34 @@ public:
 	T *construct_n(size_t n, const U &... u)
 	{
 		T *mem = static_cast<T *>(allocate(sizeof(T) * n, alignof(T)));
-		if (!mem)
-			std::terminate();
 
 		for (size_t i = 0; i < n; i++)
 		{
 			T *tmp = new (&mem[i]) T(u...);
+			assign_dense_id(tmp);
 			if (!std::is_trivially_destructible<T>::value)
 				append_typed_destructor(tmp);
 		}
 		return mem;
 	}
 
-	Vector<Type *> &get_type_cache()
+	// Types are uniqued structurally. Callers hash the type key and
+	// compare against the few candidates which share that hash.
+	Vector<Type *> &get_type_cache(uint64_t hash)
 	{
-		return type_cache;
+		return type_cache[hash];
+	}
+
+	// Metadata kinds are interned to small IDs, same as LLVM.
+	unsigned getMDKindID(const String &name);
+	// Does not intern name, so a shared context can be queried. Returns UINT32_MAX if name was never interned.
+	unsigned findMDKindID(const String &name) const;
+	const String &getMDKindName(unsigned id) const;
+
+	// Every Value constructed in the context gets a dense ID, see Value::get_dense_id().
+	uint32_t get_num_dense_ids() const
+	{
+		return next_dense_id;
 	}
 
 private:
@@ -101,19 +114,25 @@ private:
 	uintptr_t current_block = 0;
 	uintptr_t current_block_end = 0;
 
+	uint32_t next_dense_id = 0;
+	void assign_dense_id(Value *value);
+	static void assign_dense_id(...)
+	{
+	}
+
 	void *allocate_from_chain(uintptr_t size, uintptr_t align);
 	void allocate_new_chain(size_t size, size_t align);
 
 	Vector<void *> raw_allocations;
 	Vector<Deleter *> typed_allocations;
-	Vector<Type *> type_cache;
+	UnorderedMap<uint64_t, Vector<Type *>> type_cache;
+	UnorderedMap<String, unsigned> md_kind_ids;
+	Vector<String> md_kind_names;
 
 	template <typename T, typename... U>
 	T *construct_trivial(U &&... u)
 	{
 		T *mem = static_cast<T *>(allocate(sizeof(T), alignof(T)));
-		if (!mem)
-			std::terminate();
 		T *t = new (mem) T(std::forward<U>(u)...);
 		return t;
 	}
@@ -594,9 +594,10 @@ void StreamState::append(CallInst *call, bool decl)
 		}
 		append(")");
 
+		auto &context = call->getType()->getContext();
 		for (auto itr = call->metadata_begin(); itr != call->metadata_end(); ++itr)
 		{
-			append(" !", itr->first, " ", itr->second);
+			append(" !", context.getMDKindName(itr->kind), " ", itr->node);
 		}
 	}
 	else
@@ -938,6 +939,9 @@ void StreamState::append(Value *value, bool decl)
 
 bool disassemble(Module &module, String &str)
 {
+	if (!module.materialize_all())
+		return false;
+
 	StreamState state;
 
 	for (auto itr = module.global_begin(); itr != module.global_end(); ++itr)
@@ -45,6 +45,21 @@ const String &Function::getName() const
 	return module.get_value_name(value_id);
 }
 
+Function::IntrinsicKind Function::get_intrinsic_kind() const
+{
+	return intrinsic_kind;
+}
+
+void Function::set_intrinsic_kind(IntrinsicKind kind)
+{
+	intrinsic_kind = kind;
+}
+
+bool Function::isIntrinsic() const
+{
+	return intrinsic_kind == IntrinsicKind::LLVM;
+}
+
 void Function::set_basic_blocks(Vector<BasicBlock *> basic_blocks_)
 {
 	basic_blocks = std::move(basic_blocks_);
@@ -91,6 +91,18 @@ public:
 	explicit Function(FunctionType *function_type, uint64_t value_id, Module &module);
 	const String &getName() const;
 
+	// getName() is a lookup in the module symbol table,
+	// so the kind of callee is resolved once when the module has been parsed.
+	enum class IntrinsicKind : uint8_t
+	{
+		None,
+		DXILOp,
+		LLVM
+	};
+	IntrinsicKind get_intrinsic_kind() const;
+	void set_intrinsic_kind(IntrinsicKind kind);
+	bool isIntrinsic() const;
+
 	void set_basic_blocks(Vector<BasicBlock *> basic_blocks);
 	IteratorAdaptor<BasicBlock, Vector<BasicBlock *>::const_iterator> begin() const;
 	IteratorAdaptor<BasicBlock, Vector<BasicBlock *>::const_iterator> end() const;
@@ -116,5 +128,6 @@ private:
 	Vector<BasicBlock *> basic_blocks;
 	Vector<Argument *> arguments;
 	Vector<std::pair<String, String>> attributes;
+	IntrinsicKind intrinsic_kind = IntrinsicKind::None;
 };
 } // namespace LLVMBC
@@ -24,6 +24,8 @@
 
 #include "instruction.hpp"
 #include "cast.hpp"
+#include "context.hpp"
+#include "type.hpp"
 #include <assert.h>
 
 namespace LLVMBC
@@ -79,33 +81,70 @@ bool Instruction::resolve_proxy_values()
 	return true;
 }
 
-void Instruction::setMetadata(const String &str, MDNode *node)
+const Instruction::MetadataAttachment *Instruction::find_attachment(unsigned kind) const
 {
-	attachments[str] = node;
+	for (auto &attachment : attachments)
+		if (attachment.kind == kind)
+			return &attachment;
+	return nullptr;
 }
 
-UnorderedMap<String, MDNode *>::const_iterator Instruction::metadata_begin() const
+const Instruction::MetadataAttachment *Instruction::find_attachment(const String &str) const
 {
-	return attachments.begin();
+	if (attachments.empty())
+		return nullptr;
+
+	// Compare against the interned names rather than interning str on every query.
+	auto &context = getType()->getContext();
+	for (auto &attachment : attachments)
+		if (context.getMDKindName(attachment.kind) == str)
+			return &attachment;
+	return nullptr;
 }
 
-UnorderedMap<String, MDNode *>::const_iterator Instruction::metadata_end() const
+void Instruction::setMetadata(unsigned kind, MDNode *node)
 {
-	return attachments.end();
+	if (auto *attachment = find_attachment(kind))
+		const_cast<MetadataAttachment *>(attachment)->node = node;
+	else
+		attachments.push_back({ kind, node });
+}
+
+bool Instruction::hasMetadata(unsigned kind) const
+{
+	return find_attachment(kind) != nullptr;
+}
+
+MDNode *Instruction::getMetadata(unsigned kind) const
+{
+	auto *attachment = find_attachment(kind);
+	return attachment ? attachment->node : nullptr;
+}
+
+void Instruction::setMetadata(const String &str, MDNode *node)
+{
+	setMetadata(getType()->getContext().getMDKindID(str), node);
 }
 
 bool Instruction::hasMetadata(const String &str) const
 {
-	return attachments.find(str) != attachments.end();
+	return find_attachment(str) != nullptr;
 }
 
 MDNode *Instruction::getMetadata(const String &str) const
 {
-	auto itr = attachments.find(str);
-	if (itr != attachments.end())
-		return itr->second;
-	else
-		return nullptr;
+	auto *attachment = find_attachment(str);
+	return attachment ? attachment->node : nullptr;
+}
+
+Vector<Instruction::MetadataAttachment>::const_iterator Instruction::metadata_begin() const
+{
+	return attachments.begin();
+}
+
+Vector<Instruction::MetadataAttachment>::const_iterator Instruction::metadata_end() const
+{
+	return attachments.end();
 }
 
 bool Instruction::is_base_of_value_kind(ValueKind kind)
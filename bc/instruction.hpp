@@ -122,12 +122,23 @@ public:
 
 	bool resolve_proxy_values();
 
+	struct MetadataAttachment
+	{
+		unsigned kind;
+		MDNode *node;
+	};
+
+	// Kind IDs come from LLVMContext::getMDKindID().
+	MDNode *getMetadata(unsigned kind) const;
+	bool hasMetadata(unsigned kind) const;
+	void setMetadata(unsigned kind, MDNode *node);
+
 	MDNode *getMetadata(const String &str) const;
 	bool hasMetadata(const String &str) const;
 	void setMetadata(const String &str, MDNode *node);
 
-	UnorderedMap<String, MDNode *>::const_iterator metadata_begin() const;
-	UnorderedMap<String, MDNode *>::const_iterator metadata_end() const;
+	Vector<MetadataAttachment>::const_iterator metadata_begin() const;
+	Vector<MetadataAttachment>::const_iterator metadata_end() const;
 
 	static bool is_base_of_value_kind(ValueKind kind);
 	static constexpr ValueKind get_value_kind()
@@ -140,7 +151,10 @@ protected:
 	bool is_terminator = false;
 	void set_operands(Vector<Value *> op);
 	Vector<Value *> operands;
-	UnorderedMap<String, MDNode *> attachments;
+	// Instructions rarely have more than one or two attachments, a linear search beats hashing.
+	Vector<MetadataAttachment> attachments;
+	const MetadataAttachment *find_attachment(unsigned kind) const;
+	const MetadataAttachment *find_attachment(const String &str) const;
 };
 
 class ReturnInst : public Instruction
@@ -32,6 +32,7 @@
 #include "type.hpp"
 #include "value.hpp"
 #include <algorithm>
+#include <memory>
 
 #include "llvm_decoder.h"
 
@@ -308,7 +309,7 @@ static int64_t decode_sign_rotated_value(uint64_t v)
 	return int64_t(v);
 }
 
-struct ModuleParseContext
+struct ModuleParseContext : BitcodeVisitor
 {
 	Function *function = nullptr;
 	Module *module = nullptr;
@@ -321,25 +322,29 @@ struct ModuleParseContext
 	Vector<Type *> types;
 	Vector<Function *> functions_with_bodies;
 	UnorderedMap<uint64_t, MDOperand *> metadata;
-	UnorderedMap<uint64_t, String> metadata_kind_map;
+	UnorderedMap<uint64_t, unsigned> metadata_kind_map;
 	Vector<Vector<std::pair<String, String>>> attribute_lists;
 	UnorderedMap<uint64_t, Vector<std::pair<String, String>>> attribute_groups;
 	Type *constant_type = nullptr;
 	String current_metadata_name;
 
-	bool parse_function_child_block(const BlockOrRecord &entry);
+	BlockAction EnterBlock(const BlockOrRecord &block) override;
+	bool VisitRecord(const BlockOrRecord &record) override;
+	bool LeaveBlock(const BlockOrRecord &block) override;
+
+	bool parse_module_record(const BlockOrRecord &entry);
 	bool parse_record(const BlockOrRecord &entry);
 	bool parse_constants_record(const BlockOrRecord &entry);
-	bool parse_constants_block(const BlockOrRecord &entry);
-	bool parse_metadata_block(const BlockOrRecord &entry);
-	bool parse_paramattr_block(const BlockOrRecord &entry);
-	bool parse_paramattr_group_block(const BlockOrRecord &entry);
+	bool parse_paramattr_record(const BlockOrRecord &entry);
+	bool parse_paramattr_group_record(const BlockOrRecord &entry);
 	bool parse_metadata_attachment_record(const BlockOrRecord &entry);
 	bool parse_metadata_record(const BlockOrRecord &entry, unsigned index);
 	Type *get_constant_type();
-	bool parse_function_body(const BlockOrRecord &entry);
-	bool parse_types(const BlockOrRecord &entry);
-	bool parse_value_symtab(const BlockOrRecord &entry);
+	Function *next_function_with_body();
+	bool begin_function_body(Function *func);
+	bool end_function_body();
+	bool materialize_function_body(Function *func, bool &parsed);
+	bool parse_value_symtab_record(const BlockOrRecord &entry);
 	bool parse_function_record(const BlockOrRecord &entry);
 	bool parse_global_variable_record(const BlockOrRecord &entry);
 	bool parse_version_record(const BlockOrRecord &entry);
@@ -360,7 +365,7 @@ struct ModuleParseContext
 	Value *get_value(const Vector<uint64_t> &ops, unsigned &index, Type *expected_type);
 	Value *get_value_signed(uint64_t op, Type *expected_type = nullptr);
 	MDOperand *get_metadata(uint64_t index) const;
-	const char *get_metadata_kind(uint64_t index) const;
+	bool get_metadata_kind(uint64_t index, unsigned &kind) const;
 
 	Instruction *get_instruction(uint64_t index) const;
 
@@ -368,6 +373,7 @@ struct ModuleParseContext
 	Vector<std::pair<GlobalVariable *, uint64_t>> global_initializations;
 	bool resolve_forward_references();
 	bool resolve_global_initializations();
+	void classify_functions();
 
 	uint64_t tween_id = 1;
 	uint64_t metadata_tween_id = 1;
@@ -375,6 +381,18 @@ struct ModuleParseContext
 	bool use_relative_id = true;
 	bool use_strtab = false;
 	bool seen_first_function_body = false;
+
+	// With lazy function bodies, FUNCTION_BLOCKs are skipped in the first pass
+	// and decoded on demand from their recorded bit offsets.
+	std::unique_ptr<BitcodeReader> reader;
+	bool lazy_function_bodies = false;
+	Function *materialize_target = nullptr;
+	UnorderedMap<const Function *, size_t> lazy_function_offsets;
+
+	// Blocks we are currently decoding, innermost last. Blocks we don't care about are skipped entirely.
+	Vector<KnownBlocks> block_stack;
+	Vector<Value *> global_values;
+	unsigned metadata_index = 0;
 };
 
 ValueProxy::ValueProxy(Type *type, ModuleParseContext &context_, uint64_t id_)
@@ -541,13 +559,13 @@ MDOperand *ModuleParseContext::get_metadata(uint64_t index) const
 	}
 }
 
-const char *ModuleParseContext::get_metadata_kind(uint64_t index) const
+bool ModuleParseContext::get_metadata_kind(uint64_t index, unsigned &kind) const
 {
 	auto itr = metadata_kind_map.find(index);
-	if (itr != metadata_kind_map.end())
-		return itr->second.c_str();
-	else
-		return nullptr;
+	if (itr == metadata_kind_map.end())
+		return false;
+	kind = itr->second;
+	return true;
 }
 
 Value *ModuleParseContext::get_value_signed(uint64_t op, Type *expected_type)
@@ -969,15 +987,6 @@ bool ModuleParseContext::parse_constants_record(const BlockOrRecord &entry)
 	return true;
 }
 
-bool ModuleParseContext::parse_constants_block(const BlockOrRecord &entry)
-{
-	constant_type = nullptr;
-	for (auto &child : entry.children)
-		if (!parse_constants_record(child))
-			return false;
-	return true;
-}
-
 bool ModuleParseContext::parse_metadata_attachment_record(const BlockOrRecord &entry)
 {
 	if (MetaDataRecord(entry.id) != MetaDataRecord::ATTACHMENT)
@@ -998,11 +1007,11 @@ bool ModuleParseContext::parse_metadata_attachment_record(const BlockOrRecord &e
 
 	for (size_t i = 0; i < num_nodes; i++)
 	{
-		auto *kind = get_metadata_kind(entry.ops[2 * i + 1]);
+		unsigned kind;
 		auto *operand = get_metadata(entry.ops[2 * i + 2]);
 		auto *node = dyn_cast<MDNode>(operand);
 
-		if (!kind)
+		if (!get_metadata_kind(entry.ops[2 * i + 1], kind))
 		{
 			LOGE("Invalid metadata kind.\n");
 			return false;
@@ -1101,7 +1110,7 @@ bool ModuleParseContext::parse_metadata_record(const BlockOrRecord &entry, unsig
 		if (entry.ops.size() < 1)
 			return false;
 
-		metadata_kind_map[entry.ops[0]] = entry.getString(1);
+		metadata_kind_map[entry.ops[0]] = context->getMDKindID(entry.getString(1));
 		break;
 	}
 
@@ -1112,156 +1121,103 @@ bool ModuleParseContext::parse_metadata_record(const BlockOrRecord &entry, unsig
 	return true;
 }
 
-bool ModuleParseContext::parse_metadata_block(const BlockOrRecord &entry)
+bool ModuleParseContext::parse_paramattr_record(const BlockOrRecord &child)
 {
-	unsigned index = 0;
-	for (auto &child : entry.children)
-		if (!parse_metadata_record(child, index++))
-			return false;
-	return true;
-}
+	// Don't support the OLD variant unless we observe it in the wild.
+	// DXC doesn't generate it.
+	if (AttributeCodes(child.id) != AttributeCodes::CodeEntry)
+		return false;
 
-bool ModuleParseContext::parse_paramattr_block(const BlockOrRecord &entry)
-{
-	for (auto &child : entry.children)
+	Vector<std::pair<String, String>> pairs;
+	for (auto op : child.ops)
 	{
-		if (!child.IsRecord())
-			continue;
-
-		// Don't support the OLD variant unless we observe it in the wild.
-		// DXC doesn't generate it.
-		if (AttributeCodes(child.id) != AttributeCodes::CodeEntry)
-			return false;
-
-		Vector<std::pair<String, String>> pairs;
-		for (auto op : child.ops)
-		{
-			auto &grp = attribute_groups[op];
-			for (auto &elem : grp)
-				pairs.push_back(elem);
-		}
-		attribute_lists.push_back(std::move(pairs));
+		auto &grp = attribute_groups[op];
+		for (auto &elem : grp)
+			pairs.push_back(elem);
 	}
+	attribute_lists.push_back(std::move(pairs));
 	return true;
 }
 
-bool ModuleParseContext::parse_paramattr_group_block(const BlockOrRecord &entry)
+bool ModuleParseContext::parse_paramattr_group_record(const BlockOrRecord &child)
 {
-	if (!attribute_groups.empty())
-	{
-		LOGE("Cannot use multiple group blocks.\n");
-		return false;
-	}
-
-	for (auto &child : entry.children)
-	{
-		if (!child.IsRecord())
-			continue;
-		if (AttributeCodes(child.id) != AttributeCodes::GroupCodeEntry)
-			continue;
+	if (AttributeCodes(child.id) != AttributeCodes::GroupCodeEntry)
+		return true;
 
-		if (child.ops.size() < 3)
-			return false;
+	if (child.ops.size() < 3)
+		return false;
 
-		uint64_t group_id = child.ops[0];
-		uint64_t index = child.ops[1];
+	uint64_t group_id = child.ops[0];
+	uint64_t index = child.ops[1];
 
-		if (index != ~0u) // Only care about attributes on function scope
-			continue;
+	if (index != ~0u) // Only care about attributes on function scope
+		return true;
 
-		auto &attr_group = attribute_groups[group_id];
+	auto &attr_group = attribute_groups[group_id];
 
-		size_t i = 2;
-		size_t count = child.ops.size();
-		while (i < count)
+	size_t i = 2;
+	size_t count = child.ops.size();
+	while (i < count)
+	{
+		if (child.ops[i] == 0) // Enum attribute, skip 2 values
 		{
-			if (child.ops[i] == 0) // Enum attribute, skip 2 values
-			{
-				i += 2;
-			}
-			else if (child.ops[i] == 1) // Integer attribute, skip 2 or 3 values
+			i += 2;
+		}
+		else if (child.ops[i] == 1) // Integer attribute, skip 2 or 3 values
+		{
+			i++;
+			if (i >= count)
+				return false;
+
+			switch (AttributeRecord(child.ops[i++]))
 			{
+			case AttributeRecord::ALIGNMENT:
+			case AttributeRecord::STACK_ALIGNMENT:
+			case AttributeRecord::ALLOC_SIZE:
+			case AttributeRecord::DEREFERENCEABLE:
+			case AttributeRecord::DEREFERENCEABLE_OR_NULL:
 				i++;
-				if (i >= count)
-					return false;
+				break;
 
-				switch (AttributeRecord(child.ops[i++]))
-				{
-				case AttributeRecord::ALIGNMENT:
-				case AttributeRecord::STACK_ALIGNMENT:
-				case AttributeRecord::ALLOC_SIZE:
-				case AttributeRecord::DEREFERENCEABLE:
-				case AttributeRecord::DEREFERENCEABLE_OR_NULL:
-					i++;
-					break;
-
-				default:
-					break;
-				}
+			default:
+				break;
 			}
-			else if (child.ops[i] == 3 || child.ops[i] == 4) // String attribute
-			{
-				bool has_value = child.ops[i++] == 4;
-				String kind, value;
+		}
+		else if (child.ops[i] == 3 || child.ops[i] == 4) // String attribute
+		{
+			bool has_value = child.ops[i++] == 4;
+			String kind, value;
+
+			while (child.ops[i] != 0 && i < count)
+				kind.push_back(char(child.ops[i++]));
+			if (child.ops[i] != 0)
+				return false;
+			i++;
 
+			if (has_value)
+			{
 				while (child.ops[i] != 0 && i < count)
-					kind.push_back(char(child.ops[i++]));
+					value.push_back(char(child.ops[i++]));
 				if (child.ops[i] != 0)
 					return false;
 				i++;
-
-				if (has_value)
-				{
-					while (child.ops[i] != 0 && i < count)
-						value.push_back(char(child.ops[i++]));
-					if (child.ops[i] != 0)
-						return false;
-					i++;
-				}
-				attr_group.emplace_back(std::move(kind), std::move(value));
-			}
-			else if (child.ops[i] == 5 || child.ops[i] == 6) // Value attribute
-			{
-				bool has_type = child.ops[i++] == 6;
-				if (i >= count)
-					return false;
-				if (AttributeRecord(child.ops[i++]) == AttributeRecord::BY_VAL && has_type)
-					i++;
 			}
-			else
+			attr_group.emplace_back(std::move(kind), std::move(value));
+		}
+		else if (child.ops[i] == 5 || child.ops[i] == 6) // Value attribute
+		{
+			bool has_type = child.ops[i++] == 6;
+			if (i >= count)
 				return false;
+			if (AttributeRecord(child.ops[i++]) == AttributeRecord::BY_VAL && has_type)
+				i++;
 		}
-
-		if (i > count)
+		else
 			return false;
 	}
 
-	return true;
-}
-
-bool ModuleParseContext::parse_function_child_block(const BlockOrRecord &entry)
-{
-	switch (KnownBlocks(entry.id))
-	{
-	case KnownBlocks::CONSTANTS_BLOCK:
-	{
-		for (auto &child : entry.children)
-			if (!parse_constants_record(child))
-				return false;
-		break;
-	}
-
-	case KnownBlocks::METADATA_ATTACHMENT:
-	{
-		for (auto &child : entry.children)
-			if (!parse_metadata_attachment_record(child))
-				return false;
-		break;
-	}
-
-	default:
-		break;
-	}
+	if (i > count)
+		return false;
 
 	return true;
 }
@@ -1837,6 +1793,23 @@ bool ModuleParseContext::resolve_forward_references()
 	return true;
 }
 
+void ModuleParseContext::classify_functions()
+{
+	// Names are only known once the module symbol table has been parsed.
+	for (auto *value : values)
+	{
+		auto *func = dyn_cast<Function>(value);
+		if (!func)
+			continue;
+
+		auto &name = func->getName();
+		if (name.compare(0, 5, "dx.op") == 0)
+			func->set_intrinsic_kind(Function::IntrinsicKind::DXILOp);
+		else if (name.compare(0, 5, "llvm.") == 0)
+			func->set_intrinsic_kind(Function::IntrinsicKind::LLVM);
+	}
+}
+
 bool ModuleParseContext::resolve_global_initializations()
 {
 	for (auto &ref : global_initializations)
@@ -1856,10 +1829,8 @@ bool ModuleParseContext::resolve_global_initializations()
 	return true;
 }
 
-bool ModuleParseContext::parse_function_body(const BlockOrRecord &entry)
+Function *ModuleParseContext::next_function_with_body()
 {
-	auto global_values = values;
-
 	// I think we are supposed to process functions in same order as the module declared them?
 	if (!seen_first_function_body)
 	{
@@ -1870,11 +1841,18 @@ bool ModuleParseContext::parse_function_body(const BlockOrRecord &entry)
 	if (functions_with_bodies.empty())
 	{
 		LOGE("No more functions to process?\n");
-		return false;
+		return nullptr;
 	}
 
-	function = functions_with_bodies.back();
+	auto *func = functions_with_bodies.back();
 	functions_with_bodies.pop_back();
+	return func;
+}
+
+bool ModuleParseContext::begin_function_body(Function *func)
+{
+	global_values = values;
+	function = func;
 
 	auto *func_type = function->getFunctionType();
 	for (unsigned i = 0; i < func_type->getNumParams(); i++)
@@ -1885,20 +1863,11 @@ bool ModuleParseContext::parse_function_body(const BlockOrRecord &entry)
 		add_value(arg);
 	}
 
-	for (auto &child : entry.children)
-	{
-		if (child.IsBlock())
-		{
-			if (!parse_function_child_block(child))
-				return false;
-		}
-		else
-		{
-			if (!parse_record(child))
-				return false;
-		}
-	}
+	return true;
+}
 
+bool ModuleParseContext::end_function_body()
+{
 	if (!resolve_forward_references())
 		return false;
 	if (!resolve_global_initializations())
@@ -1907,13 +1876,185 @@ bool ModuleParseContext::parse_function_body(const BlockOrRecord &entry)
 	function->set_basic_blocks(std::move(basic_blocks));
 	basic_blocks = {};
 	basic_block_index = 0;
-	module->add_function_implementation(function);
 
-	values = global_values;
+	// Lazily parsed functions were added to the module in the first pass.
+	if (!materialize_target)
+		module->add_function_implementation(function);
+
+	values = std::move(global_values);
+	global_values = {};
 	instructions.clear();
 	return true;
 }
 
+bool ModuleParseContext::materialize_function_body(Function *func, bool &parsed)
+{
+	parsed = false;
+	auto itr = lazy_function_offsets.find(func);
+	if (itr == lazy_function_offsets.end())
+		return true;
+
+	size_t offset = itr->second;
+	lazy_function_offsets.erase(itr);
+
+	// The body is decoded as if we were still inside the module block.
+	block_stack.clear();
+	block_stack.push_back(KnownBlocks::MODULE_BLOCK);
+	materialize_target = func;
+	bool ret = reader->VisitBlockAt(offset, *this);
+	materialize_target = nullptr;
+	block_stack.clear();
+
+	if (!ret)
+	{
+		LOGE("Failed to parse function body.\n");
+		return false;
+	}
+
+	parsed = true;
+	return true;
+}
+
+BitcodeVisitor::BlockAction ModuleParseContext::EnterBlock(const BlockOrRecord &block)
+{
+	auto id = KnownBlocks(block.id);
+
+	if (block_stack.empty())
+	{
+		// The top-level block must be MODULE_BLOCK.
+		if (id != KnownBlocks::MODULE_BLOCK)
+			return BlockAction::Stop;
+		block_stack.push_back(id);
+		return BlockAction::Enter;
+	}
+
+	auto parent = block_stack.back();
+	bool interesting = false;
+
+	if (id == KnownBlocks::BLOCKINFO)
+	{
+		// Always decoded since it defines abbreviations, but there is nothing for us in it.
+		interesting = true;
+	}
+	else if (parent == KnownBlocks::MODULE_BLOCK)
+	{
+		switch (id)
+		{
+		case KnownBlocks::VALUE_SYMTAB_BLOCK:
+		case KnownBlocks::TYPE_BLOCK:
+		case KnownBlocks::PARAMATTR_BLOCK:
+			interesting = true;
+			break;
+
+		case KnownBlocks::PARAMATTR_GROUP_BLOCK:
+			if (!attribute_groups.empty())
+			{
+				LOGE("Cannot use multiple group blocks.\n");
+				return BlockAction::Stop;
+			}
+			interesting = true;
+			break;
+
+		case KnownBlocks::CONSTANTS_BLOCK:
+			constant_type = nullptr;
+			interesting = true;
+			break;
+
+		case KnownBlocks::METADATA_BLOCK:
+			metadata_index = 0;
+			interesting = true;
+			break;
+
+		case KnownBlocks::FUNCTION_BLOCK:
+		{
+			Function *func = materialize_target;
+			if (!func)
+				func = next_function_with_body();
+			if (!func)
+				return BlockAction::Stop;
+
+			if (lazy_function_bodies && !materialize_target)
+			{
+				// Keep module iteration order the same as eager parsing.
+				lazy_function_offsets[func] = block.blockBitOffset;
+				module->add_function_implementation(func);
+				return BlockAction::Skip;
+			}
+
+			if (!begin_function_body(func))
+				return BlockAction::Stop;
+			interesting = true;
+			break;
+		}
+
+		default:
+			break;
+		}
+	}
+	else if (parent == KnownBlocks::FUNCTION_BLOCK)
+	{
+		// Constants declared in a function body keep the current SETTYPE.
+		interesting = id == KnownBlocks::CONSTANTS_BLOCK || id == KnownBlocks::METADATA_ATTACHMENT;
+	}
+	else if (parent == KnownBlocks::METADATA_BLOCK)
+	{
+		// Metadata indices count every entry in the block.
+		metadata_index++;
+	}
+
+	if (!interesting)
+		return BlockAction::Skip;
+
+	block_stack.push_back(id);
+	return BlockAction::Enter;
+}
+
+bool ModuleParseContext::VisitRecord(const BlockOrRecord &record)
+{
+	switch (block_stack.back())
+	{
+	case KnownBlocks::MODULE_BLOCK:
+		return parse_module_record(record);
+	case KnownBlocks::VALUE_SYMTAB_BLOCK:
+		return parse_value_symtab_record(record);
+	case KnownBlocks::TYPE_BLOCK:
+		return parse_type(record);
+	case KnownBlocks::CONSTANTS_BLOCK:
+		return parse_constants_record(record);
+	case KnownBlocks::METADATA_BLOCK:
+		return parse_metadata_record(record, metadata_index++);
+	case KnownBlocks::PARAMATTR_BLOCK:
+		return parse_paramattr_record(record);
+	case KnownBlocks::PARAMATTR_GROUP_BLOCK:
+		return parse_paramattr_group_record(record);
+	case KnownBlocks::FUNCTION_BLOCK:
+		return parse_record(record);
+	case KnownBlocks::METADATA_ATTACHMENT:
+		return parse_metadata_attachment_record(record);
+	default:
+		return true;
+	}
+}
+
+bool ModuleParseContext::LeaveBlock(const BlockOrRecord &block)
+{
+	auto id = block_stack.back();
+	block_stack.pop_back();
+
+	if (id == KnownBlocks::FUNCTION_BLOCK)
+	{
+		return end_function_body();
+	}
+	else if (id == KnownBlocks::MODULE_BLOCK)
+	{
+		classify_functions();
+		// If no function body was parsed, module level references are still pending.
+		return resolve_forward_references() && resolve_global_initializations();
+	}
+	else
+		return true;
+}
+
 bool ModuleParseContext::parse_type(const BlockOrRecord &child)
 {
 	Type *type = nullptr;
@@ -2041,33 +2182,22 @@ bool ModuleParseContext::parse_type(const BlockOrRecord &child)
 	return true;
 }
 
-bool ModuleParseContext::parse_types(const BlockOrRecord &entry)
-{
-	for (auto &child : entry.children)
-		if (!parse_type(child))
-			return false;
-	return true;
-}
-
-bool ModuleParseContext::parse_value_symtab(const BlockOrRecord &entry)
+bool ModuleParseContext::parse_value_symtab_record(const BlockOrRecord &symtab)
 {
-	for (auto &symtab : entry.children)
+	switch (ValueSymtabRecord(symtab.id))
 	{
-		switch (ValueSymtabRecord(symtab.id))
-		{
-		case ValueSymtabRecord::ENTRY:
-		{
-			if (symtab.ops.size() < 1)
-				return false;
+	case ValueSymtabRecord::ENTRY:
+	{
+		if (symtab.ops.size() < 1)
+			return false;
 
-			auto name = symtab.getString(1);
-			module->add_value_name(symtab.ops[0], name);
-			break;
-		}
+		auto name = symtab.getString(1);
+		module->add_value_name(symtab.ops[0], name);
+		break;
+	}
 
-		default:
-			break;
-		}
+	default:
+		break;
 	}
 	return true;
 }
@@ -2202,6 +2332,11 @@ void Module::add_function_implementation(Function *func)
 	functions.push_back(func);
 }
 
+void Module::set_lazy_parse_context(ModuleParseContext *parse_context)
+{
+	lazy_parse_context = parse_context;
+}
+
 void Module::add_global_variable(GlobalVariable *variable)
 {
 	globals.push_back(variable);
@@ -2297,94 +2432,84 @@ Vector<MDNode *>::const_iterator Module::unnamed_metadata_end() const
 	return unnamed_metadata.end();
 }
 
-Module *parseIR(LLVMContext &context, const void *data, size_t size)
+bool ModuleParseContext::parse_module_record(const BlockOrRecord &entry)
 {
-	LLVMBC::BitcodeReader reader(static_cast<const uint8_t *>(data), size);
-	auto toplevel = reader.ReadToplevelBlock();
-
-	// The top-level block must be MODULE_BLOCK.
-	if (KnownBlocks(toplevel.id) != KnownBlocks::MODULE_BLOCK)
-		return nullptr;
-
-	// We should have consumed all bits, only one top-level block.
-	if (!reader.AtEndOfStream())
-		return nullptr;
-
-	auto *module = context.construct<Module>(context);
+	switch (ModuleRecord(entry.id))
+	{
+	case ModuleRecord::VERSION:
+		return parse_version_record(entry);
+	case ModuleRecord::FUNCTION:
+		return parse_function_record(entry);
+	case ModuleRecord::GLOBAL_VARIABLE:
+		return parse_global_variable_record(entry);
+	default:
+		return true;
+	}
+}
 
-	ModuleParseContext parse_context;
-	parse_context.module = module;
-	parse_context.context = &module->getContext();
+bool Module::materialize(Function *func)
+{
+	if (!lazy_parse_context)
+		return true;
 
-	for (auto &child : toplevel.children)
+	// Callees have to be available as well, dx.op and other declarations are simply ignored.
+	Vector<Function *> work_list = { func };
+	while (!work_list.empty())
 	{
-		if (child.IsBlock())
-		{
-			switch (KnownBlocks(child.id))
-			{
-			case KnownBlocks::VALUE_SYMTAB_BLOCK:
-				if (!parse_context.parse_value_symtab(child))
-					return nullptr;
-				break;
+		auto *next = work_list.back();
+		work_list.pop_back();
 
-			case KnownBlocks::FUNCTION_BLOCK:
-				if (!parse_context.parse_function_body(child))
-					return nullptr;
-				break;
+		bool parsed;
+		if (!lazy_parse_context->materialize_function_body(next, parsed))
+			return false;
+		if (!parsed)
+			continue;
 
-			case KnownBlocks::TYPE_BLOCK:
-				if (!parse_context.parse_types(child))
-					return nullptr;
-				break;
+		for (auto &bb : *next)
+			for (auto &inst : bb)
+				if (auto *call = dyn_cast<CallInst>(&inst))
+					if (auto *callee = call->getCalledFunction())
+						work_list.push_back(callee);
+	}
 
-			case KnownBlocks::CONSTANTS_BLOCK:
-				if (!parse_context.parse_constants_block(child))
-					return nullptr;
-				break;
+	return true;
+}
 
-			case KnownBlocks::METADATA_BLOCK:
-				if (!parse_context.parse_metadata_block(child))
-					return nullptr;
-				break;
+bool Module::materialize_all()
+{
+	// Materialize in declaration order so IDs are assigned the same way as with eager parsing.
+	for (auto *func : functions)
+		if (!materialize(func))
+			return false;
+	return true;
+}
 
-			case KnownBlocks::PARAMATTR_BLOCK:
-				if (!parse_context.parse_paramattr_block(child))
-					return nullptr;
-				break;
+Module *parseIR(LLVMContext &context, const void *data, size_t size, bool lazy_function_bodies)
+{
+	auto *module = context.construct<Module>(context);
 
-			case KnownBlocks::PARAMATTR_GROUP_BLOCK:
-				if (!parse_context.parse_paramattr_group_block(child))
-					return nullptr;
-				break;
+	// A lazy parse context has to stay alive as long as the module.
+	ModuleParseContext eager_parse_context;
+	ModuleParseContext *parse_context = &eager_parse_context;
+	if (lazy_function_bodies)
+		parse_context = context.construct<ModuleParseContext>();
 
-			default:
-				break;
-			}
-		}
-		else
-		{
-			switch (ModuleRecord(child.id))
-			{
-			case ModuleRecord::VERSION:
-				if (!parse_context.parse_version_record(child))
-					return nullptr;
-				break;
+	parse_context->module = module;
+	parse_context->context = &module->getContext();
+	parse_context->lazy_function_bodies = lazy_function_bodies;
 
-			case ModuleRecord::FUNCTION:
-				if (!parse_context.parse_function_record(child))
-					return nullptr;
-				break;
+	// Records are handed to the parse context as they are decoded, we never build the full block tree.
+	parse_context->reader.reset(new BitcodeReader(static_cast<const uint8_t *>(data), size));
+	auto &reader = *parse_context->reader;
+	if (!reader.VisitToplevelBlock(*parse_context))
+		return nullptr;
 
-			case ModuleRecord::GLOBAL_VARIABLE:
-				if (!parse_context.parse_global_variable_record(child))
-					return nullptr;
-				break;
+	// We should have consumed all bits, only one top-level block.
+	if (!reader.AtEndOfStream())
+		return nullptr;
 
-			default:
-				break;
-			}
-		}
-	}
+	if (lazy_function_bodies)
+		module->set_lazy_parse_context(parse_context);
 
 	return module;
 }
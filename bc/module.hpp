@@ -46,6 +46,7 @@ class BasicBlock;
 class GlobalVariable;
 class NamedMDNode;
 class MDNode;
+struct ModuleParseContext;
 
 class Module
 {
@@ -59,11 +60,17 @@ public:
 
 	void add_value_name(uint64_t id, const String &name);
 	void add_function_implementation(Function *func);
+	void set_lazy_parse_context(ModuleParseContext *parse_context);
 	void add_global_variable(GlobalVariable *variable);
 	void add_named_metadata(const String &name, NamedMDNode *node);
 	void add_unnamed_metadata(MDNode *node);
 	const String &get_value_name(uint64_t id) const;
 
+	// With lazy parsing, function bodies are empty until materialized.
+	// Materializing a function also materializes every function it calls.
+	bool materialize(Function *func);
+	bool materialize_all();
+
 	Vector<Function *>::const_iterator begin() const;
 	Vector<Function *>::const_iterator end() const;
 
@@ -83,8 +90,10 @@ private:
 	UnorderedMap<uint64_t, String> value_symtab;
 	UnorderedMap<String, NamedMDNode *> named_metadata;
 	Vector<MDNode *> unnamed_metadata;
+	ModuleParseContext *lazy_parse_context = nullptr;
 };
 
-Module *parseIR(LLVMContext &context, const void *data, size_t size);
+// With lazy_function_bodies, data must stay alive until all required functions are materialized.
+Module *parseIR(LLVMContext &context, const void *data, size_t size, bool lazy_function_bodies = false);
 bool disassemble(Module &module, String &str);
 } // namespace LLVMBC
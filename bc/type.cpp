@@ -29,6 +29,29 @@
 
 namespace LLVMBC
 {
+namespace
+{
+struct TypeKeyHasher
+{
+	explicit TypeKeyHasher(Type::TypeID id)
+	{
+		u64(uint64_t(id));
+	}
+
+	void u64(uint64_t v)
+	{
+		h = (h * 0x100000001b3ull) ^ v;
+	}
+
+	void type(const Type *t)
+	{
+		u64(uint64_t(reinterpret_cast<uintptr_t>(t)));
+	}
+
+	uint64_t h = 0xcbf29ce484222325ull;
+};
+}
+
 PointerType::PointerType(Type *type, uint32_t addr_space)
     : Type(type->getContext(), TypeID::PointerTyID)
     , contained_type(type)
@@ -39,7 +62,11 @@ PointerType::PointerType(Type *type, uint32_t addr_space)
 PointerType *PointerType::get(Type *pointee, unsigned addr_space)
 {
 	auto &context = pointee->getContext();
-	auto &cache = context.get_type_cache();
+	TypeKeyHasher hasher(TypeID::PointerTyID);
+	hasher.type(pointee);
+	hasher.u64(addr_space);
+
+	auto &cache = context.get_type_cache(hasher.h);
 	for (auto *type : cache)
 	{
 		if (type->getTypeID() == TypeID::PointerTyID)
@@ -75,7 +102,11 @@ ArrayType::ArrayType(Type *type, uint64_t elements_)
 ArrayType *ArrayType::get(Type *element, uint64_t size)
 {
 	auto &context = element->getContext();
-	auto &cache = context.get_type_cache();
+	TypeKeyHasher hasher(TypeID::ArrayTyID);
+	hasher.type(element);
+	hasher.u64(size);
+
+	auto &cache = context.get_type_cache(hasher.h);
 	for (auto *type : cache)
 	{
 		if (type->getTypeID() == TypeID::ArrayTyID)
@@ -111,7 +142,11 @@ Type *VectorType::getElementType() const
 VectorType *VectorType::get(unsigned vector_size, Type *element)
 {
 	auto &context = element->getContext();
-	auto &cache = context.get_type_cache();
+	TypeKeyHasher hasher(TypeID::VectorTyID);
+	hasher.type(element);
+	hasher.u64(vector_size);
+
+	auto &cache = context.get_type_cache(hasher.h);
 	for (auto *type : cache)
 	{
 		if (type->getTypeID() == TypeID::VectorTyID)
@@ -188,7 +223,12 @@ Type *StructType::getElementType(unsigned N) const
 
 StructType *StructType::get(LLVMContext &context, Vector<Type *> member_types)
 {
-	auto &cache = context.get_type_cache();
+	TypeKeyHasher hasher(TypeID::StructTyID);
+	hasher.u64(member_types.size());
+	for (auto *member : member_types)
+		hasher.type(member);
+
+	auto &cache = context.get_type_cache(hasher.h);
 	for (auto *type : cache)
 	{
 		if (type->getTypeID() == TypeID::StructTyID)
@@ -265,7 +305,10 @@ Type::TypeID Type::getTypeID() const
 
 Type *Type::getIntTy(LLVMContext &context, uint32_t width)
 {
-	auto &cache = context.get_type_cache();
+	TypeKeyHasher hasher(TypeID::IntegerTyID);
+	hasher.u64(width);
+
+	auto &cache = context.get_type_cache(hasher.h);
 	for (auto *type : cache)
 		if (type->getTypeID() == TypeID::IntegerTyID && cast<IntegerType>(type)->getBitWidth() == width)
 			return type;
@@ -277,7 +320,7 @@ Type *Type::getIntTy(LLVMContext &context, uint32_t width)
 
 Type *Type::getTy(LLVMContext &context, TypeID id)
 {
-	auto &cache = context.get_type_cache();
+	auto &cache = context.get_type_cache(TypeKeyHasher(id).h);
 	for (auto *type : cache)
 		if (type->getTypeID() == id)
 			return type;
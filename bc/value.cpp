@@ -48,6 +48,16 @@ uint64_t Value::get_tween_id() const
 	return tween_id;
 }
 
+void Value::set_dense_id(uint32_t id)
+{
+	dense_id = id;
+}
+
+uint32_t Value::get_dense_id() const
+{
+	return dense_id;
+}
+
 Type *Value::getType() const
 {
 	return type;
@@ -90,9 +90,14 @@ public:
 	void set_tween_id(uint64_t id);
 	uint64_t get_tween_id() const;
 
+	// Unique and dense within an LLVMContext, suitable for indexing flat side tables.
+	void set_dense_id(uint32_t id);
+	uint32_t get_dense_id() const;
+
 protected:
 	Type *type;
 	ValueKind kind;
+	uint32_t dense_id = 0;
 	uint64_t tween_id = 0;
 };
 
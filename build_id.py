@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+#
+# SPDX-License-Identifier: MIT
+#
+# Permission is hereby granted, free of charge, to any person obtaining
+# a copy of this software and associated documentation files (the
+# "Software"), to deal in the Software without restriction, including
+# without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to
+# the following conditions:
+#
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+# CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+# SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+# Writes a header with a hash of every source which can affect converter output.
+# Runs on every build, but only touches the header when the hash changes.
+# Conversion cache entries are keyed on it, see compute_conversion_base_key().
+
+import argparse
+import hashlib
+import os
+
+SOURCE_EXTENSIONS = ('.c', '.cpp', '.h', '.hpp')
+
+# Directories scanned recursively, relative to the source root. The root itself is not recursed into.
+SOURCE_DIRECTORIES = [
+    'bc',
+    'debug',
+    'opcodes',
+    'util',
+    'third_party/bc-decoder',
+    'third_party/glslang-spirv',
+    'third_party/spirv-headers/include',
+]
+
+def gather_sources(root):
+    sources = [f for f in os.listdir(root) if f.endswith(SOURCE_EXTENSIONS) and os.path.isfile(os.path.join(root, f))]
+    for directory in SOURCE_DIRECTORIES:
+        for dirpath, _, filenames in os.walk(os.path.join(root, directory)):
+            for f in filenames:
+                if f.endswith(SOURCE_EXTENSIONS):
+                    sources.append(os.path.relpath(os.path.join(dirpath, f), root))
+    # Sort on the normalized path so the hash does not depend on the host.
+    return sorted(sources, key = lambda path: path.replace(os.sep, '/'))
+
+def main():
+    parser = argparse.ArgumentParser(description = 'Generates the dxil-spirv build ID header.')
+    parser.add_argument('--source-root', required = True, help = 'Root of the dxil-spirv source tree')
+    parser.add_argument('--output', required = True, help = 'Header to write')
+    args = parser.parse_args()
+
+    h = hashlib.sha256()
+    for path in gather_sources(args.source_root):
+        h.update(path.replace(os.sep, '/').encode('utf-8'))
+        h.update(b'\0')
+        with open(os.path.join(args.source_root, path), 'rb') as f:
+            h.update(f.read())
+        h.update(b'\0')
+
+    header = '// Generated by build_id.py, do not edit.\n#define DXIL_SPV_BUILD_ID "{}"\n'.format(h.hexdigest())
+
+    try:
+        with open(args.output, 'r') as f:
+            if f.read() == header:
+                return
+    except OSError:
+        pass
+
+    with open(args.output, 'w') as f:
+        f.write(header)
+
+if __name__ == '__main__':
+    main()
@@ -28,6 +28,8 @@
 #include "node.hpp"
 #include "node_pool.hpp"
 #include "spirv_module.hpp"
+#include "bitset_union.hpp"
+#include "timer.hpp"
 #include <algorithm>
 #include <assert.h>
 
@@ -40,6 +42,11 @@ CFGStructurizer::CFGStructurizer(CFGNode *entry, CFGNodePool &pool_, SPIRVModule
 {
 	exit_block = pool.create_node();
 	exit_block->name = "EXIT";
+
+	// Debug mode which always rebuilds CFG analysis from scratch,
+	// and verifies that skipped rebuilds would have yielded the same result.
+	if (const char *env = getenv("DXIL_SPIRV_VALIDATE_CFG"))
+		validate_cfg_analysis = strtoul(env, nullptr, 0) != 0;
 }
 
 void CFGStructurizer::log_cfg_graphviz(const char *path) const
@@ -504,10 +511,10 @@ bool CFGStructurizer::rewrite_rov_lock_region()
 		scrub_rov_lock_regions(node, node == idom, node == pdom);
 
 	if (!begin_block_has_lock)
-		idom->ir.operations.push_back(module.allocate_op(spv::OpBeginInvocationInterlockEXT));
+		idom->ir.operations.push_back(allocate_op(spv::OpBeginInvocationInterlockEXT));
 
 	if (!end_block_has_lock)
-		pdom->ir.operations.insert(pdom->ir.operations.begin(), module.allocate_op(spv::OpEndInvocationInterlockEXT));
+		pdom->ir.operations.insert(pdom->ir.operations.begin(), allocate_op(spv::OpEndInvocationInterlockEXT));
 
 	return true;
 }
@@ -518,15 +525,74 @@ void CFGStructurizer::rewrite_multiple_back_edges()
 	visit_for_back_edge_analysis(*entry_block);
 }
 
+// Snapshots the running counters and adds the deltas to a pass on scope exit.
+class CFGStructurizer::PassScope
+{
+public:
+	PassScope(CFGStructurizer &self_, StructurizerPass pass)
+	    : self(self_)
+	    , stats(self_.pass_stats[unsigned(pass)])
+	    , nodes_created(self.pool.get_node_count())
+	    , ladder_blocks(self.num_ladder_blocks)
+	    , helper_blocks(self.num_helper_blocks)
+	    , duplicated_nodes(self.num_duplicated_nodes)
+	    , recompute_cfg_calls(self.num_recompute_cfg_calls)
+	    , recompute_cfg_splices(self.num_recompute_cfg_splices)
+	    , recompute_cfg_rebuilds(self.num_recompute_cfg_rebuilds)
+	    , start_ns(get_current_time_nsecs())
+	{
+	}
+
+	~PassScope()
+	{
+		stats.time_ns += get_current_time_nsecs() - start_ns;
+		stats.invocations++;
+		stats.nodes_created += unsigned(self.pool.get_node_count() - nodes_created);
+		stats.ladder_blocks += self.num_ladder_blocks - ladder_blocks;
+		stats.helper_blocks += self.num_helper_blocks - helper_blocks;
+		stats.duplicated_nodes += self.num_duplicated_nodes - duplicated_nodes;
+		stats.recompute_cfg_calls += self.num_recompute_cfg_calls - recompute_cfg_calls;
+		stats.recompute_cfg_splices += self.num_recompute_cfg_splices - recompute_cfg_splices;
+		stats.recompute_cfg_rebuilds += self.num_recompute_cfg_rebuilds - recompute_cfg_rebuilds;
+	}
+
+	PassScope(const PassScope &) = delete;
+	void operator=(const PassScope &) = delete;
+
+private:
+	CFGStructurizer &self;
+	StructurizerPassStats &stats;
+	size_t nodes_created;
+	unsigned ladder_blocks;
+	unsigned helper_blocks;
+	unsigned duplicated_nodes;
+	unsigned recompute_cfg_calls;
+	unsigned recompute_cfg_splices;
+	unsigned recompute_cfg_rebuilds;
+	uint64_t start_ns;
+};
+
+template <typename Op>
+auto CFGStructurizer::run_pass(StructurizerPass pass, const Op &op) -> decltype(op())
+{
+	// Once over the memory limit, skip remaining passes. Looping passes report no progress and stop.
+	if (thread_allocator_out_of_memory())
+		return decltype(op())();
+
+	PassScope scope(*this, pass);
+	return op();
+}
+
 bool CFGStructurizer::run()
 {
+	ScopedAllocatorTag tag(AllocatorTag::Structurizer);
 	String graphviz_path;
 	if (const char *env = getenv("DXIL_SPIRV_GRAPHVIZ_PATH"))
 		graphviz_path = env;
 
 	// We make the assumption during traversal that there is only one back edge.
 	// Fix this up here.
-	rewrite_multiple_back_edges();
+	run_pass(StructurizerPass::RewriteMultipleBackEdges, [&]() { rewrite_multiple_back_edges(); });
 
 	//log_cfg("Input state");
 	if (!graphviz_path.empty())
@@ -537,9 +603,9 @@ bool CFGStructurizer::run()
 		log_cfg_graphviz(graphviz_input.c_str());
 	}
 
-	recompute_cfg();
+	run_pass(StructurizerPass::RecomputeCFG, [&]() { recompute_cfg(); });
 
-	cleanup_breaking_phi_constructs();
+	run_pass(StructurizerPass::CleanupBreakingPhiConstructs, [&]() { cleanup_breaking_phi_constructs(); });
 
 	if (!graphviz_path.empty())
 	{
@@ -547,22 +613,24 @@ bool CFGStructurizer::run()
 		log_cfg_graphviz(graphviz_split.c_str());
 	}
 
-	while (cleanup_breaking_return_constructs())
+	while (run_pass(StructurizerPass::CleanupBreakingReturnConstructs,
+	                [&]() { return cleanup_breaking_return_constructs(); }))
 	{
 		auto graphviz_split = graphviz_path + ".break-return";
 		log_cfg_graphviz(graphviz_split.c_str());
 	}
 
-	create_continue_block_ladders();
+	run_pass(StructurizerPass::CreateContinueBlockLadders, [&]() { create_continue_block_ladders(); });
 
-	while (serialize_interleaved_merge_scopes())
+	while (run_pass(StructurizerPass::SerializeInterleavedMergeScopes,
+	                [&]() { return serialize_interleaved_merge_scopes(); }))
 	{
 		auto graphviz_split = graphviz_path + ".serialize";
 		log_cfg_graphviz(graphviz_split.c_str());
 	}
 
-	split_merge_scopes();
-	recompute_cfg();
+	run_pass(StructurizerPass::SplitMergeScopes, [&]() { split_merge_scopes(); });
+	run_pass(StructurizerPass::RecomputeCFG, [&]() { recompute_cfg(); });
 
 	//log_cfg("Split merge scopes");
 	if (!graphviz_path.empty())
@@ -574,7 +642,7 @@ bool CFGStructurizer::run()
 	// We will have generated lots of ladder blocks
 	// which might cause issues with further analysis, so
 	// nuke them as required.
-	eliminate_degenerate_blocks();
+	run_pass(StructurizerPass::EliminateDegenerateBlocks, [&]() { eliminate_degenerate_blocks(); });
 
 	if (!graphviz_path.empty())
 	{
@@ -584,7 +652,8 @@ bool CFGStructurizer::run()
 
 	// Similar to cleanup_breaking_phi_constructs() in spirit,
 	// but here we are forced to duplicate code blocks to make it work.
-	duplicate_impossible_merge_constructs();
+	run_pass(StructurizerPass::DuplicateImpossibleMergeConstructs,
+	         [&]() { duplicate_impossible_merge_constructs(); });
 
 	//log_cfg("Split impossible merges");
 	if (!graphviz_path.empty())
@@ -593,7 +662,7 @@ bool CFGStructurizer::run()
 		log_cfg_graphviz(graphviz_split.c_str());
 	}
 
-	while (rewrite_transposed_loops())
+	while (run_pass(StructurizerPass::RewriteTransposedLoops, [&]() { return rewrite_transposed_loops(); }))
 	{
 		auto graphviz_split = graphviz_path + ".transpose-loop-rewrite";
 		log_cfg_graphviz(graphviz_split.c_str());
@@ -601,7 +670,8 @@ bool CFGStructurizer::run()
 
 	//LOGI("=== Structurize pass ===\n");
 	structurize(0);
-	update_structured_loop_merge_targets();
+	run_pass(StructurizerPass::UpdateStructuredLoopMergeTargets,
+	         [&]() { update_structured_loop_merge_targets(); });
 
 	//log_cfg("Structurize pass 0");
 	if (!graphviz_path.empty())
@@ -613,7 +683,7 @@ bool CFGStructurizer::run()
 	// We will have generated lots of ladder blocks
 	// which might cause issues with further analysis, so
 	// nuke them as required.
-	eliminate_degenerate_blocks();
+	run_pass(StructurizerPass::EliminateDegenerateBlocks, [&]() { eliminate_degenerate_blocks(); });
 
 	//log_cfg("Split merge scopes");
 	if (!graphviz_path.empty())
@@ -632,7 +702,7 @@ bool CFGStructurizer::run()
 	}
 
 	bool need_restructure = false;
-	while (rewrite_invalid_loop_breaks())
+	while (run_pass(StructurizerPass::RewriteInvalidLoopBreaks, [&]() { return rewrite_invalid_loop_breaks(); }))
 	{
 		if (!graphviz_path.empty())
 		{
@@ -656,7 +726,13 @@ bool CFGStructurizer::run()
 		log_cfg_graphviz(graphviz_final.c_str());
 	}
 
-	insert_phi();
+	run_pass(StructurizerPass::InsertPhi, [&]() { insert_phi(); });
+
+	if (thread_allocator_out_of_memory() || deferred_operations_failed)
+	{
+		LOGE("Allocator context ran out of memory while structurizing.\n");
+		return false;
+	}
 
 	return true;
 }
@@ -666,6 +742,282 @@ CFGNode *CFGStructurizer::get_entry_block() const
 	return entry_block;
 }
 
+unsigned CFGStructurizer::get_num_ladder_blocks() const
+{
+	return num_ladder_blocks;
+}
+
+unsigned CFGStructurizer::get_num_path_query_hits() const
+{
+	return num_path_query_hits;
+}
+
+unsigned CFGStructurizer::get_num_path_query_misses() const
+{
+	return num_path_query_misses;
+}
+
+const StructurizerPassStats &CFGStructurizer::get_pass_stats(StructurizerPass pass) const
+{
+	assert(pass < StructurizerPass::Count);
+	return pass_stats[unsigned(pass)];
+}
+
+const char *CFGStructurizer::get_pass_name(StructurizerPass pass)
+{
+	switch (pass)
+	{
+	case StructurizerPass::RewriteMultipleBackEdges:
+		return "rewrite_multiple_back_edges";
+	case StructurizerPass::RecomputeCFG:
+		return "recompute_cfg";
+	case StructurizerPass::CleanupBreakingPhiConstructs:
+		return "cleanup_breaking_phi_constructs";
+	case StructurizerPass::CleanupBreakingReturnConstructs:
+		return "cleanup_breaking_return_constructs";
+	case StructurizerPass::CreateContinueBlockLadders:
+		return "create_continue_block_ladders";
+	case StructurizerPass::SerializeInterleavedMergeScopes:
+		return "serialize_interleaved_merge_scopes";
+	case StructurizerPass::SplitMergeScopes:
+		return "split_merge_scopes";
+	case StructurizerPass::EliminateDegenerateBlocks:
+		return "eliminate_degenerate_blocks";
+	case StructurizerPass::DuplicateImpossibleMergeConstructs:
+		return "duplicate_impossible_merge_constructs";
+	case StructurizerPass::RewriteTransposedLoops:
+		return "rewrite_transposed_loops";
+	case StructurizerPass::FindSwitchBlocks:
+		return "find_switch_blocks";
+	case StructurizerPass::FindLoops:
+		return "find_loops";
+	case StructurizerPass::FindSelectionMerges:
+		return "find_selection_merges";
+	case StructurizerPass::FixupBrokenSelectionMerges:
+		return "fixup_broken_selection_merges";
+	case StructurizerPass::SplitMergeBlocks:
+		return "split_merge_blocks";
+	case StructurizerPass::UpdateStructuredLoopMergeTargets:
+		return "update_structured_loop_merge_targets";
+	case StructurizerPass::RewriteInvalidLoopBreaks:
+		return "rewrite_invalid_loop_breaks";
+	case StructurizerPass::InsertPhi:
+		return "insert_phi";
+	default:
+		return "unknown";
+	}
+}
+
+void CFGStructurizer::set_defer_module_calls(bool enable)
+{
+	defer_module_calls = enable;
+}
+
+spv::Id CFGStructurizer::record_deferred_call(DeferredModuleCall::Type type, uint32_t arg0, uint32_t arg1)
+{
+	spv::Id result = 0;
+	if (type != DeferredModuleCall::Type::AddName)
+	{
+		result = DeferredIdBase + spv::Id(deferred_ids.size());
+		deferred_ids.push_back(0);
+	}
+
+	deferred_calls.push_back({ type, arg0, arg1, result });
+	return result;
+}
+
+spv::Id CFGStructurizer::resolve_deferred_id(spv::Id id) const
+{
+	if (id >= DeferredIdBase && id - DeferredIdBase < deferred_ids.size())
+		return deferred_ids[id - DeferredIdBase];
+	else
+		return id;
+}
+
+void CFGStructurizer::commit_deferred_module_calls()
+{
+	auto &builder = module.get_builder();
+	defer_module_calls = false;
+
+	for (auto &call : deferred_calls)
+	{
+		spv::Id id = 0;
+		switch (call.type)
+		{
+		case DeferredModuleCall::Type::AllocateId:
+			id = module.allocate_id();
+			break;
+
+		case DeferredModuleCall::Type::CreateVariable:
+			id = module.create_variable(spv::StorageClass(call.arg0), resolve_deferred_id(call.arg1));
+			break;
+
+		case DeferredModuleCall::Type::CreateUndefined:
+			id = builder.createUndefined(resolve_deferred_id(call.arg0));
+			break;
+
+		case DeferredModuleCall::Type::MakeBoolType:
+			id = builder.makeBoolType();
+			break;
+
+		case DeferredModuleCall::Type::MakeIntType:
+			id = builder.makeIntType(int(call.arg0));
+			break;
+
+		case DeferredModuleCall::Type::MakeBoolConstant:
+			id = builder.makeBoolConstant(call.arg0 != 0);
+			break;
+
+		case DeferredModuleCall::Type::MakeUintConstant:
+			id = builder.makeUintConstant(call.arg0);
+			break;
+
+		case DeferredModuleCall::Type::MakeIntConstant:
+			id = builder.makeIntConstant(int32_t(call.arg0));
+			break;
+
+		case DeferredModuleCall::Type::AddName:
+			builder.addName(resolve_deferred_id(call.arg0), deferred_names[call.arg1].c_str());
+			break;
+		}
+
+		if (call.result)
+			deferred_ids[call.result - DeferredIdBase] = id;
+	}
+
+	// Placeholders can only have ended up in the IR of this function.
+	pool.for_each_node([this](CFGNode &node) {
+		auto &ir = node.ir;
+		for (auto &phi : ir.phi)
+		{
+			phi.id = resolve_deferred_id(phi.id);
+			phi.type_id = resolve_deferred_id(phi.type_id);
+			for (auto &incoming : phi.incoming)
+				incoming.id = resolve_deferred_id(incoming.id);
+		}
+
+		for (auto *op : ir.operations)
+		{
+			op->id = resolve_deferred_id(op->id);
+			op->type_id = resolve_deferred_id(op->type_id);
+			for (unsigned i = 0; i < op->num_arguments; i++)
+				if ((op->literal_mask & (1u << i)) == 0)
+					op->arguments[i] = resolve_deferred_id(op->arguments[i]);
+		}
+
+		ir.terminator.conditional_id = resolve_deferred_id(ir.terminator.conditional_id);
+		ir.terminator.return_value = resolve_deferred_id(ir.terminator.return_value);
+	});
+
+	deferred_calls.clear();
+	deferred_names.clear();
+	deferred_ids.clear();
+}
+
+spv::Id CFGStructurizer::allocate_id()
+{
+	if (defer_module_calls)
+		return record_deferred_call(DeferredModuleCall::Type::AllocateId);
+	else
+		return module.allocate_id();
+}
+
+Operation *CFGStructurizer::allocate_op(spv::Op op)
+{
+	if (defer_module_calls)
+	{
+		auto *ret = deferred_operations.allocate(op);
+		return ret ? ret : discard_deferred_op(Operation(op));
+	}
+	else
+		return module.allocate_op(op);
+}
+
+Operation *CFGStructurizer::allocate_op(spv::Op op, spv::Id id, spv::Id type_id)
+{
+	if (defer_module_calls)
+	{
+		auto *ret = deferred_operations.allocate(op, id, type_id);
+		return ret ? ret : discard_deferred_op(Operation(op, id, type_id));
+	}
+	else
+		return module.allocate_op(op, id, type_id);
+}
+
+Operation *CFGStructurizer::discard_deferred_op(const Operation &op)
+{
+	deferred_operations_failed = true;
+	discarded_op = op;
+	return &discarded_op;
+}
+
+spv::Id CFGStructurizer::create_variable(spv::StorageClass storage, spv::Id type)
+{
+	if (defer_module_calls)
+		return record_deferred_call(DeferredModuleCall::Type::CreateVariable, storage, type);
+	else
+		return module.create_variable(storage, type);
+}
+
+spv::Id CFGStructurizer::create_undefined(spv::Id type)
+{
+	if (defer_module_calls)
+		return record_deferred_call(DeferredModuleCall::Type::CreateUndefined, type);
+	else
+		return module.get_builder().createUndefined(type);
+}
+
+spv::Id CFGStructurizer::make_bool_type()
+{
+	if (defer_module_calls)
+		return record_deferred_call(DeferredModuleCall::Type::MakeBoolType);
+	else
+		return module.get_builder().makeBoolType();
+}
+
+spv::Id CFGStructurizer::make_int_type(uint32_t width)
+{
+	if (defer_module_calls)
+		return record_deferred_call(DeferredModuleCall::Type::MakeIntType, width);
+	else
+		return module.get_builder().makeIntType(int(width));
+}
+
+spv::Id CFGStructurizer::make_bool_constant(bool value)
+{
+	if (defer_module_calls)
+		return record_deferred_call(DeferredModuleCall::Type::MakeBoolConstant, uint32_t(value));
+	else
+		return module.get_builder().makeBoolConstant(value);
+}
+
+spv::Id CFGStructurizer::make_uint_constant(uint32_t value)
+{
+	if (defer_module_calls)
+		return record_deferred_call(DeferredModuleCall::Type::MakeUintConstant, value);
+	else
+		return module.get_builder().makeUintConstant(value);
+}
+
+spv::Id CFGStructurizer::make_int_constant(int32_t value)
+{
+	if (defer_module_calls)
+		return record_deferred_call(DeferredModuleCall::Type::MakeIntConstant, uint32_t(value));
+	else
+		return module.get_builder().makeIntConstant(value);
+}
+
+void CFGStructurizer::add_name(spv::Id id, const String &name)
+{
+	if (defer_module_calls)
+	{
+		record_deferred_call(DeferredModuleCall::Type::AddName, id, uint32_t(deferred_names.size()));
+		deferred_names.push_back(name);
+	}
+	else
+		module.get_builder().addName(id, name.c_str());
+}
+
 static bool block_is_control_dependent(const CFGNode *node)
 {
 	for (auto *op : node->ir.operations)
@@ -792,9 +1144,9 @@ Operation *CFGStructurizer::duplicate_op(Operation *op, UnorderedMap<spv::Id, sp
 {
 	Operation *duplicated_op;
 	if (op->id)
-		duplicated_op = module.allocate_op(op->op, module.allocate_id(), op->type_id);
+		duplicated_op = allocate_op(op->op, allocate_id(), op->type_id);
 	else
-		duplicated_op = module.allocate_op(op->op);
+		duplicated_op = allocate_op(op->op);
 
 	for (unsigned i = 0; i < op->num_arguments; i++)
 	{
@@ -874,6 +1226,7 @@ void CFGStructurizer::duplicate_node(CFGNode *node)
 		// Since we only have one pred now, we can resolve PHIs directly.
 		auto *block = pool.create_node();
 		block->name = node->name + ".dup." + pred->name;
+		num_duplicated_nodes++;
 		block->ir.terminator.type = Terminator::Type::Branch;
 		block->ir.terminator.direct_block = succ;
 		block->immediate_post_dominator = succ;
@@ -969,6 +1322,10 @@ void CFGStructurizer::duplicate_impossible_merge_constructs()
 
 	for (auto *node : duplicate_queue)
 	{
+		// Duplication can blow up on pathological CFGs.
+		if (thread_allocator_out_of_memory())
+			break;
+
 		if (!can_duplicate_phis(node))
 		{
 			// A block could be subtly load bearing, in that if we split the node, it becomes impossible to resolve
@@ -1193,9 +1550,9 @@ void CFGStructurizer::fixup_broken_value_dominance()
 	for (auto &rewrite : rewrites)
 	{
 		auto &orig = origin[rewrite.id];
-		spv::Id alloca_var_id = module.create_variable(spv::StorageClassFunction, orig.type_id);
+		spv::Id alloca_var_id = create_variable(spv::StorageClassFunction, orig.type_id);
 
-		auto *store_op = module.allocate_op(spv::OpStore);
+		auto *store_op = allocate_op(spv::OpStore);
 		store_op->add_id(alloca_var_id);
 		store_op->add_id(rewrite.id);
 		orig.node->ir.operations.push_back(store_op);
@@ -1204,8 +1561,8 @@ void CFGStructurizer::fixup_broken_value_dominance()
 		// Rewrite all ID references to point to the loaded value.
 		for (auto *consumer : *rewrite.consumers)
 		{
-			spv::Id loaded_id = module.allocate_id();
-			auto *load_op = module.allocate_op(spv::OpLoad, loaded_id, orig.type_id);
+			spv::Id loaded_id = allocate_id();
+			auto *load_op = allocate_op(spv::OpLoad, loaded_id, orig.type_id);
 			load_op->add_id(alloca_var_id);
 
 			rewrite_consumed_ids(consumer->ir, rewrite.id, loaded_id);
@@ -1232,6 +1589,7 @@ void CFGStructurizer::insert_phi()
 			auto itr = std::find(succ->pred.begin(), succ->pred.end(), back_edge);
 			assert(itr != succ->pred.end());
 			succ->pred.erase(itr);
+			pool.invalidate_cfg();
 			succ->recompute_immediate_dominator();
 		}
 	}
@@ -1379,7 +1737,7 @@ bool CFGStructurizer::can_complete_phi_insertion(const PHI &phi, const CFGNode *
 
 bool CFGStructurizer::query_reachability_through_back_edges(const CFGNode &from, const CFGNode &to) const
 {
-	if (to.dominates(&from))
+	if (query_dominance(to, from))
 	{
 		// If we're dominated by end node, only way we can reach is through a back edge.
 		return to.pred_back_edge && query_reachability(from, *to.pred_back_edge);
@@ -1449,7 +1807,7 @@ void CFGStructurizer::insert_phi(PHINode &node)
 	auto &phi = node.block->ir.phi[node.phi_index];
 	auto &incoming_values = phi.incoming;
 
-	UnorderedSet<const CFGNode *> placed_frontiers;
+	CFGNodeVisitSet placed_frontiers(pool);
 
 	for (;;)
 	{
@@ -1511,7 +1869,7 @@ void CFGStructurizer::insert_phi(PHINode &node)
 				auto itr = find_incoming_value(frontier->pred.front(), incoming_values);
 				assert(itr != incoming_values.end());
 
-				auto *op = module.allocate_op(spv::OpCopyObject, phi.id, phi.type_id);
+				auto *op = allocate_op(spv::OpCopyObject, phi.id, phi.type_id);
 				op->add_id(itr->id);
 				frontier->pred.front()->ir.operations.push_back(op);
 
@@ -1531,7 +1889,7 @@ void CFGStructurizer::insert_phi(PHINode &node)
 					if (itr != incoming_values.end())
 						value.id = itr->id;
 					else
-						value.id = module.get_builder().createUndefined(phi.type_id);
+						value.id = create_undefined(phi.type_id);
 
 					value.block = input;
 					final_incoming.push_back(value);
@@ -1545,7 +1903,7 @@ void CFGStructurizer::insert_phi(PHINode &node)
 					if (itr != incoming_values.end())
 						value.id = itr->id;
 					else
-						value.id = module.get_builder().createUndefined(phi.type_id);
+						value.id = create_undefined(phi.type_id);
 
 					value.block = frontier->pred_back_edge;
 					final_incoming.push_back(value);
@@ -1565,10 +1923,10 @@ void CFGStructurizer::insert_phi(PHINode &node)
 
 		// Remove old inputs.
 		PHI frontier_phi;
-		frontier_phi.id = module.allocate_id();
+		frontier_phi.id = allocate_id();
 		frontier_phi.type_id = phi.type_id;
 		frontier_phi.relaxed = phi.relaxed;
-		module.get_builder().addName(frontier_phi.id, (String("frontier_phi_") + frontier->name).c_str());
+		add_name(frontier_phi.id, String("frontier_phi_") + frontier->name);
 
 		assert(!frontier->pred_back_edge);
 		for (auto *input : frontier->pred)
@@ -1596,7 +1954,7 @@ void CFGStructurizer::insert_phi(PHINode &node)
 #endif
 				// If there is no incoming value, we need to hallucinate an undefined value.
 				IncomingValue value = {};
-				value.id = module.get_builder().createUndefined(phi.type_id);
+				value.id = create_undefined(phi.type_id);
 				value.block = input;
 				frontier_phi.incoming.push_back(value);
 			}
@@ -1695,13 +2053,13 @@ void CFGStructurizer::insert_phi(PHINode &node)
 					if (input_is_normal_edge)
 						normal_branch_count++;
 
-					value.id = module.get_builder().makeBoolConstant(input_is_normal_edge);
+					value.id = make_bool_constant(input_is_normal_edge);
 				}
 				else
 				{
 					// The input is undefined, so we don't really care. Just treat this as a normal edge.
 					normal_branch_count++;
-					value.id = module.get_builder().makeBoolConstant(true);
+					value.id = make_bool_constant(true);
 				}
 
 				value.block = input;
@@ -1710,18 +2068,17 @@ void CFGStructurizer::insert_phi(PHINode &node)
 
 			if (normal_branch_count != frontier->pred.size())
 			{
-				merge_phi.id = module.allocate_id();
-				merge_phi.type_id = module.get_builder().makeBoolType();
+				merge_phi.id = allocate_id();
+				merge_phi.type_id = make_bool_type();
 
-				Operation *op = module.allocate_op(spv::OpSelect, module.allocate_id(), phi.type_id);
+				Operation *op = allocate_op(spv::OpSelect, allocate_id(), phi.type_id);
 				op->add_id(merge_phi.id);
 				op->add_id(dominated_incoming->id);
 				op->add_id(frontier_phi.id);
 				dominated_incoming->block->ir.operations.push_back(op);
 				dominated_incoming->id = op->id;
 
-				module.get_builder().addName(merge_phi.id,
-				                             (String("merged_phi_") + dominated_incoming->block->name).c_str());
+				add_name(merge_phi.id, String("merged_phi_") + dominated_incoming->block->name);
 				frontier->ir.phi.push_back(std::move(merge_phi));
 			}
 		}
@@ -1741,8 +2098,186 @@ void CFGStructurizer::insert_phi(PHINode &node)
 	}
 }
 
+bool CFGStructurizer::build_frontiers(const Vector<CFGNode *> &order, bool post)
+{
+	// Builds the same frontier lists as calling recompute_(post_)dominance_frontier() over order.
+	// Those push a block's frontier into its idom's frontier after every edge, which is equivalent to
+	// appending the children's frontiers in visit order, followed by the block's own edges.
+	// Children always come before their idom in post-visit order, so each list is built in one go,
+	// with dominator tree intervals and stamps replacing the idom chain walks and list searches.
+	const auto get_index = [post](const CFGNode *node) {
+		return post ? node->backward_post_visit_order : node->forward_post_visit_order;
+	};
+	const auto get_idom = [post](const CFGNode *node) {
+		return post ? node->immediate_post_dominator : node->immediate_dominator;
+	};
+	const auto get_edges = [post](CFGNode *node) -> CFGNodeList & { return post ? node->pred : node->succ; };
+	const auto get_frontier = [post](CFGNode *node) -> CFGNodeList & {
+		return post ? node->post_dominance_frontier : node->dominance_frontier;
+	};
+
+	uint32_t count = uint32_t(order.size());
+	const auto in_order = [&](const CFGNode *node) {
+		uint32_t index = get_index(node);
+		return index < count && order[index] == node;
+	};
+
+	// Leaves are post-dominated by the exit block, which is not part of the traversal.
+	// Anything else falls back to the chain walks.
+	Vector<uint32_t> child_offsets(count + 1);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		auto *node = order[i];
+		auto *idom = get_idom(node);
+		if (!idom || get_index(node) != i)
+			return false;
+		if (idom != node && !(post && idom == exit_block))
+		{
+			if (!in_order(idom) || get_index(idom) <= i)
+				return false;
+			child_offsets[get_index(idom)]++;
+		}
+
+		for (auto *edge : get_edges(node))
+			if (!in_order(edge))
+				return false;
+	}
+
+	if (post && !exit_block->post_dominance_frontier.empty())
+		return false;
+
+	uint32_t offset = 0;
+	for (auto &child_offset : child_offsets)
+	{
+		uint32_t num_children = child_offset;
+		child_offset = offset;
+		offset += num_children;
+	}
+
+	Vector<uint32_t> children(offset);
+	Vector<uint32_t> roots;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		auto *idom = get_idom(order[i]);
+		if (idom == order[i] || idom == exit_block)
+			roots.push_back(i);
+		else
+			children[child_offsets[get_index(idom)]++] = i;
+	}
+
+	// Offsets were bumped past each child range, so range i is now [offsets[i - 1], offsets[i]).
+	const auto children_begin = [&](uint32_t i) { return i ? child_offsets[i - 1] : 0u; };
+
+	// Pre-order intervals of the dominator tree.
+	Vector<uint32_t> pre_order(count);
+	Vector<uint32_t> subtree_end(count);
+	Vector<uint32_t> stack;
+	uint32_t counter = 0;
+	for (auto root : roots)
+	{
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			uint32_t i = stack.back();
+			if (i & 0x80000000u)
+			{
+				stack.pop_back();
+				subtree_end[i & 0x7fffffffu] = counter - 1;
+				continue;
+			}
+
+			stack.back() |= 0x80000000u;
+			pre_order[i] = counter++;
+			for (uint32_t c = children_begin(i); c < child_offsets[i]; c++)
+				stack.push_back(children[c]);
+		}
+	}
+
+	if (counter != count)
+		return false;
+
+	const auto dominates = [&](uint32_t a, uint32_t b) {
+		return pre_order[a] <= pre_order[b] && pre_order[b] <= subtree_end[a];
+	};
+
+	Vector<uint32_t> stamps(count, UINT32_MAX);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		auto *node = order[i];
+		auto &frontier = get_frontier(node);
+		frontier.clear();
+
+		for (uint32_t c = children_begin(i); c < child_offsets[i]; c++)
+		{
+			auto *child = order[children[c]];
+			// A block without edges never propagates its frontier.
+			if (get_edges(child).empty())
+				continue;
+
+			for (auto *frontier_node : get_frontier(child))
+			{
+				uint32_t index = get_index(frontier_node);
+				if (!dominates(i, index) && stamps[index] != i)
+				{
+					stamps[index] = i;
+					frontier.push_back(frontier_node);
+				}
+			}
+		}
+
+		for (auto *edge : get_edges(node))
+		{
+			uint32_t index = get_index(edge);
+			if (get_idom(edge) != node && stamps[index] != i)
+			{
+				stamps[index] = i;
+				frontier.push_back(edge);
+			}
+		}
+	}
+
+	return true;
+}
+
+void CFGStructurizer::validate_frontiers(const Vector<CFGNode *> &order, bool post)
+{
+	Vector<CFGNodeList> frontiers;
+	frontiers.reserve(order.size());
+	for (auto *node : order)
+		frontiers.push_back(post ? node->post_dominance_frontier : node->dominance_frontier);
+
+	for (auto *node : order)
+		(post ? node->post_dominance_frontier : node->dominance_frontier).clear();
+	for (auto *node : order)
+	{
+		if (post)
+			recompute_post_dominance_frontier(node);
+		else
+			recompute_dominance_frontier(node);
+	}
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		auto &frontier = post ? order[i]->post_dominance_frontier : order[i]->dominance_frontier;
+		if (frontier.size() != frontiers[i].size() ||
+		    !std::equal(frontier.begin(), frontier.end(), frontiers[i].begin()))
+		{
+			LOGE("Frontiers diverged from reference implementation.\n");
+			assert(0 && "Frontiers diverged from reference implementation.");
+			return;
+		}
+	}
+}
+
 void CFGStructurizer::compute_dominance_frontier()
 {
+	if (build_frontiers(forward_post_visit_order, false))
+	{
+		if (validate_cfg_analysis)
+			validate_frontiers(forward_post_visit_order, false);
+		return;
+	}
+
 	for (auto *node : forward_post_visit_order)
 		node->dominance_frontier.clear();
 	for (auto *node : forward_post_visit_order)
@@ -1751,6 +2286,13 @@ void CFGStructurizer::compute_dominance_frontier()
 
 void CFGStructurizer::compute_post_dominance_frontier()
 {
+	if (build_frontiers(backward_post_visit_order, true))
+	{
+		if (validate_cfg_analysis)
+			validate_frontiers(backward_post_visit_order, true);
+		return;
+	}
+
 	for (auto *node : backward_post_visit_order)
 		node->post_dominance_frontier.clear();
 	for (auto *node : backward_post_visit_order)
@@ -1775,8 +2317,28 @@ void CFGStructurizer::build_immediate_post_dominators()
 	}
 }
 
+void CFGStructurizer::reset_structured_analysis(CFGNode &node)
+{
+	node.split_merge_block_candidate = nullptr;
+
+	if (!node.freeze_structured_analysis)
+	{
+		node.headers.clear();
+		node.merge = MergeType::None;
+		node.loop_merge_block = nullptr;
+		node.loop_ladder_block = nullptr;
+		node.selection_merge_block = nullptr;
+	}
+}
+
 void CFGStructurizer::reset_traversal()
 {
+	analysis_cfg_generation = UINT64_MAX;
+	loop_forest_generation = UINT64_MAX;
+	path_query_generation = UINT64_MAX;
+	path_query_memo.clear();
+	cfg_splices.clear();
+	cfg_splice_generation = UINT64_MAX;
 	reachable_nodes.clear();
 	forward_post_visit_order.clear();
 	backward_post_visit_order.clear();
@@ -1786,18 +2348,10 @@ void CFGStructurizer::reset_traversal()
 		node.traversing = false;
 		node.immediate_dominator = nullptr;
 		node.immediate_post_dominator = nullptr;
-		node.split_merge_block_candidate = nullptr;
 		node.fake_pred.clear();
 		node.fake_succ.clear();
 
-		if (!node.freeze_structured_analysis)
-		{
-			node.headers.clear();
-			node.merge = MergeType::None;
-			node.loop_merge_block = nullptr;
-			node.loop_ladder_block = nullptr;
-			node.selection_merge_block = nullptr;
-		}
+		reset_structured_analysis(node);
 
 		if (node.succ_back_edge)
 			node.succ.push_back(node.succ_back_edge);
@@ -1970,6 +2524,7 @@ void CFGStructurizer::backwards_visit()
 		}
 	}
 
+	analysis_has_fake_branches = need_revisit;
 	if (need_revisit)
 	{
 		for (auto *node : forward_post_visit_order)
@@ -2561,6 +3116,7 @@ void CFGStructurizer::fixup_broken_selection_merges(unsigned pass)
 					auto *target_block = node->succ[1 - trivial_merge_index];
 					// We kinda want to merge the other way, but to do that, we need an interim block.
 					auto *ladder = pool.create_node();
+					num_ladder_blocks++;
 					ladder->name = node->name + "." + target_block->name + ".interim";
 					ladder->add_branch(target_block);
 					ladder->ir.terminator.type = Terminator::Type::Branch;
@@ -2655,7 +3211,12 @@ void CFGStructurizer::rewrite_selection_breaks(CFGNode *header, CFGNode *ladder_
 	for (auto *inner_block : sorted_construct)
 	{
 		//LOGI("Header: %s, Inner: %s.\n", header->name.c_str(), inner_block->name.c_str());
+		uint64_t generation = pool.get_cfg_generation();
+		size_t node_count = pool.get_node_count();
+		CFGNodeList ladder_to_preds = ladder_to->pred;
+
 		auto *ladder = pool.create_node();
+		num_ladder_blocks++;
 		ladder->name = ladder_to->name + "." + inner_block->name + ".ladder";
 		//LOGI("Walking dominated blocks of %s, rewrite branches %s -> %s.\n", inner_block->name.c_str(),
 		//     ladder_to->name.c_str(), ladder->name.c_str());
@@ -2675,6 +3236,7 @@ void CFGStructurizer::rewrite_selection_breaks(CFGNode *header, CFGNode *ladder_
 		    });
 
 		ladder->recompute_immediate_dominator();
+		record_cfg_splice(ladder, ladder_to, ladder_to_preds, generation, node_count);
 		rewrite_selection_breaks(inner_block, ladder);
 	}
 }
@@ -2813,8 +3375,6 @@ bool CFGStructurizer::serialize_interleaved_merge_scopes()
 		if (node->num_forward_preds() >= 2 && !block_is_plain_continue(node))
 			potential_merge_nodes.insert(node);
 
-	UnorderedSet<const CFGNode *> visited;
-
 	for (auto *node : forward_post_visit_order)
 	{
 		if (node->num_forward_preds() <= 1)
@@ -2906,10 +3466,9 @@ bool CFGStructurizer::serialize_interleaved_merge_scopes()
 			// Rewrite the control flow to serialize execution of the candidate blocks.
 			auto *dispatcher = create_helper_pred_block(node);
 
-			auto &builder = module.get_builder();
 			PHI phi;
-			phi.id = module.allocate_id();
-			phi.type_id = builder.makeIntType(32);
+			phi.id = allocate_id();
+			phi.type_id = make_int_type(32);
 
 			for (auto *candidate : valid_constructs)
 				traverse_dominated_blocks_and_rewrite_branch(candidate, dispatcher, node);
@@ -2921,7 +3480,7 @@ bool CFGStructurizer::serialize_interleaved_merge_scopes()
 			bool need_default_case = !dispatcher->pred.empty();
 
 			for (size_t i = 0; i < cutoff_index; i++)
-				phi.incoming.push_back({ dispatcher->pred[i], builder.makeIntConstant(-1) });
+				phi.incoming.push_back({ dispatcher->pred[i], make_int_constant(-1) });
 
 			for (size_t i = 0; i < count; i++)
 			{
@@ -2929,7 +3488,7 @@ bool CFGStructurizer::serialize_interleaved_merge_scopes()
 				traverse_dominated_blocks_and_rewrite_branch(idom, candidate, dispatcher);
 				size_t next_cutoff_index = dispatcher->pred.size();
 				for (size_t j = cutoff_index; j < next_cutoff_index; j++)
-					phi.incoming.push_back({ dispatcher->pred[j], builder.makeIntConstant(int32_t(i)) });
+					phi.incoming.push_back({ dispatcher->pred[j], make_int_constant(int32_t(i)) });
 				cutoff_index = next_cutoff_index;
 			}
 
@@ -2939,7 +3498,7 @@ bool CFGStructurizer::serialize_interleaved_merge_scopes()
 
 			dispatcher->ir.terminator.conditional_id = phi.id;
 			dispatcher->ir.phi.push_back(std::move(phi));
-			builder.addName(phi.id, String("selector_" + node->name).c_str());
+			add_name(phi.id, "selector_" + node->name);
 
 			Terminator::Case default_case;
 			dispatcher->ir.terminator.type = Terminator::Type::Switch;
@@ -3041,38 +3600,382 @@ bool CFGStructurizer::query_reachability(const CFGNode &from, const CFGNode &to)
 	if (&from == &to)
 		return true;
 
-	const uint32_t *src_reachability = &reachability_bitset[from.forward_post_visit_order * reachability_stride];
-	return (src_reachability[to.forward_post_visit_order / 32] & (1u << (to.forward_post_visit_order & 31u))) != 0;
+	// Nodes which became unreachable since the last traversal can keep stale orders.
+	if (from.forward_post_visit_order >= forward_post_visit_order.size() ||
+	    to.forward_post_visit_order >= forward_post_visit_order.size())
+	{
+		return false;
+	}
+
+	if (use_reachability_ranges)
+	{
+		uint32_t order = to.forward_post_visit_order;
+		auto begin = reachability_ranges.begin() + reachability_range_offsets[from.forward_post_visit_order];
+		auto end = reachability_ranges.begin() + reachability_range_offsets[from.forward_post_visit_order + 1];
+		auto itr = std::upper_bound(begin, end, order, [](uint32_t value, const ReachabilityRange &range) {
+			return value < range.lo;
+		});
+		return itr != begin && order <= (itr - 1)->hi;
+	}
+
+	const uint64_t *src_reachability = &reachability_rows[from.forward_post_visit_order * reachability_stride];
+	return (src_reachability[to.forward_post_visit_order / 64] & (1ull << (to.forward_post_visit_order & 63u))) != 0;
 }
 
 void CFGStructurizer::visit_reachability(const CFGNode &node)
 {
-	uint32_t *dst_reachability = &reachability_bitset[node.forward_post_visit_order * reachability_stride];
+	uint64_t *dst_reachability = &reachability_rows[node.forward_post_visit_order * reachability_stride];
 
+	// If a successor reaches another successor, the latter's row is a subset of the former's.
+	// Merge the successor with highest post-visit order first since it's the one most likely to reach the others.
+	const CFGNode *first = nullptr;
 	for (auto *succ : node.succ)
+		if (!first || succ->forward_post_visit_order > first->forward_post_visit_order)
+			first = succ;
+
+	const auto merge_succ = [&](const CFGNode *succ) {
+		uint32_t order = succ->forward_post_visit_order;
+		if (dst_reachability[order / 64] & (1ull << (order & 63u)))
+			return;
+
+		// Successors only reach nodes with lower post-visit order, so the rest of the row is zero.
+		const uint64_t *src_reachability = &reachability_rows[order * reachability_stride];
+		bitset_union_words(dst_reachability, src_reachability, order / 64 + 1);
+	};
+
+	// Inherit reachability from all successors.
+	if (first)
+		merge_succ(first);
+	for (auto *succ : node.succ)
+		if (succ != first)
+			merge_succ(succ);
+
+	// We can reach ourselves.
+	dst_reachability[node.forward_post_visit_order / 64] |= 1ull << (node.forward_post_visit_order & 63u);
+}
+
+bool CFGStructurizer::build_reachability_ranges()
+{
+	size_t count = forward_post_visit_order.size();
+	// Give up if ranges end up taking more space than the dense matrix.
+	size_t max_ranges = (count * ((count + 31) / 32)) / 2;
+
+	reachability_ranges.clear();
+	reachability_range_offsets.clear();
+	reachability_range_offsets.reserve(count + 1);
+	Vector<ReachabilityRange> ranges;
+
+	// Successors always have lower post-visit order, so they are resolved before the node itself.
+	for (uint32_t order = 0; order < count; order++)
 	{
-		// Inherit reachability from all successors.
-		const uint32_t *src_reachability = &reachability_bitset[succ->forward_post_visit_order * reachability_stride];
-		for (unsigned i = 0; i < reachability_stride; i++)
-			dst_reachability[i] |= src_reachability[i];
+		auto *node = forward_post_visit_order[order];
+		ranges.clear();
+		ranges.push_back({ order, order });
+		for (auto *succ : node->succ)
+		{
+			uint32_t succ_order = succ->forward_post_visit_order;
+			uint32_t begin = reachability_range_offsets[succ_order];
+			uint32_t end = succ_order + 1 < order ? reachability_range_offsets[succ_order + 1] :
+			                                        uint32_t(reachability_ranges.size());
+			ranges.insert(ranges.end(), reachability_ranges.begin() + begin, reachability_ranges.begin() + end);
+		}
+
+		std::sort(ranges.begin(), ranges.end(), [](const ReachabilityRange &a, const ReachabilityRange &b) {
+			return a.lo < b.lo;
+		});
+
+		reachability_range_offsets.push_back(uint32_t(reachability_ranges.size()));
+		reachability_ranges.push_back(ranges.front());
+		for (size_t i = 1; i < ranges.size(); i++)
+		{
+			auto &last = reachability_ranges.back();
+			if (ranges[i].lo <= last.hi + 1)
+				last.hi = std::max(last.hi, ranges[i].hi);
+			else
+				reachability_ranges.push_back(ranges[i]);
+		}
+
+		if (reachability_ranges.size() > max_ranges)
+		{
+			reachability_ranges.clear();
+			reachability_range_offsets.clear();
+			return false;
+		}
 	}
 
-	// We can reach ourselves.
-	dst_reachability[node.forward_post_visit_order / 32] |= 1u << (node.forward_post_visit_order & 31u);
+	reachability_range_offsets.push_back(uint32_t(reachability_ranges.size()));
+	return true;
+}
+
+void CFGStructurizer::validate_reachability_ranges() const
+{
+	for (auto *from : forward_post_visit_order)
+	{
+		auto begin = reachability_ranges.begin() + reachability_range_offsets[from->forward_post_visit_order];
+		auto end = reachability_ranges.begin() + reachability_range_offsets[from->forward_post_visit_order + 1];
+		const uint64_t *src_reachability = &reachability_rows[from->forward_post_visit_order * reachability_stride];
+
+		for (auto *to : forward_post_visit_order)
+		{
+			uint32_t order = to->forward_post_visit_order;
+			bool dense = (src_reachability[order / 64] & (1ull << (order & 63u))) != 0;
+			bool sparse = std::find_if(begin, end, [&](const ReachabilityRange &range) {
+				return order >= range.lo && order <= range.hi;
+			}) != end;
+
+			if (dense != sparse)
+			{
+				LOGE("Reachability ranges diverged from dense reachability.\n");
+				assert(0 && "Reachability ranges diverged from dense reachability.");
+				return;
+			}
+		}
+	}
 }
 
 void CFGStructurizer::build_reachability()
 {
-	reachability_stride = (forward_post_visit_order.size() + 31) / 32;
+	// Dense N x N matrix is fastest to build and query for small CFGs,
+	// but grows quadratically for the very large CFGs unrolled shaders can produce.
+	constexpr size_t SparseReachabilityThreshold = 1024;
+
 	reachability_bitset.clear();
-	reachability_bitset.resize(reachability_stride * forward_post_visit_order.size());
+	reachability_rows = nullptr;
+	reachability_stride = 0;
+	use_reachability_ranges = false;
+
+	if (forward_post_visit_order.size() > SparseReachabilityThreshold || validate_cfg_analysis)
+		use_reachability_ranges = build_reachability_ranges();
+
+	if (!use_reachability_ranges || validate_cfg_analysis)
+	{
+		// Pad rows to 64 byte cache lines.
+		reachability_stride = ((forward_post_visit_order.size() + 511) / 512) * 8;
+		reachability_bitset.resize(reachability_stride * forward_post_visit_order.size() + 7);
+		auto base = reinterpret_cast<uintptr_t>(reachability_bitset.data());
+		reachability_rows = reachability_bitset.data() + (((base + 63) & ~uintptr_t(63)) - base) / sizeof(uint64_t);
+		for (auto *node : forward_post_visit_order)
+			visit_reachability(*node);
+	}
+
+	if (use_reachability_ranges && validate_cfg_analysis)
+		validate_reachability_ranges();
+
+	// Validation keeps the dense matrix around, so make queries take the normal path for small CFGs.
+	if (forward_post_visit_order.size() <= SparseReachabilityThreshold)
+		use_reachability_ranges = false;
+}
+
+void CFGStructurizer::serialize_cfg_analysis(Vector<uintptr_t> &state)
+{
+	state.clear();
+
+	const auto push_nodes = [&](const auto &nodes) {
+		state.push_back(nodes.size());
+		for (auto *n : nodes)
+			state.push_back(uintptr_t(n));
+	};
+
+	state.push_back(uintptr_t(entry_block));
+	state.push_back(reachable_nodes.size());
+	push_nodes(forward_post_visit_order);
+	push_nodes(backward_post_visit_order);
+
+	pool.for_each_node([&](CFGNode &node) {
+		state.push_back(uintptr_t(&node));
+		state.push_back(node.forward_post_visit_order);
+		state.push_back(node.backward_post_visit_order);
+		state.push_back(uintptr_t(node.immediate_dominator));
+		state.push_back(uintptr_t(node.immediate_post_dominator));
+		state.push_back(uintptr_t(node.succ_back_edge));
+		state.push_back(uintptr_t(node.pred_back_edge));
+		state.push_back(node.visited | (node.backward_visited << 1) | (node.traversing << 2));
+		push_nodes(node.succ);
+		push_nodes(node.pred);
+		push_nodes(node.fake_succ);
+		push_nodes(node.fake_pred);
+		push_nodes(node.dominance_frontier);
+		push_nodes(node.post_dominance_frontier);
+	});
+
+	state.push_back(reachability_stride);
+	for (size_t i = 0; i < reachability_stride * forward_post_visit_order.size(); i++)
+	{
+		state.push_back(uintptr_t(reachability_rows[i]));
+		state.push_back(uintptr_t(reachability_rows[i] >> 32));
+	}
+	state.push_back(use_reachability_ranges);
+	for (auto &range : reachability_ranges)
+	{
+		state.push_back(range.lo);
+		state.push_back(range.hi);
+	}
+}
+
+void CFGStructurizer::record_cfg_splice(CFGNode *pred, CFGNode *node, const CFGNodeList &node_preds,
+                                        uint64_t generation, size_t node_count)
+{
+	// The edit must apply on top of the analyzed CFG plus earlier splices,
+	// and nothing but the pred block may have been added.
+	uint64_t base_generation = cfg_splices.empty() ? analysis_cfg_generation : cfg_splice_generation;
+	bool is_splice = generation == base_generation && generation != UINT64_MAX && !analysis_has_fake_branches &&
+	                 pool.get_node_count() == node_count + 1 &&
+	                 pred->succ.size() == 1 && pred->succ.front() == node &&
+	                 node->pred.size() == 1 && node->pred.front() == pred &&
+	                 pred->pred.size() == node_preds.size() &&
+	                 std::equal(node_preds.begin(), node_preds.end(), pred->pred.begin()) &&
+	                 !pred->succ_back_edge && !pred->pred_back_edge &&
+	                 pred->fake_succ.empty() && pred->fake_pred.empty() && node->fake_pred.empty();
+
+	// Keep splices independent so they can be patched in any order.
+	for (auto &splice : cfg_splices)
+		if (splice.node == node || splice.pred == node)
+			is_splice = false;
+
+	if (is_splice)
+	{
+		cfg_splices.push_back({ pred, node });
+		cfg_splice_generation = pool.get_cfg_generation();
+	}
+	else
+	{
+		cfg_splices.clear();
+		cfg_splice_generation = UINT64_MAX;
+	}
+}
+
+bool CFGStructurizer::apply_cfg_splices()
+{
+	if (cfg_splices.empty() || cfg_splice_generation != pool.get_cfg_generation())
+		return false;
+
+	UnorderedMap<const CFGNode *, CFGNode *> spliced_preds;
+	for (auto &splice : cfg_splices)
+	{
+		if (!reachable_nodes.count(splice.node) || !splice.node->backward_visited)
+			return false;
+		for (auto *p : splice.pred->pred)
+			if (!reachable_nodes.count(p))
+				return false;
+		spliced_preds[splice.node] = splice.pred;
+	}
+
+	// A spliced pred is visited right after its block finishes in a forward traversal,
+	// and takes over the block's slot in a backward traversal, so no other nodes change relative order.
+	Vector<CFGNode *> order;
+	order.reserve(forward_post_visit_order.size() + cfg_splices.size());
 	for (auto *node : forward_post_visit_order)
-		visit_reachability(*node);
+	{
+		order.push_back(node);
+		auto itr = spliced_preds.find(node);
+		if (itr != spliced_preds.end())
+			order.push_back(itr->second);
+	}
+	std::swap(forward_post_visit_order, order);
+
+	order.clear();
+	for (auto *node : backward_post_visit_order)
+	{
+		auto itr = spliced_preds.find(node);
+		if (itr != spliced_preds.end())
+			order.push_back(itr->second);
+		order.push_back(node);
+	}
+	std::swap(backward_post_visit_order, order);
+
+	for (size_t i = 0, n = forward_post_visit_order.size(); i < n; i++)
+		forward_post_visit_order[i]->forward_post_visit_order = i;
+	for (size_t i = 0, n = backward_post_visit_order.size(); i < n; i++)
+		backward_post_visit_order[i]->backward_post_visit_order = i;
+
+	for (auto &splice : cfg_splices)
+	{
+		reachable_nodes.insert(splice.pred);
+		splice.pred->visited = true;
+		splice.pred->backward_visited = true;
+		splice.pred->traversing = false;
+	}
+
+	path_query_generation = UINT64_MAX;
+	path_query_memo.clear();
+
+	// Dominators, post-dominators and reachability are cheap to redo with exact visit orders.
+	pool.for_each_node([](CFGNode &node) {
+		node.immediate_dominator = nullptr;
+		node.immediate_post_dominator = nullptr;
+	});
+	build_immediate_dominators();
+	build_reachability();
+
+	exit_block->backward_post_visit_order = backward_post_visit_order.size();
+	exit_block->immediate_post_dominator = exit_block;
+	for (auto *node : forward_post_visit_order)
+		if (node->succ.empty() && !node->succ_back_edge)
+			node->immediate_post_dominator = exit_block;
+	build_immediate_post_dominators();
+
+	// A spliced pred inherits the frontiers of its block. Blocks which had the old block in their
+	// dominance frontier dominate one of its preds without dominating the pred block,
+	// and now see the pred block in the same position instead.
+	for (auto &splice : cfg_splices)
+	{
+		splice.pred->dominance_frontier = splice.node->dominance_frontier;
+		splice.pred->post_dominance_frontier = splice.node->post_dominance_frontier;
+	}
+
+	for (auto &splice : cfg_splices)
+	{
+		auto *idom = splice.pred->immediate_dominator;
+		for (auto *p : splice.pred->pred)
+		{
+			for (auto *n = p; n != idom; n = n->immediate_dominator)
+			{
+				auto itr = std::find(n->dominance_frontier.begin(), n->dominance_frontier.end(), splice.node);
+				if (itr != n->dominance_frontier.end())
+					*itr = splice.pred;
+				if (n == n->immediate_dominator)
+					break;
+			}
+		}
+	}
+
+	cfg_splices.clear();
+	cfg_splice_generation = UINT64_MAX;
+	analysis_cfg_generation = pool.get_cfg_generation();
+	build_loop_forest();
+	return true;
 }
 
 void CFGStructurizer::recompute_cfg()
 {
+	num_recompute_cfg_calls++;
+
+	// Dominance, post-dominance and reachability only depend on nodes and edges,
+	// so if nothing was rewritten since the last full rebuild, only structured analysis needs to be reset.
+	// If the only rewrites were helper blocks spliced in front of existing blocks, patch the analysis.
+	// Anything else forces a full rebuild. Validation compares either path against a full rebuild.
+	bool analysis_is_current = analysis_cfg_generation == pool.get_cfg_generation();
+	if (!analysis_is_current && apply_cfg_splices())
+	{
+		analysis_is_current = true;
+		num_recompute_cfg_splices++;
+	}
+	if (analysis_is_current)
+	{
+		pool.for_each_node(reset_structured_analysis);
+		if (!validate_cfg_analysis)
+			return;
+	}
+
+	Vector<uintptr_t> current_state;
+	if (analysis_is_current)
+		serialize_cfg_analysis(current_state);
+	else
+		num_recompute_cfg_rebuilds++;
+
 	reset_traversal();
+	uint64_t generation = pool.get_cfg_generation();
+
 	visit(*entry_block);
 	// Need to prune dead preds before computing dominance.
 	prune_dead_preds();
@@ -3084,6 +3987,25 @@ void CFGStructurizer::recompute_cfg()
 
 	compute_dominance_frontier();
 	compute_post_dominance_frontier();
+
+	// If backwards traversal had to add branches to transpose loop exits,
+	// the CFG is not the same one we analyzed, so a later rebuild is not redundant.
+	if (generation == pool.get_cfg_generation())
+	{
+		analysis_cfg_generation = generation;
+		build_loop_forest();
+	}
+
+	if (analysis_is_current)
+	{
+		Vector<uintptr_t> rebuilt_state;
+		serialize_cfg_analysis(rebuilt_state);
+		if (current_state != rebuilt_state)
+		{
+			LOGE("CFG analysis diverged from full rebuild.\n");
+			assert(0 && "CFG analysis diverged from full rebuild.");
+		}
+	}
 }
 
 CFGNode *CFGStructurizer::find_natural_switch_merge_block(CFGNode *node, CFGNode *post_dominator) const
@@ -3223,18 +4145,18 @@ Operation *CFGStructurizer::build_switch_case_equal_check(
 		{
 			if (!label.is_default)
 			{
-				Operation *neq = module.allocate_op(spv::OpINotEqual,
-				                                    module.allocate_id(),
-				                                    module.get_builder().makeBoolType());
+				Operation *neq = allocate_op(spv::OpINotEqual,
+				                                    allocate_id(),
+				                                    make_bool_type());
 				neq->add_id(header->ir.terminator.conditional_id);
-				neq->add_id(module.get_builder().makeUintConstant(label.value));
+				neq->add_id(make_uint_constant(label.value));
 				insert_node->ir.operations.push_back(neq);
 
 				if (neq_and)
 				{
-					Operation *and_op = module.allocate_op(spv::OpLogicalAnd,
-					                                       module.allocate_id(),
-					                                       module.get_builder().makeBoolType());
+					Operation *and_op = allocate_op(spv::OpLogicalAnd,
+					                                       allocate_id(),
+					                                       make_bool_type());
 					and_op->add_id(neq_and->id);
 					and_op->add_id(neq->id);
 					insert_node->ir.operations.push_back(and_op);
@@ -3251,9 +4173,9 @@ Operation *CFGStructurizer::build_switch_case_equal_check(
 	}
 	else
 	{
-		ieq = module.allocate_op(spv::OpIEqual, module.allocate_id(), module.get_builder().makeBoolType());
+		ieq = allocate_op(spv::OpIEqual, allocate_id(), make_bool_type());
 		ieq->add_id(header->ir.terminator.conditional_id);
-		ieq->add_id(module.get_builder().makeUintConstant(c.value));
+		ieq->add_id(make_uint_constant(c.value));
 		insert_node->ir.operations.push_back(ieq);
 	}
 
@@ -3286,8 +4208,8 @@ void CFGStructurizer::hoist_switch_branches_to_frontier(CFGNode *node, CFGNode *
 
 				if (cond_id)
 				{
-					auto *bor = module.allocate_op(spv::OpLogicalOr, module.allocate_id(),
-					                               module.get_builder().makeBoolType());
+					auto *bor = allocate_op(spv::OpLogicalOr, allocate_id(),
+					                               make_bool_type());
 					bor->add_id(cond_id);
 					bor->add_id(ieq->id);
 					pred->ir.operations.push_back(bor);
@@ -3310,6 +4232,7 @@ void CFGStructurizer::hoist_switch_branches_to_frontier(CFGNode *node, CFGNode *
 						incoming.block = pred;
 		}
 
+		pool.invalidate_cfg();
 		for (auto *&p : succ->pred)
 			if (p == node)
 				p = pred;
@@ -3507,7 +4430,7 @@ bool CFGStructurizer::find_switch_blocks(unsigned pass)
 		{
 			// We got a switch block where someone is escaping. Similar idea as for loop analysis.
 			// Find a post-dominator where we ignore branches which are "escaping".
-			auto *dominated_merge_target = find_common_post_dominator_with_ignored_break(node->succ, merge);
+			auto *dominated_merge_target = find_common_post_dominator_with_ignored_break({ node->succ.begin(), node->succ.end() }, merge);
 
 			if (!dominated_merge_target)
 			{
@@ -3739,8 +4662,192 @@ void CFGStructurizer::find_selection_merges(unsigned pass)
 	}
 }
 
+void CFGStructurizer::build_loop_forest()
+{
+	size_t count = forward_post_visit_order.size();
+	loop_forest_blocks.clear();
+	loop_forest_loops.clear();
+	loop_forest_exits.clear();
+
+	// The dominator walks we replace stop at a block without preds, which should only be the entry.
+	auto *root = count ? forward_post_visit_order.back() : nullptr;
+	if (!root || !root->pred.empty())
+		return;
+
+	loop_forest_blocks.resize(count);
+	for (auto &block : loop_forest_blocks)
+		block.dominator_subtree_size = 1;
+
+	// Dominators are DFS ancestors, so they always come later in post-order.
+	for (size_t i = 0; i + 1 < count; i++)
+	{
+		auto *idom = forward_post_visit_order[i]->immediate_dominator;
+		if (!idom || idom->forward_post_visit_order <= i || forward_post_visit_order[idom->forward_post_visit_order] != idom)
+			return;
+		loop_forest_blocks[idom->forward_post_visit_order].dominator_subtree_size += loop_forest_blocks[i].dominator_subtree_size;
+	}
+
+	// Hand out contiguous pre-order ranges top-down. Children take slots from their parent's cursor.
+	Vector<uint32_t> pre_order_cursor(count);
+	for (size_t i = count; i; i--)
+	{
+		auto *node = forward_post_visit_order[i - 1];
+		auto &block = loop_forest_blocks[i - 1];
+		uint32_t parent_loop = NoLoop;
+
+		if (node == root)
+			block.dominator_pre_order = 0;
+		else
+		{
+			uint32_t idom_order = node->immediate_dominator->forward_post_visit_order;
+			block.dominator_pre_order = pre_order_cursor[idom_order];
+			pre_order_cursor[idom_order] += block.dominator_subtree_size;
+			parent_loop = loop_forest_blocks[idom_order].innermost_loop;
+		}
+		pre_order_cursor[i - 1] = block.dominator_pre_order + 1;
+
+		if (node->pred_back_edge)
+		{
+			LoopForestLoop loop = {};
+			loop.header = node;
+			loop.parent = parent_loop;
+			loop.depth = parent_loop != NoLoop ? loop_forest_loops[parent_loop].depth + 1 : 1;
+			block.innermost_loop = uint32_t(loop_forest_loops.size());
+			loop_forest_loops.push_back(loop);
+		}
+		else
+			block.innermost_loop = parent_loop;
+	}
+
+	loop_forest_generation = analysis_cfg_generation;
+}
+
+bool CFGStructurizer::loop_forest_contains(const CFGNode &node) const
+{
+	return loop_forest_generation == pool.get_cfg_generation() &&
+	       node.forward_post_visit_order < forward_post_visit_order.size() &&
+	       forward_post_visit_order[node.forward_post_visit_order] == &node;
+}
+
+bool CFGStructurizer::query_dominance(const CFGNode &a, const CFGNode &b) const
+{
+	if (!loop_forest_contains(a) || !loop_forest_contains(b))
+		return a.dominates(&b);
+
+	auto &a_block = loop_forest_blocks[a.forward_post_visit_order];
+	auto &b_block = loop_forest_blocks[b.forward_post_visit_order];
+	bool ret = b_block.dominator_pre_order - a_block.dominator_pre_order < a_block.dominator_subtree_size;
+
+	if (validate_cfg_analysis && ret != a.dominates(&b))
+	{
+		LOGE("Dominator tree intervals diverged from dominator chain.\n");
+		assert(0 && "Dominator tree intervals diverged from dominator chain.");
+	}
+
+	return ret;
+}
+
+const CFGNode *CFGStructurizer::get_innermost_loop_header_from_forest(const CFGNode *header, const CFGNode *other) const
+{
+	auto &header_block = loop_forest_blocks[header->forward_post_visit_order];
+	auto &other_block = loop_forest_blocks[other->forward_post_visit_order];
+	bool header_dominates =
+	    other_block.dominator_pre_order - header_block.dominator_pre_order < header_block.dominator_subtree_size;
+
+	// Only loop headers, header itself and the entry can end the dominator walk,
+	// so jump between loop headers instead.
+	for (uint32_t index = other_block.innermost_loop; index != NoLoop; index = loop_forest_loops[index].parent)
+	{
+		auto *loop_header = loop_forest_loops[index].header;
+
+		// We would run into header before reaching this loop header.
+		if (header_dominates &&
+		    loop_forest_blocks[loop_header->forward_post_visit_order].dominator_pre_order <= header_block.dominator_pre_order)
+		{
+			return header;
+		}
+
+		if (loop_header->pred.empty())
+			return loop_header;
+
+		if (loop_header->pred_back_edge == other || !query_reachability(*loop_header->pred_back_edge, *other))
+			return loop_header;
+	}
+
+	return header_dominates ? header : forward_post_visit_order.back();
+}
+
+void CFGStructurizer::trace_loop_exits(CFGNode *header, Vector<CFGNode *> &exits)
+{
+	LoopBacktracer tracer;
+	auto *pred = header->pred_back_edge;
+
+	// Back-trace from here.
+	// The CFG is reducible, so header must dominate pred.
+	// Since header dominates pred, there is no pred chain we can follow without
+	// eventually hitting header, and we'll stop traversal there.
+
+	// All nodes which are touched during this traversal must be part of the loop construct.
+	tracer.trace_to_parent(header, pred);
+
+	LoopMergeTracer merge_tracer(tracer);
+	merge_tracer.trace_from_parent(header);
+
+	for (auto *loop_exit : merge_tracer.loop_exits)
+		exits.push_back(loop_exit);
+}
+
+void CFGStructurizer::get_loop_exits(CFGNode *header, Vector<CFGNode *> &exits) const
+{
+	exits.clear();
+
+	if (!loop_forest_contains(*header))
+	{
+		trace_loop_exits(header, exits);
+		return;
+	}
+
+	uint32_t index = loop_forest_blocks[header->forward_post_visit_order].innermost_loop;
+	if (index == NoLoop || loop_forest_loops[index].header != header)
+	{
+		trace_loop_exits(header, exits);
+		return;
+	}
+
+	auto &loop = loop_forest_loops[index];
+	if (!loop.exits_traced)
+	{
+		loop.exit_offset = uint32_t(loop_forest_exits.size());
+		trace_loop_exits(header, loop_forest_exits);
+		loop.exit_count = uint32_t(loop_forest_exits.size()) - loop.exit_offset;
+		loop.exits_traced = true;
+	}
+
+	auto itr = loop_forest_exits.begin() + loop.exit_offset;
+	exits.insert(exits.end(), itr, itr + loop.exit_count);
+
+	if (validate_cfg_analysis)
+	{
+		Vector<CFGNode *> traced_exits;
+		trace_loop_exits(header, traced_exits);
+		if (traced_exits != exits)
+		{
+			LOGE("Cached loop exits diverged from trace.\n");
+			assert(0 && "Cached loop exits diverged from trace.");
+		}
+	}
+}
+
 const CFGNode *CFGStructurizer::get_innermost_loop_header_for(const CFGNode *header, const CFGNode *other) const
 {
+	const CFGNode *forest_header = nullptr;
+	if (loop_forest_contains(*header) && loop_forest_contains(*other))
+	{
+		forest_header = get_innermost_loop_header_from_forest(header, other);
+		if (!validate_cfg_analysis)
+			return forest_header;
+	}
+
 	auto *node = other;
 
 	while (header != other)
@@ -3760,6 +4867,12 @@ const CFGNode *CFGStructurizer::get_innermost_loop_header_for(const CFGNode *hea
 		other = other->immediate_dominator;
 	}
 
+	if (forest_header && forest_header != other)
+	{
+		LOGE("Loop forest diverged from dominator walk.\n");
+		assert(0 && "Loop forest diverged from dominator walk.");
+	}
+
 	return other;
 }
 
@@ -3786,8 +4899,9 @@ CFGStructurizer::LoopExitType CFGStructurizer::get_loop_exit_type(const CFGNode
 	// If there exists an inner loop which dominates this exit, we treat it as an inner loop exit.
 	const CFGNode *innermost_loop_header = get_innermost_loop_header_for(&header, &node);
 	bool is_innermost_loop_header = &header == innermost_loop_header;
+	bool header_dominates = query_dominance(header, node);
 
-	if (header.dominates(&node) && node.dominates_all_reachable_exits())
+	if (header_dominates && node.dominates_all_reachable_exits())
 	{
 		if (is_innermost_loop_header)
 			return LoopExitType::Exit;
@@ -3795,7 +4909,7 @@ CFGStructurizer::LoopExitType CFGStructurizer::get_loop_exit_type(const CFGNode
 			return LoopExitType::InnerLoopExit;
 	}
 
-	if (header.dominates(&node))
+	if (header_dominates)
 	{
 		if (is_innermost_loop_header)
 		{
@@ -3846,8 +4960,13 @@ CFGStructurizer::LoopExitType CFGStructurizer::get_loop_exit_type(const CFGNode
 
 CFGNode *CFGStructurizer::create_helper_pred_block(CFGNode *node)
 {
+	uint64_t generation = pool.get_cfg_generation();
+	size_t node_count = pool.get_node_count();
+	CFGNodeList node_preds = node->pred;
+
 	auto *pred_node = pool.create_node();
 	pred_node->name = node->name + ".pred";
+	num_helper_blocks++;
 
 	// Fixup visit order later.
 	pred_node->forward_post_visit_order = node->forward_post_visit_order;
@@ -3881,11 +5000,13 @@ CFGNode *CFGStructurizer::create_helper_pred_block(CFGNode *node)
 	pred_node->ir.terminator.type = Terminator::Type::Branch;
 	pred_node->ir.terminator.direct_block = node;
 
+	record_cfg_splice(pred_node, node, node_preds, generation, node_count);
 	return pred_node;
 }
 
 void CFGStructurizer::retarget_pred_from(CFGNode *new_node, CFGNode *old_succ)
 {
+	pool.invalidate_cfg();
 	for (auto *p : new_node->pred)
 	{
 		for (auto &s : p->succ)
@@ -3914,6 +5035,7 @@ void CFGStructurizer::retarget_pred_from(CFGNode *new_node, CFGNode *old_succ)
 
 void CFGStructurizer::retarget_succ_from(CFGNode *new_node, CFGNode *old_pred)
 {
+	pool.invalidate_cfg();
 	for (auto *s : new_node->succ)
 		for (auto &p : s->pred)
 			if (p == old_pred)
@@ -3937,6 +5059,7 @@ CFGNode *CFGStructurizer::create_helper_succ_block(CFGNode *node)
 {
 	auto *succ_node = pool.create_node();
 	succ_node->name = node->name + ".succ";
+	num_helper_blocks++;
 
 	// Fixup visit order later.
 	succ_node->forward_post_visit_order = node->forward_post_visit_order;
@@ -3958,7 +5081,8 @@ CFGNode *CFGStructurizer::create_helper_succ_block(CFGNode *node)
 	return succ_node;
 }
 
-CFGNode *CFGStructurizer::find_common_post_dominator(const Vector<CFGNode *> &candidates)
+template <typename List>
+CFGNode *CFGStructurizer::find_common_post_dominator_in_list(const List &candidates)
 {
 	if (candidates.empty())
 		return nullptr;
@@ -3971,10 +5095,20 @@ CFGNode *CFGStructurizer::find_common_post_dominator(const Vector<CFGNode *> &ca
 	return common_post != common_post->immediate_post_dominator ? common_post : nullptr;
 }
 
+CFGNode *CFGStructurizer::find_common_post_dominator(const Vector<CFGNode *> &candidates)
+{
+	return find_common_post_dominator_in_list(candidates);
+}
+
+CFGNode *CFGStructurizer::find_common_post_dominator(const CFGNodeList &candidates)
+{
+	return find_common_post_dominator_in_list(candidates);
+}
+
 CFGNode *CFGStructurizer::find_break_target_for_selection_construct(CFGNode *idom, CFGNode *merge)
 {
 	Vector<CFGNode *> new_visit_queue;
-	UnorderedSet<CFGNode *> visited;
+	CFGNodeVisitSet visited(pool);
 	Vector<CFGNode *> visit_queue;
 	Vector<CFGNode *> candidates;
 
@@ -4067,12 +5201,12 @@ void CFGStructurizer::rewrite_transposed_loop_outer(CFGNode *node, CFGNode *impo
 	replaced_merge_block->ir.terminator.true_block = impossible_merge_target;
 	replaced_merge_block->ir.terminator.false_block = analysis.dominated_merge;
 	replaced_merge_block->ir.terminator.type = Terminator::Type::Condition;
-	replaced_merge_block->ir.terminator.conditional_id = module.allocate_id();
+	replaced_merge_block->ir.terminator.conditional_id = allocate_id();
 
 	PHI phi;
 	phi.id = replaced_merge_block->ir.terminator.conditional_id;
-	phi.type_id = module.get_builder().makeBoolType();
-	module.get_builder().addName(phi.id, (String("transposed_selector_") + node->name).c_str());
+	phi.type_id = make_bool_type();
+	add_name(phi.id, String("transposed_selector_") + node->name);
 
 	for (auto *ladder_pred : replaced_merge_block->pred)
 	{
@@ -4080,7 +5214,7 @@ void CFGStructurizer::rewrite_transposed_loop_outer(CFGNode *node, CFGNode *impo
 		incoming.block = ladder_pred;
 		bool branches_to_impossible =
 				std::find(impossible_preds.begin(), impossible_preds.end(), ladder_pred) != impossible_preds.end();
-		incoming.id = module.get_builder().makeBoolConstant(branches_to_impossible);
+		incoming.id = make_bool_constant(branches_to_impossible);
 		phi.incoming.push_back(incoming);
 	}
 
@@ -4110,6 +5244,7 @@ void CFGStructurizer::rewrite_transposed_loop_inner(CFGNode *node, CFGNode *impo
 	ladder_break->backward_post_visit_order = impossible_merge_target->backward_post_visit_order;
 
 	auto *ladder_selection = pool.create_node();
+	num_ladder_blocks += 2;
 	ladder_selection->name = node->name + ".transposed-merge-inner";
 	ladder_selection->forward_post_visit_order = impossible_merge_target->forward_post_visit_order;
 	ladder_selection->backward_post_visit_order = impossible_merge_target->backward_post_visit_order;
@@ -4132,19 +5267,19 @@ void CFGStructurizer::rewrite_transposed_loop_inner(CFGNode *node, CFGNode *impo
 	ladder_selection->ir.terminator.type = Terminator::Type::Condition;
 	ladder_selection->ir.terminator.true_block = dominated_merge;
 	ladder_selection->ir.terminator.false_block = ladder_break;
-	ladder_selection->ir.terminator.conditional_id = module.allocate_id();
+	ladder_selection->ir.terminator.conditional_id = allocate_id();
 
 	PHI phi;
 	phi.id = ladder_selection->ir.terminator.conditional_id;
-	phi.type_id = module.get_builder().makeBoolType();
-	module.get_builder().addName(phi.id, (String("transposed_selector_") + node->name).c_str());
+	phi.type_id = make_bool_type();
+	add_name(phi.id, String("transposed_selector_") + node->name);
 	for (auto *ladder_pred : ladder_selection->pred)
 	{
 		IncomingValue incoming = {};
 		incoming.block = ladder_pred;
 		bool branches_to_dominated_merge =
 				std::find(ladder_preds.begin(), ladder_preds.end(), ladder_pred) != ladder_preds.end();
-		incoming.id = module.get_builder().makeBoolConstant(branches_to_dominated_merge);
+		incoming.id = make_bool_constant(branches_to_dominated_merge);
 		phi.incoming.push_back(incoming);
 	}
 	ladder_selection->ir.phi.push_back(std::move(phi));
@@ -4279,21 +5414,10 @@ CFGStructurizer::LoopAnalysis CFGStructurizer::analyze_loop(CFGNode *node) const
 	// Ideally, there is a unique block which is the loop exit block, but if there are multiple breaks
 	// there are multiple blocks which are not part of the loop construct.
 
-	LoopBacktracer tracer;
-	auto *pred = node->pred_back_edge;
-
-	// Back-trace from here.
-	// The CFG is reducible, so node must dominate pred.
-	// Since node dominates pred, there is no pred chain we can follow without
-	// eventually hitting node, and we'll stop traversal there.
-
-	// All nodes which are touched during this traversal must be part of the loop construct.
-	tracer.trace_to_parent(node, pred);
+	Vector<CFGNode *> loop_exits;
+	get_loop_exits(node, loop_exits);
 
-	LoopMergeTracer merge_tracer(tracer);
-	merge_tracer.trace_from_parent(node);
-
-	for (auto *loop_exit : merge_tracer.loop_exits)
+	for (auto *loop_exit : loop_exits)
 	{
 		auto exit_type = get_loop_exit_type(*node, *loop_exit);
 		switch (exit_type)
@@ -4667,7 +5791,12 @@ CFGNode *CFGStructurizer::get_target_break_block_for_inner_header(const CFGNode
 
 CFGNode *CFGStructurizer::create_ladder_block(CFGNode *header, CFGNode *node, const char *tag)
 {
+	uint64_t generation = pool.get_cfg_generation();
+	size_t node_count = pool.get_node_count();
+	CFGNodeList node_preds = node->pred;
+
 	auto *ladder = pool.create_node();
+	num_ladder_blocks++;
 	ladder->name = node->name + tag;
 	ladder->add_branch(node);
 	ladder->ir.terminator.type = Terminator::Type::Branch;
@@ -4680,6 +5809,8 @@ CFGNode *CFGStructurizer::create_ladder_block(CFGNode *header, CFGNode *node, co
 	traverse_dominated_blocks_and_rewrite_branch(header, node, ladder);
 	ladder->recompute_immediate_dominator();
 
+	// Only a splice if every pred was dominated by header.
+	record_cfg_splice(ladder, node, node_preds, generation, node_count);
 	return ladder;
 }
 
@@ -4829,6 +5960,7 @@ CFGNode *CFGStructurizer::build_ladder_block_for_escaping_edge_handling(CFGNode
 		// Otherwise we branch to the existing merge block and continue as normal.
 		// We'll also need to rewrite a lot of Phi nodes this way as well.
 		auto *ladder = create_helper_pred_block(loop_ladder);
+		num_ladder_blocks++;
 		new_ladder_block = ladder;
 
 		unsigned header_index;
@@ -4853,20 +5985,20 @@ CFGNode *CFGStructurizer::build_ladder_block_for_escaping_edge_handling(CFGNode
 			});
 
 		ladder->ir.terminator.type = Terminator::Type::Condition;
-		ladder->ir.terminator.conditional_id = module.allocate_id();
+		ladder->ir.terminator.conditional_id = allocate_id();
 		ladder->ir.terminator.false_block = loop_ladder;
 
 		PHI phi;
 		phi.id = ladder->ir.terminator.conditional_id;
-		phi.type_id = module.get_builder().makeBoolType();
-		module.get_builder().addName(phi.id, (String("ladder_phi_") + loop_ladder->name).c_str());
+		phi.type_id = make_bool_type();
+		add_name(phi.id, String("ladder_phi_") + loop_ladder->name);
 
 		for (auto *pred : ladder->pred)
 		{
 			IncomingValue incoming = {};
 			incoming.block = pred;
 			bool is_breaking_pred = normal_preds.count(pred) == 0;
-			incoming.id = module.get_builder().makeBoolConstant(is_breaking_pred);
+			incoming.id = make_bool_constant(is_breaking_pred);
 			phi.incoming.push_back(incoming);
 		}
 		ladder->ir.phi.push_back(std::move(phi));
@@ -4920,10 +6052,11 @@ CFGNode *CFGStructurizer::build_ladder_block_for_escaping_edge_handling(CFGNode
 			//      \-------------------/
 			auto *ladder_pre = create_helper_pred_block(loop_ladder);
 			auto *ladder_post = create_helper_succ_block(loop_ladder);
+			num_ladder_blocks += 2;
 			ladder_pre->add_branch(ladder_post);
 
 			ladder_pre->ir.terminator.type = Terminator::Type::Condition;
-			ladder_pre->ir.terminator.conditional_id = module.allocate_id();
+			ladder_pre->ir.terminator.conditional_id = allocate_id();
 			ladder_pre->ir.terminator.true_block = ladder_post;
 			ladder_pre->ir.terminator.false_block = loop_ladder;
 
@@ -4933,15 +6066,14 @@ CFGNode *CFGStructurizer::build_ladder_block_for_escaping_edge_handling(CFGNode
 
 			PHI phi;
 			phi.id = ladder_pre->ir.terminator.conditional_id;
-			phi.type_id = module.get_builder().makeBoolType();
-			module.get_builder().addName(phi.id,
-										 (String("ladder_phi_") + loop_ladder->name).c_str());
+			phi.type_id = make_bool_type();
+			add_name(phi.id, String("ladder_phi_") + loop_ladder->name);
 			for (auto *pred : ladder_pre->pred)
 			{
 				IncomingValue incoming = {};
 				incoming.block = pred;
 				bool is_breaking_pred = normal_preds.count(pred) == 0;
-				incoming.id = module.get_builder().makeBoolConstant(is_breaking_pred);
+				incoming.id = make_bool_constant(is_breaking_pred);
 				phi.incoming.push_back(incoming);
 			}
 			ladder_pre->ir.phi.push_back(std::move(phi));
@@ -5094,21 +6226,22 @@ void CFGStructurizer::split_merge_blocks()
 
 void CFGStructurizer::structurize(unsigned pass)
 {
-	if (find_switch_blocks(pass))
+	const auto find_switches = [&]() { return find_switch_blocks(pass); };
+	if (run_pass(StructurizerPass::FindSwitchBlocks, find_switches))
 	{
-		recompute_cfg();
-		if (find_switch_blocks(pass))
+		run_pass(StructurizerPass::RecomputeCFG, [&]() { recompute_cfg(); });
+		if (run_pass(StructurizerPass::FindSwitchBlocks, find_switches))
 		{
 			LOGE("Fatal, detected infinite loop.\n");
 			abort();
 		}
 	}
 
-	find_loops();
-	find_selection_merges(pass);
-	fixup_broken_selection_merges(pass);
+	run_pass(StructurizerPass::FindLoops, [&]() { find_loops(); });
+	run_pass(StructurizerPass::FindSelectionMerges, [&]() { find_selection_merges(pass); });
+	run_pass(StructurizerPass::FixupBrokenSelectionMerges, [&]() { fixup_broken_selection_merges(pass); });
 	if (pass == 0)
-		split_merge_blocks();
+		run_pass(StructurizerPass::SplitMergeBlocks, [&]() { split_merge_blocks(); });
 }
 
 bool CFGStructurizer::exists_path_in_cfg_without_intermediate_node(const CFGNode *start_block,
@@ -5133,6 +6266,48 @@ bool CFGStructurizer::exists_path_in_cfg_without_intermediate_node(const CFGNode
 CFGNode *CFGStructurizer::get_post_dominance_frontier_with_cfg_subset_that_reaches(const CFGNode *node,
                                                                                    const CFGNode *must_reach,
                                                                                    const CFGNode *must_reach_frontier) const
+{
+	uint64_t generation = pool.get_cfg_generation();
+	if (analysis_cfg_generation != generation)
+	{
+		// Analysis has been patched up locally since the last rebuild, don't trust anything.
+		num_path_query_misses++;
+		return compute_post_dominance_frontier_with_cfg_subset_that_reaches(node, must_reach, must_reach_frontier);
+	}
+
+	if (path_query_generation != generation)
+	{
+		path_query_memo.clear();
+		path_query_generation = generation;
+	}
+
+	PathQueryKey key = { node, must_reach, must_reach_frontier };
+	auto itr = path_query_memo.find(key);
+	if (itr != path_query_memo.end())
+	{
+		num_path_query_hits++;
+		if (validate_cfg_analysis)
+		{
+			auto *frontier =
+			    compute_post_dominance_frontier_with_cfg_subset_that_reaches(node, must_reach, must_reach_frontier);
+			if (frontier != itr->second)
+			{
+				LOGE("Memoized post-dominance frontier query diverged.\n");
+				assert(0 && "Memoized post-dominance frontier query diverged.");
+			}
+		}
+		return itr->second;
+	}
+
+	num_path_query_misses++;
+	auto *frontier = compute_post_dominance_frontier_with_cfg_subset_that_reaches(node, must_reach, must_reach_frontier);
+	path_query_memo[key] = frontier;
+	return frontier;
+}
+
+CFGNode *CFGStructurizer::compute_post_dominance_frontier_with_cfg_subset_that_reaches(const CFGNode *node,
+                                                                                       const CFGNode *must_reach,
+                                                                                       const CFGNode *must_reach_frontier) const
 {
 	UnorderedSet<const CFGNode *> promoted_post_dominators;
 	promoted_post_dominators.insert(node);
@@ -5328,15 +6503,15 @@ bool CFGStructurizer::rewrite_invalid_loop_breaks()
 		traverse_dominated_blocks_and_rewrite_branch(rewrite_header, invalid_target, dispatcher);
 
 		PHI phi;
-		phi.id = module.allocate_id();
-		phi.type_id = module.get_builder().makeBoolType();
-		module.get_builder().addName(phi.id, (String("break_selector_") + merge->name).c_str());
+		phi.id = allocate_id();
+		phi.type_id = make_bool_type();
+		add_name(phi.id, String("break_selector_") + merge->name);
 
 		for (size_t i = 0; i < natural_preds; i++)
 		{
 			IncomingValue incoming = {};
 			incoming.block = dispatcher->pred[i];
-			incoming.id = module.get_builder().makeBoolConstant(true);
+			incoming.id = make_bool_constant(true);
 			phi.incoming.push_back(incoming);
 		}
 
@@ -5344,7 +6519,7 @@ bool CFGStructurizer::rewrite_invalid_loop_breaks()
 		{
 			IncomingValue incoming = {};
 			incoming.block = dispatcher->pred[i];
-			incoming.id = module.get_builder().makeBoolConstant(false);
+			incoming.id = make_bool_constant(false);
 			phi.incoming.push_back(incoming);
 		}
 
@@ -5413,7 +6588,7 @@ void CFGStructurizer::traverse(BlockEmissionInterface &iface)
 template <typename Op>
 void CFGStructurizer::traverse_dominated_blocks_and_rewrite_branch(const CFGNode *dominator, CFGNode *candidate,
                                                                    CFGNode *from, CFGNode *to, const Op &op,
-                                                                   UnorderedSet<const CFGNode *> &visitation_cache)
+                                                                   CFGNodeVisitSet &visitation_cache)
 {
 	visitation_cache.insert(candidate);
 
@@ -5471,7 +6646,7 @@ void CFGStructurizer::traverse_dominated_blocks_and_rewrite_branch(CFGNode *domi
 	if (from == to)
 		return;
 
-	UnorderedSet<const CFGNode *> visitation_cache;
+	CFGNodeVisitSet visitation_cache(pool);
 	traverse_dominated_blocks_and_rewrite_branch(dominator, dominator, from, to, op, visitation_cache);
 	dominator->fixup_merge_info_after_branch_rewrite(from, to);
 }
@@ -26,6 +26,8 @@
 
 #include "thread_local_allocator.hpp"
 #include "ir.hpp"
+#include "node_pool.hpp"
+#include "scratch_pool.hpp"
 #include <memory>
 #include <stdint.h>
 
@@ -34,7 +36,50 @@ namespace dxil_spv
 class BlockEmissionInterface;
 class SPIRVModule;
 struct CFGNode;
-class CFGNodePool;
+class CFGNodeVisitSet;
+
+// Top-level steps of CFGStructurizer::run(). Structurize0/1 are split into their sub-passes.
+enum class StructurizerPass : uint8_t
+{
+	RewriteMultipleBackEdges,
+	RecomputeCFG,
+	CleanupBreakingPhiConstructs,
+	CleanupBreakingReturnConstructs,
+	CreateContinueBlockLadders,
+	SerializeInterleavedMergeScopes,
+	SplitMergeScopes,
+	EliminateDegenerateBlocks,
+	DuplicateImpossibleMergeConstructs,
+	RewriteTransposedLoops,
+	FindSwitchBlocks,
+	FindLoops,
+	FindSelectionMerges,
+	FixupBrokenSelectionMerges,
+	SplitMergeBlocks,
+	UpdateStructuredLoopMergeTargets,
+	RewriteInvalidLoopBreaks,
+	InsertPhi,
+	Count
+};
+
+struct StructurizerPassStats
+{
+	uint64_t time_ns;
+	// Times the pass was entered. For passes which run until they stop making progress, every round counts.
+	unsigned invocations;
+	unsigned nodes_created;
+	unsigned ladder_blocks;
+	// Helper pred/succ blocks.
+	unsigned helper_blocks;
+	// Copies made of blocks which had to be duplicated per predecessor.
+	unsigned duplicated_nodes;
+	unsigned recompute_cfg_calls;
+	// recompute_cfg() calls which patched the analysis for spliced helper blocks.
+	// Calls which neither spliced nor rebuilt found the analysis current.
+	unsigned recompute_cfg_splices;
+	// recompute_cfg() calls which had to rebuild dominance and reachability.
+	unsigned recompute_cfg_rebuilds;
+};
 
 class BlockEmissionInterface
 {
@@ -48,12 +93,31 @@ class CFGStructurizer
 {
 public:
 	CFGStructurizer(CFGNode *entry, CFGNodePool &pool, SPIRVModule &module);
+	// Fails if the allocator context bound to the thread runs out of memory.
 	bool run();
 	void traverse(BlockEmissionInterface &iface);
 	CFGNode *get_entry_block() const;
 
 	bool rewrite_rov_lock_region();
 
+	// Number of ladder and interim blocks inserted while structurizing.
+	unsigned get_num_ladder_blocks() const;
+	// Post-dominance frontier path queries answered from the memo table vs. computed.
+	unsigned get_num_path_query_hits() const;
+	unsigned get_num_path_query_misses() const;
+
+	// Counters and wall time of each pass in run(), accumulated over rounds.
+	const StructurizerPassStats &get_pass_stats(StructurizerPass pass) const;
+	static const char *get_pass_name(StructurizerPass pass);
+
+	// Lets structurizers for functions with separate node pools run concurrently.
+	// While deferred, run() does not touch the SPIR-V module. New IDs are placeholders and module calls
+	// are recorded. commit_deferred_module_calls() must be called on the thread owning the module before
+	// traverse(). It replays the calls in order and patches the placeholders, so the module ends up
+	// the same as if run() was called right there.
+	void set_defer_module_calls(bool enable);
+	void commit_deferred_module_calls();
+
 private:
 	CFGNode *entry_block;
 	CFGNode *exit_block;
@@ -65,21 +129,101 @@ private:
 	// For post-dominance analysis.
 	Vector<CFGNode *> backward_post_visit_order;
 
-	Vector<uint32_t> reachability_bitset;
-	unsigned reachability_stride = 0;
+	// Dense N x N reachability matrix. Rows are padded to whole cache lines,
+	// and reachability_rows points to the first cache line aligned row.
+	Vector<uint64_t> reachability_bitset;
+	uint64_t *reachability_rows = nullptr;
+	size_t reachability_stride = 0;
+
+	// For large CFGs, the reachable set of each node is stored as sorted, disjoint ranges of
+	// forward post-visit orders instead. Since the orders come from a DFS, most reachable sets
+	// are contiguous, and storage stays roughly linear for structured shaders.
+	struct ReachabilityRange
+	{
+		uint32_t lo, hi;
+	};
+	Vector<ReachabilityRange> reachability_ranges;
+	Vector<uint32_t> reachability_range_offsets;
+	bool use_reachability_ranges = false;
+	unsigned num_ladder_blocks = 0;
+	unsigned num_helper_blocks = 0;
+	unsigned num_duplicated_nodes = 0;
+	unsigned num_recompute_cfg_calls = 0;
+	unsigned num_recompute_cfg_splices = 0;
+	unsigned num_recompute_cfg_rebuilds = 0;
+
+	StructurizerPassStats pass_stats[unsigned(StructurizerPass::Count)] = {};
+	class PassScope;
+
+	// CFG generation the current dominance and reachability analysis was built from.
+	uint64_t analysis_cfg_generation = UINT64_MAX;
+	bool analysis_has_fake_branches = false;
+	bool validate_cfg_analysis = false;
+
+	// Blocks spliced in front of an existing block since the last rebuild, which took over
+	// all forward preds of that block in order. As long as these are the only CFG edits,
+	// recompute_cfg() patches the analysis instead of rebuilding it.
+	struct CFGSplice
+	{
+		CFGNode *pred;
+		CFGNode *node;
+	};
+	Vector<CFGSplice> cfg_splices;
+	uint64_t cfg_splice_generation = UINT64_MAX;
+	void record_cfg_splice(CFGNode *pred, CFGNode *node, const CFGNodeList &node_preds,
+	                       uint64_t generation, size_t node_count);
+	bool apply_cfg_splices();
+
+	// Loop nesting forest over the dominator tree, built with the CFG analysis and only
+	// trusted while the CFG generation is unchanged. Blocks are indexed by forward post-visit order.
+	// A block dominates another if its dominator tree pre-order interval contains the other's.
+	// Loop exits are traced on first use and cached.
+	struct LoopForestBlock
+	{
+		uint32_t dominator_pre_order;
+		uint32_t dominator_subtree_size;
+		// Innermost loop whose header dominates (or is) this block.
+		uint32_t innermost_loop;
+	};
+	struct LoopForestLoop
+	{
+		CFGNode *header;
+		uint32_t parent;
+		uint32_t depth;
+		uint32_t exit_offset;
+		uint32_t exit_count;
+		bool exits_traced;
+	};
+	static constexpr uint32_t NoLoop = UINT32_MAX;
+	Vector<LoopForestBlock> loop_forest_blocks;
+	mutable Vector<LoopForestLoop> loop_forest_loops;
+	mutable Vector<CFGNode *> loop_forest_exits;
+	uint64_t loop_forest_generation = UINT64_MAX;
+	void build_loop_forest();
+	bool loop_forest_contains(const CFGNode &node) const;
+	bool query_dominance(const CFGNode &a, const CFGNode &b) const;
+	const CFGNode *get_innermost_loop_header_from_forest(const CFGNode *header, const CFGNode *other) const;
+	void get_loop_exits(CFGNode *header, Vector<CFGNode *> &exits) const;
+	static void trace_loop_exits(CFGNode *header, Vector<CFGNode *> &exits);
 
 	UnorderedSet<const CFGNode *> reachable_nodes;
 	UnorderedSet<const CFGNode *> structured_loop_merge_targets;
 	void visit(CFGNode &entry);
 	void visit_for_back_edge_analysis(CFGNode &entry);
+	static void reset_structured_analysis(CFGNode &node);
+	void serialize_cfg_analysis(Vector<uintptr_t> &state);
 	void backwards_visit();
 	void backwards_visit(CFGNode &entry);
 	void build_immediate_dominators();
 	void build_immediate_post_dominators();
 	void build_reachability();
 	void visit_reachability(const CFGNode &node);
+	bool build_reachability_ranges();
+	void validate_reachability_ranges() const;
 	bool query_reachability(const CFGNode &from, const CFGNode &to) const;
 	void structurize(unsigned pass);
+	template <typename Op>
+	auto run_pass(StructurizerPass pass, const Op &op) -> decltype(op());
 	void find_loops();
 	bool rewrite_transposed_loops();
 
@@ -148,6 +292,9 @@ private:
 	                                                       const UnorderedSet<const CFGNode *> &normal_preds);
 
 	static CFGNode *find_common_post_dominator(const Vector<CFGNode *> &candidates);
+	static CFGNode *find_common_post_dominator(const CFGNodeList &candidates);
+	template <typename List>
+	static CFGNode *find_common_post_dominator_in_list(const List &candidates);
 	static CFGNode *find_common_post_dominator_with_ignored_break(Vector<CFGNode *> candidates,
 	                                                              const CFGNode *break_node);
 	CFGNode *find_break_target_for_selection_construct(CFGNode *idom, CFGNode *merge);
@@ -181,6 +328,8 @@ private:
 	void rewrite_multiple_back_edges();
 	void compute_dominance_frontier();
 	void compute_post_dominance_frontier();
+	bool build_frontiers(const Vector<CFGNode *> &order, bool post);
+	void validate_frontiers(const Vector<CFGNode *> &order, bool post);
 	void create_continue_block_ladders();
 	static void recompute_dominance_frontier(CFGNode *node);
 	static void recompute_post_dominance_frontier(CFGNode *node);
@@ -191,6 +340,38 @@ private:
 	CFGNode *get_post_dominance_frontier_with_cfg_subset_that_reaches(const CFGNode *node,
 	                                                                  const CFGNode *must_reach,
 	                                                                  const CFGNode *must_reach_frontier) const;
+	CFGNode *compute_post_dominance_frontier_with_cfg_subset_that_reaches(const CFGNode *node,
+	                                                                      const CFGNode *must_reach,
+	                                                                      const CFGNode *must_reach_frontier) const;
+
+	// Memoized frontier queries. Only trusted while the CFG generation is unchanged
+	// and the analysis is a full rebuild of that generation.
+	struct PathQueryKey
+	{
+		const CFGNode *node;
+		const CFGNode *must_reach;
+		const CFGNode *must_reach_frontier;
+		bool operator==(const PathQueryKey &other) const
+		{
+			return node == other.node && must_reach == other.must_reach &&
+			       must_reach_frontier == other.must_reach_frontier;
+		}
+	};
+	struct PathQueryKeyHash
+	{
+		size_t operator()(const PathQueryKey &key) const
+		{
+			uint64_t h = 0xcbf29ce484222325ull;
+			h = (h ^ uint64_t(uintptr_t(key.node))) * 0x100000001b3ull;
+			h = (h ^ uint64_t(uintptr_t(key.must_reach))) * 0x100000001b3ull;
+			h = (h ^ uint64_t(uintptr_t(key.must_reach_frontier))) * 0x100000001b3ull;
+			return size_t(h ^ (h >> 32));
+		}
+	};
+	mutable UnorderedMap<PathQueryKey, CFGNode *, PathQueryKeyHash> path_query_memo;
+	mutable uint64_t path_query_generation = UINT64_MAX;
+	mutable unsigned num_path_query_hits = 0;
+	mutable unsigned num_path_query_misses = 0;
 	bool exists_path_in_cfg_without_intermediate_node(const CFGNode *start_block,
 	                                                  const CFGNode *end_block,
 	                                                  const CFGNode *stop_block) const;
@@ -211,6 +392,51 @@ private:
 
 	void fixup_broken_value_dominance();
 
+	// Module access during run(), which goes through the deferred path when enabled.
+	spv::Id allocate_id();
+	Operation *allocate_op(spv::Op op);
+	Operation *allocate_op(spv::Op op, spv::Id id, spv::Id type_id);
+	spv::Id create_variable(spv::StorageClass storage, spv::Id type);
+	spv::Id create_undefined(spv::Id type);
+	spv::Id make_bool_type();
+	spv::Id make_int_type(uint32_t width);
+	spv::Id make_bool_constant(bool value);
+	spv::Id make_uint_constant(uint32_t value);
+	spv::Id make_int_constant(int32_t value);
+	void add_name(spv::Id id, const String &name);
+
+	struct DeferredModuleCall
+	{
+		enum class Type : uint8_t
+		{
+			AllocateId,
+			CreateVariable,
+			CreateUndefined,
+			MakeBoolType,
+			MakeIntType,
+			MakeBoolConstant,
+			MakeUintConstant,
+			MakeIntConstant,
+			AddName
+		};
+		Type type;
+		uint32_t arg0;
+		uint32_t arg1;
+		spv::Id result;
+	};
+	static constexpr spv::Id DeferredIdBase = 0x80000000u;
+	bool defer_module_calls = false;
+	Vector<DeferredModuleCall> deferred_calls;
+	Vector<String> deferred_names;
+	Vector<spv::Id> deferred_ids;
+	ScratchPool<Operation> deferred_operations;
+	// Handed out once deferred_operations fails, which fails run().
+	Operation discarded_op;
+	bool deferred_operations_failed = false;
+	Operation *discard_deferred_op(const Operation &op);
+	spv::Id record_deferred_call(DeferredModuleCall::Type type, uint32_t arg0 = 0, uint32_t arg1 = 0);
+	spv::Id resolve_deferred_id(spv::Id id) const;
+
 	UnorderedMap<uint32_t, CFGNode *> value_id_to_block;
 
 	void log_cfg(const char *tag) const;
@@ -228,6 +454,6 @@ private:
 	template <typename Op>
 	void traverse_dominated_blocks_and_rewrite_branch(const CFGNode *dominator, CFGNode *candidate,
 	                                                  CFGNode *from, CFGNode *to, const Op &op,
-	                                                  UnorderedSet<const CFGNode *> &visitation_cache);
+	                                                  CFGNodeVisitSet &visitation_cache);
 };
 } // namespace dxil_spv
@@ -0,0 +1,1157 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "conversion_cache.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace dxil_spv
+{
+void CacheHasher::byte(uint8_t value)
+{
+	fnv = (fnv ^ value) * 0x100000001b3ull;
+	mix = (mix + value) * 0xff51afd7ed558ccdull;
+	mix ^= mix >> 29;
+}
+
+void CacheHasher::u32(uint32_t value)
+{
+	for (unsigned i = 0; i < 4; i++)
+		byte(uint8_t(value >> (8 * i)));
+}
+
+void CacheHasher::u64(uint64_t value)
+{
+	u32(uint32_t(value));
+	u32(uint32_t(value >> 32));
+}
+
+void CacheHasher::data(const void *data_, size_t size)
+{
+	auto *bytes = static_cast<const uint8_t *>(data_);
+	for (size_t i = 0; i < size; i++)
+		byte(bytes[i]);
+}
+
+void CacheHasher::string(const char *str)
+{
+	if (str)
+	{
+		size_t len = strlen(str);
+		u32(uint32_t(len));
+		data(str, len);
+	}
+	else
+		u32(~0u);
+}
+
+void CacheHasher::key(const CacheKey &key_)
+{
+	u64(key_.lo);
+	u64(key_.hi);
+}
+
+CacheKey CacheHasher::get() const
+{
+	CacheKey key_;
+	key_.lo = fnv;
+	key_.hi = mix ^ (mix >> 31);
+	return key_;
+}
+
+void hash_option(CacheHasher &h, const OptionBase &option)
+{
+	static_assert(unsigned(Option::Count) == 32, "New options must be hashed here.");
+	h.u32(uint32_t(option.type));
+
+	switch (option.type)
+	{
+	case Option::ShaderDemoteToHelper:
+		h.u32(static_cast<const OptionShaderDemoteToHelper &>(option).supported);
+		break;
+
+	case Option::DualSourceBlending:
+		h.u32(static_cast<const OptionDualSourceBlending &>(option).enabled);
+		break;
+
+	case Option::OutputSwizzle:
+	{
+		auto &swiz = static_cast<const OptionOutputSwizzle &>(option);
+		h.u32(swiz.swizzle_count);
+		if (swiz.swizzles)
+			h.data(swiz.swizzles, swiz.swizzle_count * sizeof(*swiz.swizzles));
+		break;
+	}
+
+	case Option::RasterizerSampleCount:
+	{
+		auto &count = static_cast<const OptionRasterizerSampleCount &>(option);
+		h.u32(count.count);
+		h.u32(count.spec_constant);
+		break;
+	}
+
+	case Option::RootConstantInlineUniformBlock:
+	{
+		auto &ubo = static_cast<const OptionRootConstantInlineUniformBlock &>(option);
+		h.u32(ubo.desc_set);
+		h.u32(ubo.binding);
+		h.u32(ubo.enable);
+		break;
+	}
+
+	case Option::BindlessCBVSSBOEmulation:
+		h.u32(static_cast<const OptionBindlessCBVSSBOEmulation &>(option).enable);
+		break;
+
+	case Option::PhysicalStorageBuffer:
+		h.u32(static_cast<const OptionPhysicalStorageBuffer &>(option).enable);
+		break;
+
+	case Option::SBTDescriptorSizeLog2:
+	{
+		auto &sbt = static_cast<const OptionSBTDescriptorSizeLog2 &>(option);
+		h.u32(sbt.size_log2_srv_uav_cbv);
+		h.u32(sbt.size_log2_sampler);
+		break;
+	}
+
+	case Option::SSBOAlignment:
+		h.u32(static_cast<const OptionSSBOAlignment &>(option).alignment);
+		break;
+
+	case Option::TypedUAVReadWithoutFormat:
+		h.u32(static_cast<const OptionTypedUAVReadWithoutFormat &>(option).supported);
+		break;
+
+	case Option::ShaderSourceFile:
+		h.string(static_cast<const OptionShaderSourceFile &>(option).name.c_str());
+		break;
+
+	case Option::BindlessTypedBufferOffsets:
+		h.u32(static_cast<const OptionBindlessTypedBufferOffsets &>(option).enable);
+		break;
+
+	case Option::BindlessOffsetBufferLayout:
+	{
+		auto &layout = static_cast<const OptionBindlessOffsetBufferLayout &>(option);
+		h.u32(layout.untyped_offset);
+		h.u32(layout.typed_offset);
+		h.u32(layout.stride);
+		break;
+	}
+
+	case Option::StorageInputOutput16:
+		h.u32(static_cast<const OptionStorageInputOutput16 &>(option).supported);
+		break;
+
+	case Option::DescriptorQA:
+	{
+		auto &qa = static_cast<const OptionDescriptorQA &>(option);
+		h.u32(qa.enabled);
+		h.u32(qa.version);
+		h.u32(qa.global_desc_set);
+		h.u32(qa.global_binding);
+		h.u32(qa.heap_desc_set);
+		h.u32(qa.heap_binding);
+		h.u64(qa.shader_hash);
+		break;
+	}
+
+	case Option::MinPrecisionNative16Bit:
+		h.u32(static_cast<const OptionMinPrecisionNative16Bit &>(option).enabled);
+		break;
+
+	case Option::ShaderI8Dot:
+		h.u32(static_cast<const OptionShaderI8Dot &>(option).supported);
+		break;
+
+	case Option::ShaderRayTracingPrimitiveCulling:
+		h.u32(static_cast<const OptionShaderRayTracingPrimitiveCulling &>(option).supported);
+		break;
+
+	case Option::InvariantPosition:
+		h.u32(static_cast<const OptionInvariantPosition &>(option).enabled);
+		break;
+
+	case Option::ScalarBlockLayout:
+	{
+		auto &scalar = static_cast<const OptionScalarBlockLayout &>(option);
+		h.u32(scalar.supported);
+		h.u32(scalar.supports_per_component_robustness);
+		break;
+	}
+
+	case Option::BarycentricKHR:
+		h.u32(static_cast<const OptionBarycentricKHR &>(option).supported);
+		break;
+
+	case Option::RobustPhysicalCBVLoad:
+		h.u32(static_cast<const OptionRobustPhysicalCBVLoad &>(option).enabled);
+		break;
+
+	case Option::ArithmeticRelaxedPrecision:
+		h.u32(static_cast<const OptionArithmeticRelaxedPrecision &>(option).enabled);
+		break;
+
+	case Option::PhysicalAddressDescriptorIndexing:
+	{
+		auto &indexing = static_cast<const OptionPhysicalAddressDescriptorIndexing &>(option);
+		h.u32(indexing.element_stride);
+		h.u32(indexing.element_offset);
+		break;
+	}
+
+	case Option::ForceSubgroupSize:
+	{
+		auto &subgroup = static_cast<const OptionForceSubgroupSize &>(option);
+		h.u32(subgroup.forced_value);
+		h.u32(subgroup.wave_size_enable);
+		break;
+	}
+
+	case Option::DenormPreserveSupport:
+	{
+		auto &denorm = static_cast<const OptionDenormPreserveSupport &>(option);
+		h.u32(denorm.support_float16_denorm_preserve);
+		h.u32(denorm.support_float64_denorm_preserve);
+		break;
+	}
+
+	case Option::StrictHelperLaneWaveOps:
+		h.u32(static_cast<const OptionStrictHelperLaneWaveOps &>(option).enable);
+		break;
+
+	case Option::SubgroupPartitionedNV:
+		h.u32(static_cast<const OptionSubgroupPartitionedNV &>(option).supported);
+		break;
+
+	case Option::DeadCodeEliminate:
+		h.u32(static_cast<const OptionDeadCodeEliminate &>(option).enabled);
+		break;
+
+	case Option::PreciseControl:
+	{
+		auto &precise = static_cast<const OptionPreciseControl &>(option);
+		h.u32(precise.force_precise);
+		h.u32(precise.propagate_precise);
+		break;
+	}
+
+	case Option::SampleGradOptimizationControl:
+	{
+		auto &grad = static_cast<const OptionSampleGradOptimizationControl &>(option);
+		h.u32(grad.enabled);
+		h.u32(grad.assume_uniform_scale);
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+enum class RemapQuery : uint32_t
+{
+	SRV,
+	Sampler,
+	UAV,
+	CBV,
+	VertexInput,
+	StreamOutput,
+	StageInput,
+	StageOutput,
+	RootConstantWordCount,
+	RootDescriptorCount,
+	NontrivialStageInputRemapping
+};
+
+static void write_string(Vector<uint32_t> &words, const char *str)
+{
+	if (!str)
+	{
+		words.push_back(~0u);
+		return;
+	}
+
+	size_t len = strlen(str);
+	words.push_back(uint32_t(len));
+	size_t offset = words.size();
+	words.resize(offset + (len + 3) / 4);
+	memcpy(words.data() + offset, str, len);
+}
+
+static void write(Vector<uint32_t> &words, const D3DBinding &binding)
+{
+	words.push_back(uint32_t(binding.stage));
+	words.push_back(uint32_t(binding.kind));
+	words.push_back(binding.resource_index);
+	words.push_back(binding.register_space);
+	words.push_back(binding.register_index);
+	words.push_back(binding.range_size);
+	words.push_back(binding.alignment);
+}
+
+static void write(Vector<uint32_t> &words, const D3DStageIO &io)
+{
+	write_string(words, io.semantic);
+	words.push_back(io.semantic_index);
+	words.push_back(io.start_row);
+	words.push_back(io.rows);
+}
+
+static void write(Vector<uint32_t> &words, const VulkanBinding &binding)
+{
+	words.push_back(binding.descriptor_set);
+	words.push_back(binding.binding);
+	words.push_back(binding.root_constant_index);
+	words.push_back(binding.bindless.heap_root_offset);
+	words.push_back(binding.bindless.use_heap);
+	words.push_back(uint32_t(binding.descriptor_type));
+}
+
+static void write(Vector<uint32_t> &words, const VulkanSRVBinding &binding)
+{
+	write(words, binding.buffer_binding);
+	write(words, binding.offset_binding);
+}
+
+static void write(Vector<uint32_t> &words, const VulkanUAVBinding &binding)
+{
+	write(words, binding.buffer_binding);
+	write(words, binding.counter_binding);
+	write(words, binding.offset_binding);
+}
+
+static void write(Vector<uint32_t> &words, const VulkanCBVBinding &binding)
+{
+	// push.offset_in_words aliases buffer.descriptor_set.
+	words.push_back(binding.push_constant);
+	write(words, binding.buffer);
+}
+
+static void write(Vector<uint32_t> &words, const VulkanStageIO &io)
+{
+	words.push_back(io.location);
+	words.push_back(io.component);
+	words.push_back(io.flags);
+}
+
+static void write(Vector<uint32_t> &words, const VulkanStreamOutput &output)
+{
+	words.push_back(output.offset);
+	words.push_back(output.stride);
+	words.push_back(output.buffer_index);
+	words.push_back(output.enable);
+}
+
+namespace
+{
+struct TranscriptReader
+{
+	explicit TranscriptReader(const Vector<uint32_t> &words_)
+	    : words(words_)
+	{
+	}
+
+	const Vector<uint32_t> &words;
+	size_t offset = 0;
+	bool ok = true;
+
+	bool eof() const
+	{
+		return offset >= words.size();
+	}
+
+	uint32_t next()
+	{
+		if (offset >= words.size())
+		{
+			ok = false;
+			return 0;
+		}
+		return words[offset++];
+	}
+
+	// Returns nullptr for a null string.
+	const char *read_string(String &str)
+	{
+		uint32_t len = next();
+		if (len == ~0u)
+			return nullptr;
+
+		size_t num_words = (size_t(len) + 3) / 4;
+		if (!ok || num_words > words.size() - offset)
+		{
+			ok = false;
+			return "";
+		}
+
+		str.assign(reinterpret_cast<const char *>(words.data() + offset), len);
+		offset += num_words;
+		return str.c_str();
+	}
+
+	void read(D3DBinding &binding)
+	{
+		binding.stage = ShaderStage(next());
+		binding.kind = DXIL::ResourceKind(next());
+		binding.resource_index = next();
+		binding.register_space = next();
+		binding.register_index = next();
+		binding.range_size = next();
+		binding.alignment = next();
+	}
+
+	void read(D3DStageIO &io, String &semantic)
+	{
+		io.semantic = read_string(semantic);
+		io.semantic_index = next();
+		io.start_row = next();
+		io.rows = next();
+	}
+
+	void read(VulkanBinding &binding)
+	{
+		binding.descriptor_set = next();
+		binding.binding = next();
+		binding.root_constant_index = next();
+		binding.bindless.heap_root_offset = next();
+		binding.bindless.use_heap = next() != 0;
+		binding.descriptor_type = VulkanDescriptorType(next());
+	}
+
+	void read(VulkanSRVBinding &binding)
+	{
+		read(binding.buffer_binding);
+		read(binding.offset_binding);
+	}
+
+	void read(VulkanUAVBinding &binding)
+	{
+		read(binding.buffer_binding);
+		read(binding.counter_binding);
+		read(binding.offset_binding);
+	}
+
+	void read(VulkanCBVBinding &binding)
+	{
+		binding.push_constant = next() != 0;
+		read(binding.buffer);
+	}
+
+	void read(VulkanStageIO &io)
+	{
+		io.location = next();
+		io.component = next();
+		io.flags = next();
+	}
+
+	void read(VulkanStreamOutput &output)
+	{
+		output.offset = next();
+		output.stride = next();
+		output.buffer_index = next();
+		output.enable = next() != 0;
+	}
+};
+}
+
+RecordingRemapper::RecordingRemapper(ResourceRemappingInterface &iface_)
+    : iface(iface_)
+{
+}
+
+// The initial state of the output struct is part of the input,
+// since remappers are free to leave it untouched.
+bool RecordingRemapper::remap_srv(const D3DBinding &d3d_binding, VulkanSRVBinding &vulkan_binding)
+{
+	inputs.push_back(uint32_t(RemapQuery::SRV));
+	write(inputs, d3d_binding);
+	write(inputs, vulkan_binding);
+	bool ret = iface.remap_srv(d3d_binding, vulkan_binding);
+	outputs.push_back(ret);
+	write(outputs, vulkan_binding);
+	return ret;
+}
+
+bool RecordingRemapper::remap_sampler(const D3DBinding &d3d_binding, VulkanBinding &vulkan_binding)
+{
+	inputs.push_back(uint32_t(RemapQuery::Sampler));
+	write(inputs, d3d_binding);
+	write(inputs, vulkan_binding);
+	bool ret = iface.remap_sampler(d3d_binding, vulkan_binding);
+	outputs.push_back(ret);
+	write(outputs, vulkan_binding);
+	return ret;
+}
+
+bool RecordingRemapper::remap_uav(const D3DUAVBinding &d3d_binding, VulkanUAVBinding &vulkan_binding)
+{
+	inputs.push_back(uint32_t(RemapQuery::UAV));
+	write(inputs, d3d_binding.binding);
+	inputs.push_back(d3d_binding.counter);
+	write(inputs, vulkan_binding);
+	bool ret = iface.remap_uav(d3d_binding, vulkan_binding);
+	outputs.push_back(ret);
+	write(outputs, vulkan_binding);
+	return ret;
+}
+
+bool RecordingRemapper::remap_cbv(const D3DBinding &d3d_binding, VulkanCBVBinding &vulkan_binding)
+{
+	inputs.push_back(uint32_t(RemapQuery::CBV));
+	write(inputs, d3d_binding);
+	write(inputs, vulkan_binding);
+	bool ret = iface.remap_cbv(d3d_binding, vulkan_binding);
+	outputs.push_back(ret);
+	write(outputs, vulkan_binding);
+	return ret;
+}
+
+bool RecordingRemapper::remap_vertex_input(const D3DStageIO &d3d_input, VulkanStageIO &vulkan_location)
+{
+	inputs.push_back(uint32_t(RemapQuery::VertexInput));
+	write(inputs, d3d_input);
+	write(inputs, vulkan_location);
+	bool ret = iface.remap_vertex_input(d3d_input, vulkan_location);
+	outputs.push_back(ret);
+	write(outputs, vulkan_location);
+	return ret;
+}
+
+bool RecordingRemapper::remap_stream_output(const D3DStreamOutput &d3d_output, VulkanStreamOutput &vulkan_output)
+{
+	inputs.push_back(uint32_t(RemapQuery::StreamOutput));
+	write_string(inputs, d3d_output.semantic);
+	inputs.push_back(d3d_output.semantic_index);
+	write(inputs, vulkan_output);
+	bool ret = iface.remap_stream_output(d3d_output, vulkan_output);
+	outputs.push_back(ret);
+	write(outputs, vulkan_output);
+	return ret;
+}
+
+bool RecordingRemapper::remap_stage_input(const D3DStageIO &d3d_input, VulkanStageIO &vk_input)
+{
+	inputs.push_back(uint32_t(RemapQuery::StageInput));
+	write(inputs, d3d_input);
+	write(inputs, vk_input);
+	bool ret = iface.remap_stage_input(d3d_input, vk_input);
+	outputs.push_back(ret);
+	write(outputs, vk_input);
+	return ret;
+}
+
+bool RecordingRemapper::remap_stage_output(const D3DStageIO &d3d_output, VulkanStageIO &vk_output)
+{
+	inputs.push_back(uint32_t(RemapQuery::StageOutput));
+	write(inputs, d3d_output);
+	write(inputs, vk_output);
+	bool ret = iface.remap_stage_output(d3d_output, vk_output);
+	outputs.push_back(ret);
+	write(outputs, vk_output);
+	return ret;
+}
+
+unsigned RecordingRemapper::get_root_constant_word_count()
+{
+	inputs.push_back(uint32_t(RemapQuery::RootConstantWordCount));
+	unsigned ret = iface.get_root_constant_word_count();
+	outputs.push_back(ret);
+	return ret;
+}
+
+unsigned RecordingRemapper::get_root_descriptor_count()
+{
+	inputs.push_back(uint32_t(RemapQuery::RootDescriptorCount));
+	unsigned ret = iface.get_root_descriptor_count();
+	outputs.push_back(ret);
+	return ret;
+}
+
+bool RecordingRemapper::has_nontrivial_stage_input_remapping()
+{
+	inputs.push_back(uint32_t(RemapQuery::NontrivialStageInputRemapping));
+	bool ret = iface.has_nontrivial_stage_input_remapping();
+	outputs.push_back(ret);
+	return ret;
+}
+
+const Vector<uint32_t> &RecordingRemapper::get_inputs() const
+{
+	return inputs;
+}
+
+const Vector<uint32_t> &RecordingRemapper::get_outputs() const
+{
+	return outputs;
+}
+
+bool RecordingRemapper::replay(ResourceRemappingInterface &iface, const Vector<uint32_t> &inputs,
+                               Vector<uint32_t> &outputs)
+{
+	TranscriptReader reader(inputs);
+	String semantic;
+	outputs.clear();
+
+	while (reader.ok && !reader.eof())
+	{
+		auto query = RemapQuery(reader.next());
+		bool ret;
+
+		switch (query)
+		{
+		case RemapQuery::SRV:
+		{
+			D3DBinding d3d = {};
+			VulkanSRVBinding vk = {};
+			reader.read(d3d);
+			reader.read(vk);
+			if (!reader.ok)
+				return false;
+			ret = iface.remap_srv(d3d, vk);
+			outputs.push_back(ret);
+			write(outputs, vk);
+			break;
+		}
+
+		case RemapQuery::Sampler:
+		{
+			D3DBinding d3d = {};
+			VulkanBinding vk = {};
+			reader.read(d3d);
+			reader.read(vk);
+			if (!reader.ok)
+				return false;
+			ret = iface.remap_sampler(d3d, vk);
+			outputs.push_back(ret);
+			write(outputs, vk);
+			break;
+		}
+
+		case RemapQuery::UAV:
+		{
+			D3DUAVBinding d3d = {};
+			VulkanUAVBinding vk = {};
+			reader.read(d3d.binding);
+			d3d.counter = reader.next() != 0;
+			reader.read(vk);
+			if (!reader.ok)
+				return false;
+			ret = iface.remap_uav(d3d, vk);
+			outputs.push_back(ret);
+			write(outputs, vk);
+			break;
+		}
+
+		case RemapQuery::CBV:
+		{
+			D3DBinding d3d = {};
+			VulkanCBVBinding vk = {};
+			reader.read(d3d);
+			reader.read(vk);
+			if (!reader.ok)
+				return false;
+			ret = iface.remap_cbv(d3d, vk);
+			outputs.push_back(ret);
+			write(outputs, vk);
+			break;
+		}
+
+		case RemapQuery::VertexInput:
+		case RemapQuery::StageInput:
+		case RemapQuery::StageOutput:
+		{
+			D3DStageIO d3d = {};
+			VulkanStageIO vk = {};
+			reader.read(d3d, semantic);
+			reader.read(vk);
+			if (!reader.ok)
+				return false;
+
+			if (query == RemapQuery::VertexInput)
+				ret = iface.remap_vertex_input(d3d, vk);
+			else if (query == RemapQuery::StageInput)
+				ret = iface.remap_stage_input(d3d, vk);
+			else
+				ret = iface.remap_stage_output(d3d, vk);
+
+			outputs.push_back(ret);
+			write(outputs, vk);
+			break;
+		}
+
+		case RemapQuery::StreamOutput:
+		{
+			D3DStreamOutput d3d = {};
+			VulkanStreamOutput vk = {};
+			d3d.semantic = reader.read_string(semantic);
+			d3d.semantic_index = reader.next();
+			reader.read(vk);
+			if (!reader.ok)
+				return false;
+			ret = iface.remap_stream_output(d3d, vk);
+			outputs.push_back(ret);
+			write(outputs, vk);
+			break;
+		}
+
+		case RemapQuery::RootConstantWordCount:
+			outputs.push_back(iface.get_root_constant_word_count());
+			break;
+
+		case RemapQuery::RootDescriptorCount:
+			outputs.push_back(iface.get_root_descriptor_count());
+			break;
+
+		case RemapQuery::NontrivialStageInputRemapping:
+			outputs.push_back(iface.has_nontrivial_stage_input_remapping());
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	return reader.ok;
+}
+
+static constexpr uint32_t CacheMagic = 0x43535844; // DXSC
+static constexpr uint32_t CacheFormatVersion = 1;
+static const char CacheEntrySuffix[] = ".dxsc";
+static const char CacheTempSuffix[] = ".tmp";
+
+// Temporary files older than this are assumed to be left over from a crashed process.
+static constexpr uint64_t StaleTempFileSeconds = 60 * 60;
+
+struct CacheEntryHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key_lo;
+	uint64_t key_hi;
+	uint64_t payload_words;
+	uint64_t checksum_lo;
+	uint64_t checksum_hi;
+};
+static_assert(sizeof(CacheEntryHeader) == 48, "Unexpected padding in cache header.");
+
+static CacheKey compute_checksum(const Vector<uint32_t> &payload)
+{
+	CacheHasher h;
+	h.data(payload.data(), payload.size() * sizeof(uint32_t));
+	return h.get();
+}
+
+static bool string_ends_with(const char *str, const char *suffix)
+{
+	size_t len = strlen(str);
+	size_t suffix_len = strlen(suffix);
+	return len >= suffix_len && memcmp(str + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+namespace
+{
+struct DirectoryEntry
+{
+	std::string path;
+	uint64_t size;
+	uint64_t mtime;
+	bool temporary;
+};
+}
+
+#ifdef _WIN32
+static uint64_t filetime_to_seconds(const FILETIME &ft)
+{
+	uint64_t t = (uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+	// 100ns intervals since 1601 -> seconds since 1970.
+	return t / 10000000ull - 11644473600ull;
+}
+#endif
+
+static bool list_cache_directory(const std::string &directory, std::vector<DirectoryEntry> &entries)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE handle = FindFirstFileA((directory + "\\*").c_str(), &data);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	do
+	{
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+
+		bool temporary = string_ends_with(data.cFileName, CacheTempSuffix);
+		if (!temporary && !string_ends_with(data.cFileName, CacheEntrySuffix))
+			continue;
+
+		DirectoryEntry entry;
+		entry.path = directory + "\\" + data.cFileName;
+		entry.size = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+		entry.mtime = filetime_to_seconds(data.ftLastWriteTime);
+		entry.temporary = temporary;
+		entries.push_back(std::move(entry));
+	} while (FindNextFileA(handle, &data));
+
+	FindClose(handle);
+	return true;
+#else
+	DIR *dir = opendir(directory.c_str());
+	if (!dir)
+		return false;
+
+	while (auto *ent = readdir(dir))
+	{
+		bool temporary = string_ends_with(ent->d_name, CacheTempSuffix);
+		if (!temporary && !string_ends_with(ent->d_name, CacheEntrySuffix))
+			continue;
+
+		DirectoryEntry entry;
+		entry.path = directory + "/" + ent->d_name;
+
+		// Another process might have evicted it already.
+		struct stat st;
+		if (stat(entry.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		entry.size = uint64_t(st.st_size);
+		entry.mtime = uint64_t(st.st_mtime);
+		entry.temporary = temporary;
+		entries.push_back(std::move(entry));
+	}
+
+	closedir(dir);
+	return true;
+#endif
+}
+
+static bool publish_file(const char *from, const char *to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	// rename() atomically replaces the target, so concurrent readers see either the old or the new entry.
+	return rename(from, to) == 0;
+#endif
+}
+
+static void touch_file(const char *path)
+{
+#ifdef _WIN32
+	_utime(path, nullptr);
+#else
+	utime(path, nullptr);
+#endif
+}
+
+static uint32_t get_process_id()
+{
+#ifdef _WIN32
+	return uint32_t(GetCurrentProcessId());
+#else
+	return uint32_t(getpid());
+#endif
+}
+
+namespace
+{
+// Distinguishes a file from one published under the same path later on.
+struct FileIdentity
+{
+	uint64_t device;
+	uint64_t index;
+	uint64_t size;
+	uint64_t mtime;
+
+	bool operator==(const FileIdentity &other) const
+	{
+		return device == other.device && index == other.index && size == other.size && mtime == other.mtime;
+	}
+};
+}
+
+#ifdef _WIN32
+static bool get_file_identity(HANDLE handle, FileIdentity &identity)
+{
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!GetFileInformationByHandle(handle, &info))
+		return false;
+
+	identity.device = info.dwVolumeSerialNumber;
+	identity.index = (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+	identity.size = (uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+	identity.mtime = (uint64_t(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+	return true;
+}
+#else
+static void get_file_identity(const struct stat &st, FileIdentity &identity)
+{
+	identity.device = uint64_t(st.st_dev);
+	identity.index = uint64_t(st.st_ino);
+	identity.size = uint64_t(st.st_size);
+	identity.mtime = uint64_t(st.st_mtime);
+}
+#endif
+
+static bool get_file_identity(FILE *file, FileIdentity &identity)
+{
+#ifdef _WIN32
+	return get_file_identity(HANDLE(_get_osfhandle(_fileno(file))), identity);
+#else
+	struct stat st;
+	if (fstat(fileno(file), &st) != 0)
+		return false;
+	get_file_identity(st, identity);
+	return true;
+#endif
+}
+
+static bool get_file_identity(const char *path, FileIdentity &identity)
+{
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+	                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+	bool ret = get_file_identity(handle, identity);
+	CloseHandle(handle);
+	return ret;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+	get_file_identity(st, identity);
+	return true;
+#endif
+}
+
+bool ConversionCache::init(const char *directory_, uint64_t max_size_)
+{
+	directory = directory_;
+	while (directory.size() > 1 && (directory.back() == '/' || directory.back() == '\\'))
+		directory.pop_back();
+	max_size = max_size_;
+
+#ifdef _WIN32
+	if (!CreateDirectoryA(directory.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+	{
+		LOGE("Failed to create cache directory %s.\n", directory.c_str());
+		return false;
+	}
+#else
+	if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST)
+	{
+		LOGE("Failed to create cache directory %s.\n", directory.c_str());
+		return false;
+	}
+
+	struct stat st;
+	if (stat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+	{
+		LOGE("Cache path %s is not a directory.\n", directory.c_str());
+		return false;
+	}
+#endif
+
+	evict();
+	return true;
+}
+
+std::string ConversionCache::get_entry_path(const CacheKey &key) const
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/%016llx%016llx", static_cast<unsigned long long>(key.hi),
+	         static_cast<unsigned long long>(key.lo));
+	return directory + name + CacheEntrySuffix;
+}
+
+bool ConversionCache::load(const CacheKey &key, Vector<uint32_t> &payload) const
+{
+	auto path = get_entry_path(key);
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	FileIdentity identity;
+	bool have_identity = get_file_identity(file, identity);
+
+	CacheEntryHeader header = {};
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == CacheMagic &&
+	             header.version == CacheFormatVersion && header.key_lo == key.lo && header.key_hi == key.hi;
+
+	if (valid)
+	{
+		// Validate against the file size before trusting the header with an allocation.
+		long payload_offset = ftell(file);
+		fseek(file, 0, SEEK_END);
+		long file_size = ftell(file);
+		fseek(file, payload_offset, SEEK_SET);
+		valid = file_size >= payload_offset &&
+		        uint64_t(file_size - payload_offset) == header.payload_words * sizeof(uint32_t);
+	}
+
+	if (valid)
+	{
+		payload.resize(header.payload_words);
+		valid = payload.empty() || fread(payload.data(), sizeof(uint32_t), payload.size(), file) == payload.size();
+	}
+
+	fclose(file);
+
+	if (valid)
+	{
+		auto checksum = compute_checksum(payload);
+		valid = checksum.lo == header.checksum_lo && checksum.hi == header.checksum_hi;
+	}
+
+	if (!valid)
+	{
+		payload.clear();
+
+		// Another process may have published a good entry in the meantime, so only remove the file we read.
+		// Losing the race between the check and remove() merely costs that process a cache miss.
+		FileIdentity current;
+		if (have_identity && get_file_identity(path.c_str(), current) && current == identity)
+		{
+			LOGW("Discarding corrupt cache entry %s.\n", path.c_str());
+			remove(path.c_str());
+		}
+		return false;
+	}
+
+	// Recently used entries survive eviction.
+	touch_file(path.c_str());
+	return true;
+}
+
+bool ConversionCache::store(const CacheKey &key, const Vector<uint32_t> &payload) const
+{
+	static std::atomic<uint32_t> temp_counter;
+
+	auto path = get_entry_path(key);
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".%u.%u%s", get_process_id(), temp_counter.fetch_add(1, std::memory_order_relaxed),
+	         CacheTempSuffix);
+	auto temp_path = path + suffix;
+
+	FILE *file = fopen(temp_path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	auto checksum = compute_checksum(payload);
+	CacheEntryHeader header = {};
+	header.magic = CacheMagic;
+	header.version = CacheFormatVersion;
+	header.key_lo = key.lo;
+	header.key_hi = key.hi;
+	header.payload_words = payload.size();
+	header.checksum_lo = checksum.lo;
+	header.checksum_hi = checksum.hi;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+	          (payload.empty() || fwrite(payload.data(), sizeof(uint32_t), payload.size(), file) == payload.size());
+	ok = fclose(file) == 0 && ok;
+
+	if (!ok || !publish_file(temp_path.c_str(), path.c_str()))
+	{
+		remove(temp_path.c_str());
+		return false;
+	}
+
+	// Replacing an existing entry overcounts, which only makes the next scan happen a bit earlier.
+	uint64_t written = sizeof(header) + payload.size() * sizeof(uint32_t);
+	if (max_size != 0 && estimated_size.fetch_add(written, std::memory_order_relaxed) + written > max_size)
+		evict();
+	return true;
+}
+
+void ConversionCache::evict() const
+{
+	if (max_size == 0)
+		return;
+
+	std::vector<DirectoryEntry> entries;
+	if (!list_cache_directory(directory, entries))
+		return;
+
+	uint64_t now = uint64_t(time(nullptr));
+	uint64_t total_size = 0;
+	for (auto &entry : entries)
+	{
+		if (entry.temporary)
+		{
+			if (entry.mtime + StaleTempFileSeconds < now)
+				remove(entry.path.c_str());
+		}
+		else
+			total_size += entry.size;
+	}
+
+	if (total_size <= max_size)
+	{
+		estimated_size.store(total_size, std::memory_order_relaxed);
+		return;
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const DirectoryEntry &a, const DirectoryEntry &b) {
+		return a.mtime < b.mtime;
+	});
+
+	// Leave some headroom so that the estimate does not cross max_size again on the very next store.
+	uint64_t target_size = max_size - max_size / 8;
+	for (auto &entry : entries)
+	{
+		if (total_size <= target_size)
+			break;
+		if (entry.temporary)
+			continue;
+
+		// If another process removed it first, we still count it as freed.
+		remove(entry.path.c_str());
+		total_size -= entry.size;
+	}
+
+	estimated_size.store(total_size, std::memory_order_relaxed);
+}
+}
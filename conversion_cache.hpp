@@ -0,0 +1,117 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "thread_local_allocator.hpp"
+#include "dxil_converter.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <atomic>
+
+namespace dxil_spv
+{
+struct CacheKey
+{
+	uint64_t lo = 0;
+	uint64_t hi = 0;
+};
+
+// Two independent 64-bit lanes, so accidental collisions in a long-lived cache are not a concern.
+class CacheHasher
+{
+public:
+	void u32(uint32_t value);
+	void u64(uint64_t value);
+	void data(const void *data, size_t size);
+	void string(const char *str);
+	void key(const CacheKey &key);
+	CacheKey get() const;
+
+private:
+	uint64_t fnv = 0xcbf29ce484222325ull;
+	uint64_t mix = 0x9e3779b97f4a7c15ull;
+	void byte(uint8_t value);
+};
+
+void hash_option(CacheHasher &hasher, const OptionBase &option);
+
+// Forwards to another remapping interface and records every query.
+// The inputs can later be replayed against a different interface to check whether it
+// would respond identically, which is what makes a cached conversion reusable.
+class RecordingRemapper : public ResourceRemappingInterface
+{
+public:
+	explicit RecordingRemapper(ResourceRemappingInterface &iface);
+
+	bool remap_srv(const D3DBinding &d3d_binding, VulkanSRVBinding &vulkan_binding) override;
+	bool remap_sampler(const D3DBinding &d3d_binding, VulkanBinding &vulkan_binding) override;
+	bool remap_uav(const D3DUAVBinding &d3d_binding, VulkanUAVBinding &vulkan_binding) override;
+	bool remap_cbv(const D3DBinding &d3d_binding, VulkanCBVBinding &vulkan_binding) override;
+	bool remap_vertex_input(const D3DStageIO &d3d_input, VulkanStageIO &vulkan_location) override;
+	bool remap_stream_output(const D3DStreamOutput &d3d_output, VulkanStreamOutput &vulkan_output) override;
+	bool remap_stage_input(const D3DStageIO &d3d_input, VulkanStageIO &vk_input) override;
+	bool remap_stage_output(const D3DStageIO &d3d_output, VulkanStageIO &vk_output) override;
+	unsigned get_root_constant_word_count() override;
+	unsigned get_root_descriptor_count() override;
+	bool has_nontrivial_stage_input_remapping() override;
+
+	const Vector<uint32_t> &get_inputs() const;
+	const Vector<uint32_t> &get_outputs() const;
+
+	// Re-issues recorded inputs against iface and regenerates the outputs.
+	// Returns false if the inputs are malformed.
+	static bool replay(ResourceRemappingInterface &iface, const Vector<uint32_t> &inputs, Vector<uint32_t> &outputs);
+
+private:
+	ResourceRemappingInterface &iface;
+	Vector<uint32_t> inputs;
+	Vector<uint32_t> outputs;
+};
+
+// Content-addressed blob store in a directory shared between processes.
+// Entries are published with an atomic rename and carry a checksum, so readers never observe
+// partially written files. Damaged entries are treated as a miss, and removed unless they were replaced meanwhile.
+// The least recently used entries are evicted once the directory grows beyond max_size bytes.
+// The directory is only scanned on init and when the running size estimate crosses max_size,
+// so entries written by other processes are accounted for at the next scan.
+// Does not use the thread local allocator, since a cache typically outlives many allocator contexts.
+class ConversionCache
+{
+public:
+	bool init(const char *directory, uint64_t max_size);
+
+	bool load(const CacheKey &key, Vector<uint32_t> &payload) const;
+	bool store(const CacheKey &key, const Vector<uint32_t> &payload) const;
+
+private:
+	std::string directory;
+	uint64_t max_size = 0;
+	// Size of the directory as of the last scan plus everything stored through this object since.
+	mutable std::atomic<uint64_t> estimated_size{ 0 };
+
+	std::string get_entry_path(const CacheKey &key) const;
+	void evict() const;
+};
+}
@@ -33,6 +33,7 @@
 #include "node.hpp"
 #include "node_pool.hpp"
 #include "spirv_module.hpp"
+#include "timer.hpp"
 
 #include <utility>
 
@@ -120,6 +121,7 @@ bool Converter::shader_requires_feature(ShaderFeature feature) const
 
 ConvertedFunction Converter::convert_entry_point()
 {
+	ScopedAllocatorTag tag(AllocatorTag::Converter);
 	return impl->convert_entry_point();
 }
 
@@ -141,6 +143,19 @@ static String get_string_metadata(const llvm::MDNode *node, unsigned index)
 #endif
 }
 
+static unsigned get_metadata_kind(llvm::Module &module, const char *name)
+{
+#ifdef HAVE_LLVMBC
+	// The module may be shared between converters, so kinds must not be interned here.
+	// LLVMContext interns the kinds the converter queries up front.
+	unsigned kind = module.getContext().findMDKindID(name);
+	assert(kind != UINT32_MAX);
+	return kind;
+#else
+	return module.getContext().getMDKindID(name);
+#endif
+}
+
 static String get_resource_name_metadata(const llvm::MDNode *node, const llvm::MDNode *reflections)
 {
 	if (reflections)
@@ -5028,7 +5043,7 @@ static bool instruction_has_side_effects(const llvm::Instruction &instruction)
 	if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&instruction))
 	{
 		auto *called_function = call_inst->getCalledFunction();
-		if (strncmp(called_function->getName().data(), "dx.op", 5) == 0)
+		if (function_is_dxil_op(called_function))
 			return dxil_instruction_has_side_effects(call_inst);
 		else
 			return true;
@@ -5056,11 +5071,11 @@ bool Converter::Impl::emit_instruction(CFGNode *block, const llvm::Instruction &
 	if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&instruction))
 	{
 		auto *called_function = call_inst->getCalledFunction();
-		if (strncmp(called_function->getName().data(), "dx.op", 5) == 0)
+		if (function_is_dxil_op(called_function))
 		{
 			return emit_dxil_instruction(*this, call_inst);
 		}
-		else if (strncmp(called_function->getName().data(), "llvm.", 5) == 0)
+		else if (function_is_llvm_intrinsic(called_function))
 		{
 			// lib_6_6 sometimes emits llvm.lifetime.begin/end for some bizarre reason.
 			// Just ignore ...
@@ -5241,8 +5256,17 @@ bool Converter::Impl::emit_execution_modes_hull()
 		auto *patch_constant = llvm::cast<llvm::ConstantAsMetadata>(arguments->getOperand(0));
 		auto *patch_constant_value = patch_constant->getValue();
 		execution_mode_meta.patch_constant_function = llvm::cast<llvm::Function>(patch_constant_value);
-		if (!analyze_instructions(execution_mode_meta.patch_constant_function))
-			return false;
+		{
+			ScopedTimer timer(stats ? &stats->materialize_ns : nullptr);
+			if (!bitcode_parser.materialize(execution_mode_meta.patch_constant_function))
+				return false;
+		}
+
+		{
+			ScopedTimer timer(stats ? &stats->analyze_instructions_ns : nullptr);
+			if (!analyze_instructions(execution_mode_meta.patch_constant_function))
+				return false;
+		}
 
 		unsigned input_control_points = get_constant_metadata(arguments, 1);
 		unsigned output_control_points = get_constant_metadata(arguments, 2);
@@ -5715,15 +5739,23 @@ bool Converter::Impl::emit_execution_modes()
 	return true;
 }
 
-CFGNode *Converter::Impl::build_rov_main(llvm::Function *func, CFGNodePool &pool,
-                                         Vector<ConvertedFunction::LeafFunction> &leaves)
+CFGNode *Converter::Impl::build_rov_main(llvm::Function *func, ConvertedFunction &result)
 {
+	auto &pool = *result.node_pool;
 	auto *code_main = convert_function(func, pool);
+	if (!code_main)
+		return nullptr;
 
 	// Need to figure out if our ROV use is trivial. If not, we will wrap the entire function in ROV pairs.
 	CFGStructurizer cfg{code_main, pool, spirv_module};
 	bool trivial_rewrite = cfg.rewrite_rov_lock_region();
 
+	if (thread_allocator_out_of_memory())
+	{
+		LOGE("Allocator context ran out of memory while rewriting ROV lock region.\n");
+		return nullptr;
+	}
+
 	if (trivial_rewrite)
 		return code_main;
 
@@ -5735,19 +5767,22 @@ CFGNode *Converter::Impl::build_rov_main(llvm::Function *func, CFGNodePool &pool
 
 	code_func->moveLocalVariablesFrom(spirv_module.get_entry_function());
 
-	auto *entry = pool.create_node();
+	// The wrapper gets a new node pool, the converted function keeps its own.
+	auto code_pool = std::move(result.node_pool);
+	result.node_pool = std::make_unique<CFGNodePool>();
+
+	auto *entry = result.node_pool->create_node();
 	entry->ir.operations.push_back(allocate(spv::OpBeginInvocationInterlockEXT));
 	auto *call_op = allocate(spv::OpFunctionCall, builder().makeVoidType());
 	call_op->add_id(code_func->getId());
 	entry->ir.operations.push_back(call_op);
 	entry->ir.operations.push_back(allocate(spv::OpEndInvocationInterlockEXT));
 	entry->ir.terminator.type = Terminator::Type::Return;
-	leaves.push_back({ code_main, code_func });
+	result.leaf_functions.push_back({ code_main, code_func, std::move(code_pool) });
 	return entry;
 }
 
-CFGNode *Converter::Impl::build_hull_main(llvm::Function *func, CFGNodePool &pool,
-                                          Vector<ConvertedFunction::LeafFunction> &leaves)
+CFGNode *Converter::Impl::build_hull_main(llvm::Function *func, ConvertedFunction &result)
 {
 	// Just make sure there is an entry block already created.
 	spv::Block *hull_entry, *patch_entry;
@@ -5757,15 +5792,20 @@ CFGNode *Converter::Impl::build_hull_main(llvm::Function *func, CFGNodePool &poo
 	    builder().makeFunctionEntry(spv::NoPrecision, builder().makeVoidType(), "patch_main", {}, {}, &patch_entry);
 
 	// Set build point so alloca() functions can create variables correctly.
+	auto hull_pool = std::make_unique<CFGNodePool>();
+	auto patch_pool = std::make_unique<CFGNodePool>();
 	builder().setBuildPoint(hull_entry);
-	auto *hull_main = convert_function(func, pool);
+	auto *hull_main = convert_function(func, *hull_pool);
 	builder().setBuildPoint(patch_entry);
-	auto *patch_main = convert_function(execution_mode_meta.patch_constant_function, pool);
+	auto *patch_main = convert_function(execution_mode_meta.patch_constant_function, *patch_pool);
 	builder().setBuildPoint(spirv_module.get_entry_function()->getEntryBlock());
+	if (!hull_main || !patch_main)
+		return nullptr;
 
-	leaves.push_back({ hull_main, hull_func });
-	leaves.push_back({ patch_main, patch_func });
+	result.leaf_functions.push_back({ hull_main, hull_func, std::move(hull_pool) });
+	result.leaf_functions.push_back({ patch_main, patch_func, std::move(patch_pool) });
 
+	auto &pool = *result.node_pool;
 	auto *entry = pool.create_node();
 
 	auto *call_op = allocate(spv::OpFunctionCall, builder().makeVoidType());
@@ -5823,6 +5863,8 @@ CFGNode *Converter::Impl::build_hull_main(llvm::Function *func, CFGNodePool &poo
 
 CFGNode *Converter::Impl::convert_function(llvm::Function *func, CFGNodePool &pool)
 {
+	ScopedTimer timer(stats ? &stats->convert_function_ns : nullptr);
+
 	auto *entry = &func->getEntryBlock();
 	auto entry_meta = std::make_unique<BlockMeta>(entry);
 	bb_map[entry] = entry_meta.get();
@@ -5867,6 +5909,12 @@ CFGNode *Converter::Impl::convert_function(llvm::Function *func, CFGNodePool &po
 
 	for (auto *bb : visit_order)
 	{
+		if (thread_allocator_out_of_memory())
+		{
+			LOGE("Allocator context ran out of memory while converting function.\n");
+			return {};
+		}
+
 		auto *meta = bb_map[bb];
 		CFGNode *node = meta->node;
 		combined_image_sampler_cache.clear();
@@ -6048,39 +6096,42 @@ static bool instruction_is_precise_sensitive(const llvm::Instruction *value)
 	return false;
 }
 
-static bool instruction_requires_no_contraction(const llvm::Instruction *value)
+static bool instruction_requires_no_contraction(const llvm::Instruction *value, unsigned precise_kind)
 {
 	if (instruction_is_precise_sensitive(value))
 	{
 		if (auto *binary_op = llvm::dyn_cast<llvm::BinaryOperator>(value))
 			return !binary_op->isFast();
 		else
-			return llvm::cast<llvm::CallInst>(value)->hasMetadata("dx.precise");
+			return llvm::cast<llvm::CallInst>(value)->hasMetadata(precise_kind);
 	}
 
 	return false;
 }
 
-static void propagate_precise(UnorderedSet<const llvm::Instruction *> &cache, const llvm::Instruction *value);
+static void propagate_precise(UnorderedSet<const llvm::Instruction *> &cache, const llvm::Instruction *value,
+                              unsigned precise_kind);
 
-static void mark_precise(UnorderedSet<const llvm::Instruction *> &cache, const llvm::Value *value)
+static void mark_precise(UnorderedSet<const llvm::Instruction *> &cache, const llvm::Value *value,
+                         unsigned precise_kind)
 {
 	// Stop propagating when we hit something not an instruction, i.e. a constant or variable (alloca is very rare).
 	if (auto *inst = llvm::dyn_cast<llvm::Instruction>(value))
 	{
-		if (instruction_is_precise_sensitive(inst) && !instruction_requires_no_contraction(inst))
+		if (instruction_is_precise_sensitive(inst) && !instruction_requires_no_contraction(inst, precise_kind))
 		{
 			if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(inst))
-				const_cast<llvm::CallInst *>(call_inst)->setMetadata("dx.precise", nullptr);
+				const_cast<llvm::CallInst *>(call_inst)->setMetadata(precise_kind, nullptr);
 			else if (auto *binary_op = llvm::dyn_cast<llvm::BinaryOperator>(inst))
 				const_cast<llvm::BinaryOperator *>(binary_op)->setFast(false);
 		}
 
-		propagate_precise(cache, inst);
+		propagate_precise(cache, inst, precise_kind);
 	}
 }
 
-static void propagate_precise(UnorderedSet<const llvm::Instruction *> &cache, const llvm::Instruction *value)
+static void propagate_precise(UnorderedSet<const llvm::Instruction *> &cache, const llvm::Instruction *value,
+                              unsigned precise_kind)
 {
 	if (cache.count(value) != 0)
 		return;
@@ -6089,26 +6140,26 @@ static void propagate_precise(UnorderedSet<const llvm::Instruction *> &cache, co
 	if (const auto *phi = llvm::dyn_cast<llvm::PHINode>(value))
 	{
 		for (unsigned i = 0, n = phi->getNumIncomingValues(); i < n; i++)
-			mark_precise(cache, phi->getIncomingValue(i));
+			mark_precise(cache, phi->getIncomingValue(i), precise_kind);
 	}
 	else
 	{
 		for (unsigned i = 0, n = value->getNumOperands(); i < n; i++)
-			mark_precise(cache, value->getOperand(i));
+			mark_precise(cache, value->getOperand(i), precise_kind);
 	}
 }
 
-static void propagate_precise(const llvm::Function *function)
+static void propagate_precise(const llvm::Function *function, unsigned precise_kind)
 {
 	Vector<const llvm::Instruction *> precise_instructions;
 	for (auto &bb : *function)
 		for (auto &inst : bb)
-			if (instruction_requires_no_contraction(&inst))
+			if (instruction_requires_no_contraction(&inst, precise_kind))
 				precise_instructions.push_back(&inst);
 
 	UnorderedSet<const llvm::Instruction *> visitation_cache;
 	for (auto *inst : precise_instructions)
-		propagate_precise(visitation_cache, inst);
+		propagate_precise(visitation_cache, inst, precise_kind);
 }
 
 bool Converter::Impl::analyze_instructions(const llvm::Function *function)
@@ -6124,7 +6175,7 @@ bool Converter::Impl::analyze_instructions(const llvm::Function *function)
 	// of ExtractValue analysis.
 
 	if (options.propagate_precise && !options.force_precise)
-		propagate_precise(function);
+		propagate_precise(function, metadata_kinds.precise);
 
 	for (auto &bb : *function)
 	{
@@ -6133,6 +6184,9 @@ bool Converter::Impl::analyze_instructions(const llvm::Function *function)
 
 		for (auto &inst : bb)
 		{
+			if (stats)
+				stats->num_llvm_instructions++;
+
 			if (options.eliminate_dead_code)
 				mark_used_values(&inst);
 
@@ -6169,7 +6223,7 @@ bool Converter::Impl::analyze_instructions(const llvm::Function *function)
 			else if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst))
 			{
 				auto *called_function = call_inst->getCalledFunction();
-				if (strncmp(called_function->getName().data(), "dx.op", 5) == 0)
+				if (function_is_dxil_op(called_function))
 				{
 					if (!analyze_dxil_instruction(*this, call_inst, &bb))
 						return false;
@@ -6185,7 +6239,7 @@ bool Converter::Impl::analyze_instructions(const llvm::Function *function)
 			if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst))
 			{
 				auto *called_function = call_inst->getCalledFunction();
-				if (strncmp(called_function->getName().data(), "dx.op", 5) == 0)
+				if (function_is_dxil_op(called_function))
 				{
 					if (!analyze_dxil_buffer_access_instruction(*this, call_inst))
 						return false;
@@ -6215,6 +6269,8 @@ ConvertedFunction Converter::Impl::convert_entry_point()
 	ConvertedFunction result = {};
 
 	auto &module = bitcode_parser.get_module();
+	metadata_kinds.precise = get_metadata_kind(module, "dx.precise");
+	metadata_kinds.nonuniform = get_metadata_kind(module, "dx.nonuniform");
 	entry_point_meta = get_entry_point_meta(module, options.entry_point.empty() ? nullptr : options.entry_point.c_str());
 	execution_model = get_execution_model(module, entry_point_meta);
 
@@ -6244,6 +6300,16 @@ ConvertedFunction Converter::Impl::convert_entry_point()
 		builder.setSourceFile(options.shader_source_file);
 	}
 
+	// Only parse the function bodies which are reachable from this entry point.
+	{
+		ScopedTimer timer(stats ? &stats->materialize_ns : nullptr);
+		if (!bitcode_parser.materialize(get_entry_point_function(entry_point_meta)))
+		{
+			LOGE("Failed to parse entry point function.\n");
+			return result;
+		}
+	}
+
 	result.node_pool = std::make_unique<CFGNodePool>();
 	auto &pool = *result.node_pool;
 
@@ -6255,13 +6321,19 @@ ConvertedFunction Converter::Impl::convert_entry_point()
 		return result;
 	if (!emit_resources_global_mapping())
 		return result;
-	if (!analyze_instructions())
-		return result;
+	{
+		ScopedTimer timer(stats ? &stats->analyze_instructions_ns : nullptr);
+		if (!analyze_instructions())
+			return result;
+	}
 	if (!emit_execution_modes())
 		return result;
 
-	if (!emit_resources())
-		return result;
+	{
+		ScopedTimer timer(stats ? &stats->emit_resources_ns : nullptr);
+		if (!emit_resources())
+			return result;
+	}
 	if (!emit_stage_input_variables())
 		return result;
 	if (!emit_stage_output_variables())
@@ -6283,9 +6355,9 @@ ConvertedFunction Converter::Impl::convert_entry_point()
 	assert(func);
 
 	if (execution_model == spv::ExecutionModelTessellationControl)
-		result.entry = build_hull_main(func, pool, result.leaf_functions);
+		result.entry = build_hull_main(func, result);
 	else if (execution_mode_meta.declares_rov)
-		result.entry = build_rov_main(func, pool, result.leaf_functions);
+		result.entry = build_rov_main(func, result);
 	else
 		result.entry = convert_function(func, pool);
 
@@ -6741,6 +6813,11 @@ void Converter::set_entry_point(const char *entry)
 	impl->options.entry_point = entry;
 }
 
+void Converter::set_stats(ConverterStats *stats)
+{
+	impl->stats = stats;
+}
+
 const String &Converter::get_compiled_entry_point() const
 {
 	return impl->execution_mode_meta.entry_point_name;
@@ -41,10 +41,12 @@ struct ConvertedFunction
 {
 	CFGNode *entry;
 
+	// Every function owns its CFG nodes, so functions can be structurized independently.
 	struct LeafFunction
 	{
 		CFGNode *entry;
 		spv::Function *func;
+		std::unique_ptr<CFGNodePool> node_pool;
 	};
 	Vector<LeafFunction> leaf_functions;
 	std::unique_ptr<CFGNodePool> node_pool;
@@ -616,6 +618,16 @@ enum class ShaderFeature
 	Count
 };
 
+// Wall times are in nanoseconds. Accumulated over the lifetime of the converter.
+struct ConverterStats
+{
+	uint64_t materialize_ns = 0;
+	uint64_t analyze_instructions_ns = 0;
+	uint64_t emit_resources_ns = 0;
+	uint64_t convert_function_ns = 0;
+	uint64_t num_llvm_instructions = 0;
+};
+
 class Converter
 {
 public:
@@ -659,6 +671,9 @@ public:
 
 	bool shader_requires_feature(ShaderFeature feature) const;
 
+	// Opt-in. If set, per-phase timings are accumulated into stats during convert_entry_point().
+	void set_stats(ConverterStats *stats);
+
 	struct Impl;
 
 private:
@@ -163,7 +163,8 @@ static void print_help()
 	     "\t[--subgroup-partitioned-nv]\n"
 	     "\t[--dead-code-eliminate]\n"
 	     "\t[--propagate-precise]\n"
-	     "\t[--force-precise]\n");
+	     "\t[--force-precise]\n"
+	     "\t[--structurizer-threads <count>]\n");
 }
 
 struct Arguments
@@ -200,6 +201,7 @@ struct Arguments
 	bool force_precise = false;
 
 	unsigned ssbo_alignment = 1;
+	unsigned structurizer_threads = 0;
 	unsigned physical_address_indexing_stride = 1;
 	unsigned physical_address_indexing_offset = 0;
 
@@ -743,6 +745,9 @@ int main(int argc, char **argv)
 	cbs.add("--force-precise", [&](CLIParser &) {
 		args.force_precise = true;
 	});
+	cbs.add("--structurizer-threads", [&](CLIParser &parser) {
+		args.structurizer_threads = parser.next_uint();
+	});
 	cbs.error_handler = [] { print_help(); };
 	cbs.default_handler = [&](const char *arg) { args.input_path = arg; };
 	CLIParser cli_parser(std::move(cbs), argc - 1, argv + 1);
@@ -1015,6 +1020,8 @@ int main(int argc, char **argv)
 		else if (!args.entry_point.empty())
 			dxil_spv_converter_set_entry_point(converter, args.entry_point.c_str());
 
+		dxil_spv_converter_set_structurizer_threads(converter, args.structurizer_threads);
+
 		if (dxil_spv_converter_run(converter) != DXIL_SPV_SUCCESS)
 		{
 			LOGE("Failed to convert DXIL to SPIR-V.\n");
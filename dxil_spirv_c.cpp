@@ -24,14 +24,26 @@
 
 #include "thread_local_allocator.hpp"
 #include "dxil_spirv_c.h"
+#include "conversion_cache.hpp"
 #include "dxil_converter.hpp"
 #include "dxil_parser.hpp"
 #include "llvm_bitcode_parser.hpp"
 #include "logging.hpp"
 #include "spirv_module.hpp"
+#include "cfg_structurizer.hpp"
+#include "SpvBuilder.h"
+#include "timer.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
 #include <string.h>
+#include <thread>
 #include <new>
 
+#ifdef DXIL_SPV_HAVE_BUILD_ID
+#include "dxil_spv_build_id.h"
+#endif
+
 using namespace dxil_spv;
 
 void dxil_spv_get_version(unsigned *major, unsigned *minor, unsigned *patch)
@@ -54,6 +66,10 @@ struct dxil_spv_parsed_blob_s
 
 	struct Names { String mangled, demangled; };
 	Vector<Names> entry_points;
+
+	uint64_t container_parse_ns = 0;
+	uint64_t bitcode_parse_ns = 0;
+	uint64_t parse_allocated_bytes = 0;
 };
 
 struct Remapper : ResourceRemappingInterface
@@ -371,13 +387,21 @@ struct LocalRootParameter
 	Vector<DescriptorTableEntry> table_entries;
 };
 
+struct dxil_spv_conversion_cache_s
+{
+	ConversionCache cache;
+};
+
 struct dxil_spv_converter_s
 {
-	dxil_spv_converter_s(LLVMBCParser &bc_parser_, LLVMBCParser *bc_reflection_parser_)
-		: bc_parser(bc_parser_), bc_reflection_parser(bc_reflection_parser_)
+	dxil_spv_converter_s(dxil_spv_parsed_blob_s &blob_, dxil_spv_parsed_blob_s *reflection_blob_)
+		: blob(blob_), reflection_blob(reflection_blob_), bc_parser(blob_.bc),
+		  bc_reflection_parser(reflection_blob_ ? &reflection_blob_->bc : nullptr)
 	{
 	}
 
+	dxil_spv_parsed_blob_s &blob;
+	dxil_spv_parsed_blob_s *reflection_blob;
 	LLVMBCParser &bc_parser;
 	LLVMBCParser *bc_reflection_parser;
 	Vector<uint32_t> spirv;
@@ -397,50 +421,77 @@ struct dxil_spv_converter_s
 	uint32_t wave_size = 0;
 	uint32_t heuristic_wave_size = 0;
 	bool shader_feature_used[unsigned(ShaderFeature::Count)] = {};
+
+	bool stats_enabled = false;
+	bool has_stats = false;
+	dxil_spv_converter_stats stats = {};
+	dxil_spv_structurizer_pass_stats pass_stats[DXIL_SPV_STRUCTURIZER_PASS_COUNT] = {};
+	unsigned long long path_query_hits = 0;
+	unsigned long long path_query_misses = 0;
+
+	unsigned structurizer_threads = 0;
+
+	ConversionCache *cache = nullptr;
+	bool used_conversion_cache = false;
 };
 
 dxil_spv_result dxil_spv_parse_dxil_blob(const void *data, size_t size, dxil_spv_parsed_blob *blob)
 {
+	uint64_t start_bytes = get_thread_allocated_bytes();
 	auto *parsed = new (std::nothrow) dxil_spv_parsed_blob_s;
 	if (!parsed)
 		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
 
 	DXILContainerParser parser;
+	uint64_t start_ns = get_current_time_nsecs();
 	if (!parser.parse_container(data, size, false))
 	{
 		delete parsed;
 		return DXIL_SPV_ERROR_PARSER;
 	}
+	parsed->container_parse_ns = get_current_time_nsecs() - start_ns;
 
 	parsed->dxil_blob = std::move(parser.get_blob());
 	parsed->rdat_subobjects = std::move(parser.get_rdat_subobjects());
 
-	if (!parsed->bc.parse(parsed->dxil_blob.data(), parsed->dxil_blob.size()))
+	start_ns = get_current_time_nsecs();
+	if (!parsed->bc.parse(parsed->dxil_blob.data(), parsed->dxil_blob.size(), true))
 	{
 		delete parsed;
 		return DXIL_SPV_ERROR_PARSER;
 	}
+	parsed->bitcode_parse_ns = get_current_time_nsecs() - start_ns;
 
 	auto names = Converter::get_entry_points(parsed->bc);
 	for (auto &name : names)
 		parsed->entry_points.push_back({ name, demangle_entry_point(name) });
 
+	if (thread_allocator_out_of_memory())
+	{
+		delete parsed;
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+	}
+
+	parsed->parse_allocated_bytes = get_thread_allocated_bytes() - start_bytes;
 	*blob = parsed;
 	return DXIL_SPV_SUCCESS;
 }
 
 dxil_spv_result dxil_spv_parse_reflection_dxil_blob(const void *data, size_t size, dxil_spv_parsed_blob *blob)
 {
+	uint64_t start_bytes = get_thread_allocated_bytes();
 	auto *parsed = new (std::nothrow) dxil_spv_parsed_blob_s;
 	if (!parsed)
 		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
 
 	DXILContainerParser parser;
+	uint64_t start_ns = get_current_time_nsecs();
 	if (!parser.parse_container(data, size, true))
 	{
 		delete parsed;
 		return DXIL_SPV_ERROR_PARSER;
 	}
+	parsed->container_parse_ns = get_current_time_nsecs() - start_ns;
 
 	if (parser.get_blob().empty())
 	{
@@ -450,32 +501,55 @@ dxil_spv_result dxil_spv_parse_reflection_dxil_blob(const void *data, size_t siz
 
 	parsed->dxil_blob = std::move(parser.get_blob());
 
-	if (!parsed->bc.parse(parsed->dxil_blob.data(), parsed->dxil_blob.size()))
+	start_ns = get_current_time_nsecs();
+	if (!parsed->bc.parse(parsed->dxil_blob.data(), parsed->dxil_blob.size(), true))
 	{
 		delete parsed;
 		return DXIL_SPV_ERROR_PARSER;
 	}
+	parsed->bitcode_parse_ns = get_current_time_nsecs() - start_ns;
+
+	if (thread_allocator_out_of_memory())
+	{
+		delete parsed;
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+	}
 
+	parsed->parse_allocated_bytes = get_thread_allocated_bytes() - start_bytes;
 	*blob = parsed;
 	return DXIL_SPV_SUCCESS;
 }
 
 dxil_spv_result dxil_spv_parse_dxil(const void *data, size_t size, dxil_spv_parsed_blob *blob)
 {
+	uint64_t start_bytes = get_thread_allocated_bytes();
 	auto *parsed = new (std::nothrow) dxil_spv_parsed_blob_s;
 	if (!parsed)
 		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
 
-	if (!parsed->bc.parse(data, size))
+	// Function bodies are parsed lazily, so the blob must be retained.
+	auto *bytes = static_cast<const uint8_t *>(data);
+	parsed->dxil_blob.assign(bytes, bytes + size);
+
+	uint64_t start_ns = get_current_time_nsecs();
+	if (!parsed->bc.parse(parsed->dxil_blob.data(), parsed->dxil_blob.size(), true))
 	{
 		delete parsed;
 		return DXIL_SPV_ERROR_PARSER;
 	}
+	parsed->bitcode_parse_ns = get_current_time_nsecs() - start_ns;
 
 	auto names = Converter::get_entry_points(parsed->bc);
 	for (auto &name : names)
 		parsed->entry_points.push_back({ name, demangle_entry_point(name) });
 
+	if (thread_allocator_out_of_memory())
+	{
+		delete parsed;
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+	}
+
+	parsed->parse_allocated_bytes = get_thread_allocated_bytes() - start_bytes;
 	*blob = parsed;
 	return DXIL_SPV_SUCCESS;
 }
@@ -485,7 +559,8 @@ void dxil_spv_parsed_blob_dump_llvm_ir(dxil_spv_parsed_blob blob)
 	auto &module = blob->bc.get_module();
 #ifdef HAVE_LLVMBC
 	String str;
-	if (llvm::disassemble(module, str))
+	// Parse everything under the blob's lock first, so disassembly does not modify the module.
+	if (blob->bc.materialize_all() && llvm::disassemble(module, str))
 		fprintf(stderr, "%s\n", str.c_str());
 	else
 		fprintf(stderr, "Failed to disassemble LLVM IR!\n");
@@ -500,7 +575,7 @@ dxil_spv_result dxil_spv_parsed_blob_get_disassembled_ir(dxil_spv_parsed_blob bl
 
 	auto *module = &blob->bc.get_module();
 #ifdef HAVE_LLVMBC
-	if (!llvm::disassemble(*module, blob->disasm))
+	if (!blob->bc.materialize_all() || !llvm::disassemble(*module, blob->disasm))
 		return DXIL_SPV_ERROR_GENERIC;
 #else
 	llvm::raw_string_ostream ostr(blob->disasm);
@@ -585,7 +660,7 @@ dxil_spv_result dxil_spv_create_converter_with_reflection(dxil_spv_parsed_blob b
                                                           dxil_spv_parsed_blob reflection_blob,
                                                           dxil_spv_converter *converter)
 {
-	auto *conv = new (std::nothrow) dxil_spv_converter_s(blob->bc, reflection_blob ? &reflection_blob->bc : nullptr);
+	auto *conv = new (std::nothrow) dxil_spv_converter_s(*blob, reflection_blob);
 	if (!conv)
 		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
 
@@ -611,14 +686,357 @@ void dxil_spv_converter_set_entry_point(dxil_spv_converter converter, const char
 		converter->entry_point.clear();
 }
 
+// Everything which affects conversion except for remapper responses.
+// Those are validated separately by replaying the recorded remapper queries.
+static CacheKey compute_conversion_base_key(const dxil_spv_converter_s &converter)
+{
+	CacheHasher h;
+	h.u32(DXIL_SPV_API_VERSION_MAJOR);
+	h.u32(DXIL_SPV_API_VERSION_MINOR);
+	h.u32(DXIL_SPV_API_VERSION_PATCH);
+#ifdef DXIL_SPV_BUILD_ID
+	h.string(DXIL_SPV_BUILD_ID);
+#endif
+
+	h.u64(converter.blob.dxil_blob.size());
+	h.data(converter.blob.dxil_blob.data(), converter.blob.dxil_blob.size());
+	if (converter.reflection_blob)
+	{
+		h.u64(converter.reflection_blob->dxil_blob.size());
+		h.data(converter.reflection_blob->dxil_blob.data(), converter.reflection_blob->dxil_blob.size());
+	}
+	else
+		h.u64(~0ull);
+
+	h.string(converter.entry_point.c_str());
+
+	h.u32(uint32_t(converter.options.size()));
+	for (auto &opt : converter.options)
+		hash_option(h, *opt);
+
+	h.u32(uint32_t(converter.local_root_parameters.size()));
+	for (auto &param : converter.local_root_parameters)
+	{
+		h.u32(uint32_t(param.type));
+		switch (param.type)
+		{
+		case LocalRootParameterType::Constants:
+			h.u32(param.local_constants.register_space);
+			h.u32(param.local_constants.register_index);
+			h.u32(param.local_constants.num_words);
+			break;
+
+		case LocalRootParameterType::Descriptor:
+			h.u32(uint32_t(param.local_descriptor.resource_class));
+			h.u32(param.local_descriptor.register_space);
+			h.u32(param.local_descriptor.register_index);
+			break;
+
+		case LocalRootParameterType::Table:
+			h.u32(uint32_t(param.table_entries.size()));
+			for (auto &entry : param.table_entries)
+			{
+				h.u32(uint32_t(entry.type));
+				h.u32(entry.register_space);
+				h.u32(entry.register_index);
+				h.u32(entry.num_descriptors_in_range);
+				h.u32(entry.offset_in_heap);
+			}
+			break;
+		}
+	}
+
+	return h.get();
+}
+
+static CacheKey compute_transcript_key(const CacheKey &base_key)
+{
+	CacheHasher h;
+	h.key(base_key);
+	h.u32(0);
+	return h.get();
+}
+
+static CacheKey compute_result_key(const CacheKey &base_key, const Vector<uint32_t> &remap_inputs,
+                                   const Vector<uint32_t> &remap_outputs)
+{
+	CacheHasher h;
+	h.key(base_key);
+	h.u32(1);
+	h.u64(remap_inputs.size());
+	h.data(remap_inputs.data(), remap_inputs.size() * sizeof(uint32_t));
+	h.u64(remap_outputs.size());
+	h.data(remap_outputs.data(), remap_outputs.size() * sizeof(uint32_t));
+	return h.get();
+}
+
+static void serialize_conversion_result(const dxil_spv_converter_s &converter, Vector<uint32_t> &payload)
+{
+	payload.push_back(uint32_t(converter.spirv.size()));
+	payload.insert(payload.end(), converter.spirv.begin(), converter.spirv.end());
+
+	auto &name = converter.compiled_entry_point;
+	payload.push_back(uint32_t(name.size()));
+	size_t offset = payload.size();
+	payload.resize(offset + (name.size() + 3) / 4);
+	memcpy(payload.data() + offset, name.data(), name.size());
+
+	payload.push_back(converter.uses_subgroup_size);
+	for (auto dim : converter.workgroup_size)
+		payload.push_back(dim);
+	payload.push_back(converter.patch_vertex_count);
+	payload.push_back(converter.wave_size);
+	payload.push_back(converter.heuristic_wave_size);
+	payload.push_back(uint32_t(ShaderFeature::Count));
+	for (auto used : converter.shader_feature_used)
+		payload.push_back(used);
+}
+
+static bool deserialize_conversion_result(dxil_spv_converter_s &converter, const Vector<uint32_t> &payload)
+{
+	size_t offset = 0;
+	const auto remaining = [&]() { return payload.size() - offset; };
+
+	if (remaining() < 1 || payload[offset] > remaining() - 1)
+		return false;
+	size_t spirv_words = payload[offset++];
+	converter.spirv.assign(payload.begin() + offset, payload.begin() + offset + spirv_words);
+	offset += spirv_words;
+
+	if (remaining() < 1)
+		return false;
+	size_t name_len = payload[offset++];
+	size_t name_words = (name_len + 3) / 4;
+	if (name_words > remaining())
+		return false;
+	converter.compiled_entry_point.assign(reinterpret_cast<const char *>(payload.data() + offset), name_len);
+	offset += name_words;
+
+	const size_t num_features = size_t(ShaderFeature::Count);
+	if (remaining() != 8 + num_features || payload[offset + 7] != num_features)
+		return false;
+
+	converter.uses_subgroup_size = payload[offset++] != 0;
+	for (auto &dim : converter.workgroup_size)
+		dim = payload[offset++];
+	converter.patch_vertex_count = payload[offset++];
+	converter.wave_size = payload[offset++];
+	converter.heuristic_wave_size = payload[offset++];
+	offset++;
+	for (auto &used : converter.shader_feature_used)
+		used = payload[offset++] != 0;
+
+	return !converter.spirv.empty();
+}
+
+static bool load_cached_conversion(dxil_spv_converter_s &converter, const CacheKey &base_key)
+{
+	Vector<uint32_t> remap_inputs, remap_outputs, payload;
+	if (!converter.cache->load(compute_transcript_key(base_key), remap_inputs))
+		return false;
+
+	// If the remapper answers the same queries differently, we get a different key.
+	if (!RecordingRemapper::replay(converter.remapper, remap_inputs, remap_outputs))
+		return false;
+
+	if (!converter.cache->load(compute_result_key(base_key, remap_inputs, remap_outputs), payload))
+		return false;
+
+	if (!deserialize_conversion_result(converter, payload))
+	{
+		converter.spirv.clear();
+		return false;
+	}
+
+	return true;
+}
+
+static void store_cached_conversion(const dxil_spv_converter_s &converter, const CacheKey &base_key,
+                                    const RecordingRemapper &recorder)
+{
+	Vector<uint32_t> payload;
+	serialize_conversion_result(converter, payload);
+
+	// Store the result first, so that a published transcript can always find its result
+	// unless it has been evicted.
+	converter.cache->store(compute_result_key(base_key, recorder.get_inputs(), recorder.get_outputs()), payload);
+	converter.cache->store(compute_transcript_key(base_key), recorder.get_inputs());
+}
+
+static_assert(unsigned(StructurizerPass::Count) == DXIL_SPV_STRUCTURIZER_PASS_COUNT,
+              "Structurizer pass enums are out of sync.");
+
+struct StructurizeTask
+{
+	CFGNode *entry;
+	CFGNodePool *pool;
+	// nullptr for the entry point.
+	spv::Function *func;
+	std::unique_ptr<CFGStructurizer> structurizer;
+	uint64_t structurize_ns;
+	uint64_t allocated_bytes;
+	bool ran_on_worker;
+	bool success;
+};
+
+// Runs CFGStructurizer::run() for functions with separate node pools concurrently.
+// Module calls are deferred and committed in function order by the caller, so output is deterministic.
+// Workers mirror the allocator context of the calling thread. Their contexts own memory the CFGs
+// and structurizers refer to, which mix allocations of the caller and the workers, so the caller frees them.
+// Worker memory is not released by that, so workers only tear their contexts down when this object
+// is destroyed, which must be after the CFGs and structurizers are gone.
+// Their allocator stats are folded into the calling thread's context at that point.
+// Workers share the memory limit of the calling thread's context, and an exceeded limit is folded back as well.
+class StructurizerThreads
+{
+public:
+	StructurizerThreads() = default;
+	StructurizerThreads(const StructurizerThreads &) = delete;
+	void operator=(const StructurizerThreads &) = delete;
+	~StructurizerThreads();
+
+	void run(Vector<StructurizeTask> &tasks, unsigned num_threads);
+
+private:
+	std::mutex lock;
+	std::condition_variable cond;
+	std::vector<std::thread> workers;
+	Vector<StructurizeTask> *tasks = nullptr;
+	size_t next_task = 0;
+	size_t completed_tasks = 0;
+	AllocatorContext *caller_context = nullptr;
+	bool shutdown = false;
+
+	bool execute_next_task(bool worker);
+	void worker_main();
+};
+
+StructurizerThreads::~StructurizerThreads()
+{
+	{
+		std::lock_guard<std::mutex> holder{ lock };
+		shutdown = true;
+	}
+	cond.notify_all();
+
+	for (auto &worker : workers)
+		worker.join();
+}
+
+bool StructurizerThreads::execute_next_task(bool worker)
+{
+	size_t index;
+	{
+		std::lock_guard<std::mutex> holder{ lock };
+		if (next_task >= tasks->size())
+			return false;
+		index = next_task++;
+	}
+
+	auto &task = (*tasks)[index];
+	uint64_t start_bytes = get_thread_allocated_bytes();
+	{
+		ScopedTimer timer(&task.structurize_ns);
+		task.success = task.structurizer->run();
+	}
+	task.allocated_bytes = get_thread_allocated_bytes() - start_bytes;
+	task.ran_on_worker = worker;
+
+	{
+		std::lock_guard<std::mutex> holder{ lock };
+		completed_tasks++;
+	}
+	cond.notify_all();
+	return true;
+}
+
+void StructurizerThreads::worker_main()
+{
+	if (caller_context)
+	{
+		begin_thread_allocator_context();
+		share_allocator_context_memory_limit(get_thread_allocator_context(), caller_context);
+	}
+
+	while (execute_next_task(true))
+	{
+	}
+
+	{
+		std::unique_lock<std::mutex> holder{ lock };
+		cond.wait(holder, [this]() { return shutdown; });
+		if (caller_context)
+			add_allocator_context_stats(caller_context, get_thread_allocator_context());
+	}
+
+	if (caller_context)
+		end_thread_allocator_context();
+}
+
+void StructurizerThreads::run(Vector<StructurizeTask> &tasks_, unsigned num_threads)
+{
+	assert(!tasks && workers.empty());
+	tasks = &tasks_;
+	caller_context = get_thread_allocator_context();
+
+	size_t num_workers = std::min<size_t>(num_threads, tasks_.size()) - 1;
+	for (size_t i = 0; i < num_workers; i++)
+		workers.emplace_back(&StructurizerThreads::worker_main, this);
+
+	while (execute_next_task(false))
+	{
+	}
+
+	std::unique_lock<std::mutex> holder{ lock };
+	cond.wait(holder, [&]() { return completed_tasks == tasks_.size(); });
+}
+
 dxil_spv_result dxil_spv_converter_run(dxil_spv_converter converter)
 {
+	converter->used_conversion_cache = false;
+
+	CacheKey base_key;
+	if (converter->cache)
+	{
+		base_key = compute_conversion_base_key(*converter);
+		if (load_cached_conversion(*converter, base_key))
+		{
+			converter->has_stats = false;
+			converter->used_conversion_cache = true;
+			return DXIL_SPV_SUCCESS;
+		}
+	}
+
+	uint64_t start_ns = get_current_time_nsecs();
+	uint64_t start_bytes = get_thread_allocated_bytes();
+	ConverterStats converter_stats;
+	uint64_t emit_function_body_ns = 0;
+	uint64_t finalize_spirv_ns = 0;
+	auto &stats = converter->stats;
+	stats = {};
+	for (auto &pass : converter->pass_stats)
+		pass = {};
+	converter->path_query_hits = 0;
+	converter->path_query_misses = 0;
+	converter->has_stats = false;
+
+	// Must outlive the module and CFGs.
+	StructurizerThreads structurizer_threads;
 	SPIRVModule module;
 	Converter dxil_converter(converter->bc_parser, converter->bc_reflection_parser, module);
+	if (converter->stats_enabled)
+		dxil_converter.set_stats(&converter_stats);
 
 	if (!converter->entry_point.empty())
 		dxil_converter.set_entry_point(converter->entry_point.c_str());
-	dxil_converter.set_resource_remapping_interface(&converter->remapper);
+
+	// With a cache, record every remapper query so that later runs can validate the cached result.
+	RecordingRemapper recorder(converter->remapper);
+	if (converter->cache)
+		dxil_converter.set_resource_remapping_interface(&recorder);
+	else
+		dxil_converter.set_resource_remapping_interface(&converter->remapper);
+
 	for (auto &opt : converter->options)
 		dxil_converter.add_option(*opt);
 
@@ -649,15 +1067,13 @@ dxil_spv_result dxil_spv_converter_run(dxil_spv_converter converter)
 	if (entry_point.entry == nullptr)
 	{
 		LOGE("Failed to convert function.\n");
-		return DXIL_SPV_ERROR_GENERIC;
+		return thread_allocator_out_of_memory() ? DXIL_SPV_ERROR_OUT_OF_MEMORY : DXIL_SPV_ERROR_GENERIC;
 	}
 
-	{
-		dxil_spv::CFGStructurizer structurizer(entry_point.entry, *entry_point.node_pool, module);
-		structurizer.run();
-		module.emit_entry_point_function_body(structurizer);
-	}
+	const bool collect = converter->stats_enabled;
 
+	Vector<StructurizeTask> tasks;
+	tasks.push_back({ entry_point.entry, entry_point.node_pool.get(), nullptr });
 	for (auto &leaf : entry_point.leaf_functions)
 	{
 		if (!leaf.entry)
@@ -665,15 +1081,89 @@ dxil_spv_result dxil_spv_converter_run(dxil_spv_converter converter)
 			LOGE("Leaf function is nullptr!\n");
 			return DXIL_SPV_ERROR_GENERIC;
 		}
-		dxil_spv::CFGStructurizer structurizer(leaf.entry, *entry_point.node_pool, module);
-		structurizer.run();
-		module.emit_leaf_function_body(leaf.func, structurizer);
+		tasks.push_back({ leaf.entry, leaf.node_pool.get(), leaf.func });
 	}
 
-	if (!module.finalize_spirv(converter->spirv))
+	bool parallel_structurize = converter->structurizer_threads > 1 && tasks.size() > 1;
+	if (parallel_structurize)
 	{
-		LOGE("Failed to finalize SPIR-V.\n");
-		return DXIL_SPV_ERROR_GENERIC;
+		for (auto &task : tasks)
+		{
+			task.structurizer.reset(new dxil_spv::CFGStructurizer(task.entry, *task.pool, module));
+			task.structurizer->set_defer_module_calls(true);
+		}
+		structurizer_threads.run(tasks, converter->structurizer_threads);
+		for (auto &task : tasks)
+			if (!task.success)
+				return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+	}
+
+	uint64_t worker_allocated_bytes = 0;
+	for (auto &task : tasks)
+	{
+		// Variables the structurizer creates belong to the function being structurized.
+		auto *func = task.func ? task.func : module.get_entry_function();
+		module.get_builder().setBuildPoint(func->getEntryBlock());
+
+		if (parallel_structurize)
+		{
+			task.structurizer->commit_deferred_module_calls();
+		}
+		else
+		{
+			task.structurizer.reset(new dxil_spv::CFGStructurizer(task.entry, *task.pool, module));
+			ScopedTimer timer(collect ? &task.structurize_ns : nullptr);
+			if (!task.structurizer->run())
+				return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+		}
+
+		auto &structurizer = *task.structurizer;
+		stats.structurize_ns += task.structurize_ns;
+		stats.structurize_max_ns = std::max<unsigned long long>(stats.structurize_max_ns, task.structurize_ns);
+		stats.structurize_count++;
+		stats.num_ladder_blocks += structurizer.get_num_ladder_blocks();
+		converter->path_query_hits += structurizer.get_num_path_query_hits();
+		converter->path_query_misses += structurizer.get_num_path_query_misses();
+		for (unsigned i = 0; i < DXIL_SPV_STRUCTURIZER_PASS_COUNT; i++)
+		{
+			auto &pass = structurizer.get_pass_stats(StructurizerPass(i));
+			auto &total = converter->pass_stats[i];
+			total.time_ns += pass.time_ns;
+			total.invocations += pass.invocations;
+			total.nodes_created += pass.nodes_created;
+			total.ladder_blocks += pass.ladder_blocks;
+			total.helper_blocks += pass.helper_blocks;
+			total.duplicated_nodes += pass.duplicated_nodes;
+			total.recompute_cfg_calls += pass.recompute_cfg_calls;
+			total.recompute_cfg_splices += pass.recompute_cfg_splices;
+			total.recompute_cfg_rebuilds += pass.recompute_cfg_rebuilds;
+		}
+		if (task.ran_on_worker)
+			worker_allocated_bytes += task.allocated_bytes;
+
+		ScopedTimer timer(collect ? &emit_function_body_ns : nullptr);
+		if (task.func)
+			module.emit_leaf_function_body(task.func, structurizer);
+		else
+			module.emit_entry_point_function_body(structurizer);
+		// For worker-built structurizers, this only releases what the calling thread allocated.
+		task.structurizer.reset();
+	}
+
+	{
+		ScopedTimer timer(collect ? &finalize_spirv_ns : nullptr);
+		if (!module.finalize_spirv(converter->spirv))
+		{
+			LOGE("Failed to finalize SPIR-V.\n");
+			return DXIL_SPV_ERROR_GENERIC;
+		}
+	}
+
+	if (thread_allocator_out_of_memory())
+	{
+		LOGE("Allocator context ran out of memory during conversion.\n");
+		converter->spirv.clear();
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
 	}
 
 	converter->compiled_entry_point = dxil_converter.get_compiled_entry_point();
@@ -687,6 +1177,115 @@ dxil_spv_result dxil_spv_converter_run(dxil_spv_converter converter)
 	for (int i = 0; i < int(ShaderFeature::Count); i++)
 		converter->shader_feature_used[i] = dxil_converter.shader_requires_feature(ShaderFeature(i));
 
+	if (collect)
+	{
+		stats.container_parse_ns = converter->blob.container_parse_ns;
+		stats.bitcode_parse_ns = converter->blob.bitcode_parse_ns + converter_stats.materialize_ns;
+		stats.analyze_instructions_ns = converter_stats.analyze_instructions_ns;
+		stats.emit_resources_ns = converter_stats.emit_resources_ns;
+		stats.convert_function_ns = converter_stats.convert_function_ns;
+		stats.emit_function_body_ns = emit_function_body_ns;
+		stats.finalize_spirv_ns = finalize_spirv_ns;
+		stats.total_ns = stats.container_parse_ns + converter->blob.bitcode_parse_ns +
+		                 (get_current_time_nsecs() - start_ns);
+		stats.num_llvm_instructions = converter_stats.num_llvm_instructions;
+		stats.num_cfg_nodes = entry_point.node_pool->get_node_count();
+		for (auto &leaf : entry_point.leaf_functions)
+			stats.num_cfg_nodes += leaf.node_pool->get_node_count();
+		stats.num_spirv_words = converter->spirv.size();
+		stats.num_allocated_bytes = converter->blob.parse_allocated_bytes + worker_allocated_bytes +
+		                            (get_thread_allocated_bytes() - start_bytes);
+		converter->has_stats = true;
+	}
+
+	if (converter->cache)
+		store_cached_conversion(*converter, base_key, recorder);
+
+	return DXIL_SPV_SUCCESS;
+}
+
+dxil_spv_result dxil_spv_create_conversion_cache(const char *directory, unsigned long long max_size_bytes,
+                                                 dxil_spv_conversion_cache *cache)
+{
+#ifndef DXIL_SPV_BUILD_ID
+	// Without a hash of the sources, results from a different build could be served.
+	(void)directory;
+	(void)max_size_bytes;
+	(void)cache;
+	LOGE("Conversion cache requires a build ID, which is generated with Python at build time.\n");
+	return DXIL_SPV_ERROR_UNSUPPORTED_FEATURE;
+#else
+	auto *c = new (std::nothrow) dxil_spv_conversion_cache_s;
+	if (!c)
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+
+	if (!c->cache.init(directory, max_size_bytes))
+	{
+		delete c;
+		return DXIL_SPV_ERROR_GENERIC;
+	}
+
+	*cache = c;
+	return DXIL_SPV_SUCCESS;
+#endif
+}
+
+void dxil_spv_conversion_cache_free(dxil_spv_conversion_cache cache)
+{
+	delete cache;
+}
+
+void dxil_spv_converter_set_conversion_cache(dxil_spv_converter converter, dxil_spv_conversion_cache cache)
+{
+	converter->cache = cache ? &cache->cache : nullptr;
+}
+
+dxil_spv_bool dxil_spv_converter_used_conversion_cache(dxil_spv_converter converter)
+{
+	return converter->used_conversion_cache ? DXIL_SPV_TRUE : DXIL_SPV_FALSE;
+}
+
+void dxil_spv_converter_set_stats_enabled(dxil_spv_converter converter, dxil_spv_bool enable)
+{
+	converter->stats_enabled = bool(enable);
+}
+
+void dxil_spv_converter_set_structurizer_threads(dxil_spv_converter converter, unsigned num_threads)
+{
+	converter->structurizer_threads = num_threads;
+}
+
+dxil_spv_result dxil_spv_converter_get_stats(dxil_spv_converter converter, dxil_spv_converter_stats *stats)
+{
+	if (!converter->has_stats)
+		return DXIL_SPV_ERROR_GENERIC;
+
+	*stats = converter->stats;
+	return DXIL_SPV_SUCCESS;
+}
+
+dxil_spv_result dxil_spv_converter_get_structurizer_pass_stats(dxil_spv_converter converter,
+                                                              dxil_spv_structurizer_pass pass,
+                                                              dxil_spv_structurizer_pass_stats *stats)
+{
+	if (!converter->has_stats)
+		return DXIL_SPV_ERROR_GENERIC;
+	if (unsigned(pass) >= DXIL_SPV_STRUCTURIZER_PASS_COUNT)
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	*stats = converter->pass_stats[pass];
+	stats->name = CFGStructurizer::get_pass_name(StructurizerPass(pass));
+	return DXIL_SPV_SUCCESS;
+}
+
+dxil_spv_result dxil_spv_converter_get_path_query_stats(dxil_spv_converter converter,
+                                                       unsigned long long *hits, unsigned long long *misses)
+{
+	if (!converter->has_stats)
+		return DXIL_SPV_ERROR_GENERIC;
+
+	*hits = converter->path_query_hits;
+	*misses = converter->path_query_misses;
 	return DXIL_SPV_SUCCESS;
 }
 
@@ -1261,6 +1860,94 @@ void dxil_spv_reset_thread_allocator_context(void)
 	reset_thread_allocator_context();
 }
 
+// The C handle is the allocator context itself, so contexts created by
+// dxil_spv_begin_thread_allocator_context() can be unbound and rebound as well.
+static AllocatorContext *get_allocator_context(dxil_spv_allocator_context context)
+{
+	return reinterpret_cast<AllocatorContext *>(context);
+}
+
+static dxil_spv_allocator_context get_allocator_context_handle(AllocatorContext *context)
+{
+	return reinterpret_cast<dxil_spv_allocator_context>(context);
+}
+
+dxil_spv_result dxil_spv_create_allocator_context(dxil_spv_allocator_context *context)
+{
+	auto *ctx = create_allocator_context();
+	if (!ctx)
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+
+	*context = get_allocator_context_handle(ctx);
+	return DXIL_SPV_SUCCESS;
+}
+
+void dxil_spv_allocator_context_free(dxil_spv_allocator_context context)
+{
+	destroy_allocator_context(get_allocator_context(context));
+}
+
+void dxil_spv_allocator_context_reset(dxil_spv_allocator_context context)
+{
+	reset_allocator_context(get_allocator_context(context));
+}
+
+void dxil_spv_allocator_context_set_recycling(dxil_spv_allocator_context context, dxil_spv_bool enable)
+{
+	set_allocator_context_recycling(get_allocator_context(context), bool(enable));
+}
+
+void dxil_spv_allocator_context_set_retention_budget(dxil_spv_allocator_context context, unsigned long long size)
+{
+	set_allocator_context_retention_budget(get_allocator_context(context), size_t(size));
+}
+
+void dxil_spv_allocator_context_set_memory_limit(dxil_spv_allocator_context context, unsigned long long size)
+{
+	set_allocator_context_memory_limit(get_allocator_context(context), size_t(size));
+}
+
+static_assert(int(AllocatorTag::Count) == DXIL_SPV_ALLOCATOR_TAG_COUNT, "Allocator tag count mismatch.");
+
+void dxil_spv_allocator_context_get_stats(dxil_spv_allocator_context context, dxil_spv_allocator_context_stats *stats)
+{
+	AllocatorStats allocator_stats;
+	get_allocator_context_stats(get_allocator_context(context), allocator_stats);
+	stats->requested_bytes = allocator_stats.requested_bytes;
+	stats->allocation_count = allocator_stats.allocation_count;
+	stats->in_use_bytes = allocator_stats.in_use_bytes;
+	stats->peak_in_use_bytes = allocator_stats.peak_in_use_bytes;
+	stats->reserved_bytes = allocator_stats.reserved_bytes;
+	stats->peak_reserved_bytes = allocator_stats.peak_reserved_bytes;
+	stats->huge_bytes = allocator_stats.huge_bytes;
+	stats->peak_huge_bytes = allocator_stats.peak_huge_bytes;
+}
+
+dxil_spv_result dxil_spv_allocator_context_get_tag_stats(dxil_spv_allocator_context context,
+                                                         dxil_spv_allocator_tag tag,
+                                                         dxil_spv_allocator_tag_stats *stats)
+{
+	if (unsigned(tag) >= DXIL_SPV_ALLOCATOR_TAG_COUNT)
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	AllocatorStats allocator_stats;
+	get_allocator_context_stats(get_allocator_context(context), allocator_stats);
+	stats->name = get_allocator_tag_name(AllocatorTag(tag));
+	stats->requested_bytes = allocator_stats.tag_requested_bytes[tag];
+	stats->allocation_count = allocator_stats.tag_allocation_count[tag];
+	return DXIL_SPV_SUCCESS;
+}
+
+dxil_spv_allocator_context dxil_spv_bind_thread_allocator_context(dxil_spv_allocator_context context)
+{
+	return get_allocator_context_handle(bind_thread_allocator_context(get_allocator_context(context)));
+}
+
+dxil_spv_allocator_context dxil_spv_unbind_thread_allocator_context(void)
+{
+	return get_allocator_context_handle(bind_thread_allocator_context(nullptr));
+}
+
 static thread_local dxil_spv_log_cb c_callback_wrapper;
 static void c_callback_wrapper_trampoline(void *userdata, dxil_spv::LogLevel level, const char *msg)
 {
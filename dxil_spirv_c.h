@@ -34,7 +34,7 @@ extern "C" {
 #endif
 
 #define DXIL_SPV_API_VERSION_MAJOR 2
-#define DXIL_SPV_API_VERSION_MINOR 31
+#define DXIL_SPV_API_VERSION_MINOR 42
 #define DXIL_SPV_API_VERSION_PATCH 0
 
 #define DXIL_SPV_DESCRIPTOR_QA_INTERFACE_VERSION 1
@@ -288,6 +288,79 @@ typedef struct dxil_spv_compiled_spirv
 	size_t size;
 } dxil_spv_compiled_spirv;
 
+/* All times are wall clock in nanoseconds. */
+typedef struct dxil_spv_converter_stats
+{
+	unsigned long long container_parse_ns;
+	/* Includes lazy parsing of function bodies during conversion. */
+	unsigned long long bitcode_parse_ns;
+	unsigned long long analyze_instructions_ns;
+	unsigned long long emit_resources_ns;
+	unsigned long long convert_function_ns;
+	/* Sum and maximum over every CFGStructurizer::run(). */
+	unsigned long long structurize_ns;
+	unsigned long long structurize_max_ns;
+	unsigned structurize_count;
+	/* Entry point and leaf function bodies. */
+	unsigned long long emit_function_body_ns;
+	unsigned long long finalize_spirv_ns;
+	unsigned long long total_ns;
+
+	unsigned long long num_llvm_instructions;
+	unsigned long long num_cfg_nodes;
+	unsigned long long num_ladder_blocks;
+	unsigned long long num_spirv_words;
+	/* Bytes requested from the dxil_spv allocator on the calling thread while parsing and converting.
+	 * Only counted while an allocator context is bound, 0 otherwise. */
+	unsigned long long num_allocated_bytes;
+} dxil_spv_converter_stats;
+
+/* Steps of the CFG structurizer, in the order they first run. */
+typedef enum dxil_spv_structurizer_pass
+{
+	DXIL_SPV_STRUCTURIZER_PASS_REWRITE_MULTIPLE_BACK_EDGES = 0,
+	DXIL_SPV_STRUCTURIZER_PASS_RECOMPUTE_CFG = 1,
+	DXIL_SPV_STRUCTURIZER_PASS_CLEANUP_BREAKING_PHI_CONSTRUCTS = 2,
+	DXIL_SPV_STRUCTURIZER_PASS_CLEANUP_BREAKING_RETURN_CONSTRUCTS = 3,
+	DXIL_SPV_STRUCTURIZER_PASS_CREATE_CONTINUE_BLOCK_LADDERS = 4,
+	DXIL_SPV_STRUCTURIZER_PASS_SERIALIZE_INTERLEAVED_MERGE_SCOPES = 5,
+	DXIL_SPV_STRUCTURIZER_PASS_SPLIT_MERGE_SCOPES = 6,
+	DXIL_SPV_STRUCTURIZER_PASS_ELIMINATE_DEGENERATE_BLOCKS = 7,
+	DXIL_SPV_STRUCTURIZER_PASS_DUPLICATE_IMPOSSIBLE_MERGE_CONSTRUCTS = 8,
+	DXIL_SPV_STRUCTURIZER_PASS_REWRITE_TRANSPOSED_LOOPS = 9,
+	DXIL_SPV_STRUCTURIZER_PASS_FIND_SWITCH_BLOCKS = 10,
+	DXIL_SPV_STRUCTURIZER_PASS_FIND_LOOPS = 11,
+	DXIL_SPV_STRUCTURIZER_PASS_FIND_SELECTION_MERGES = 12,
+	DXIL_SPV_STRUCTURIZER_PASS_FIXUP_BROKEN_SELECTION_MERGES = 13,
+	DXIL_SPV_STRUCTURIZER_PASS_SPLIT_MERGE_BLOCKS = 14,
+	DXIL_SPV_STRUCTURIZER_PASS_UPDATE_STRUCTURED_LOOP_MERGE_TARGETS = 15,
+	DXIL_SPV_STRUCTURIZER_PASS_REWRITE_INVALID_LOOP_BREAKS = 16,
+	DXIL_SPV_STRUCTURIZER_PASS_INSERT_PHI = 17,
+	DXIL_SPV_STRUCTURIZER_PASS_COUNT = 18,
+	DXIL_SPV_STRUCTURIZER_PASS_INT_MAX = 0x7fffffff
+} dxil_spv_structurizer_pass;
+
+/* Summed over every CFGStructurizer::run() of a conversion. */
+typedef struct dxil_spv_structurizer_pass_stats
+{
+	/* Function name of the pass, e.g. "split_merge_scopes". */
+	const char *name;
+	unsigned long long time_ns;
+	/* Passes which repeat until they stop making progress count every round. */
+	unsigned long long invocations;
+	unsigned long long nodes_created;
+	unsigned long long ladder_blocks;
+	unsigned long long helper_blocks;
+	/* Per-predecessor copies of blocks which had to be duplicated. */
+	unsigned long long duplicated_nodes;
+	unsigned long long recompute_cfg_calls;
+	/* recompute_cfg calls which patched dominance and reachability for spliced helper blocks.
+	 * Calls which neither spliced nor rebuilt reused the previous analysis as is. */
+	unsigned long long recompute_cfg_splices;
+	/* recompute_cfg calls which had to rebuild dominance and reachability from scratch. */
+	unsigned long long recompute_cfg_rebuilds;
+} dxil_spv_structurizer_pass_stats;
+
 typedef dxil_spv_bool (*dxil_spv_srv_remapper_cb)(void *userdata,
                                                   const dxil_spv_d3d_binding *d3d_binding,
                                                   dxil_spv_srv_vulkan_binding *vulkan_binding);
@@ -589,7 +662,14 @@ typedef struct dxil_spv_option_sample_grad_optimization_control
 DXIL_SPV_PUBLIC_API void dxil_spv_get_version(unsigned *major, unsigned *minor, unsigned *patch);
 
 /* Parsing API */
-/* Parses and frees a DXBC blob. */
+/* Parses and frees a DXBC blob.
+ * Function bodies are parsed when a converter first needs them, so a converter only pays for its entry point
+ * and the functions it calls. Bodies are parsed under a lock owned by the blob, so converters on different threads
+ * can share one blob. The exception is precise propagation (dxil_spv_option_precise_control),
+ * which marks instructions in the blob.
+ * The blob is allocated from the allocator context bound while parsing (if any), and must be freed
+ * before that context is reset or freed, and while it is bound. Function bodies are allocated from a context
+ * owned by the blob, which shares the memory limit of that context, never from the converter's context. */
 typedef struct dxil_spv_parsed_blob_s *dxil_spv_parsed_blob;
 
 /* Parses a DXBC archive as is passed into CreatePipeline, which contains a DXIL blob. */
@@ -721,9 +801,56 @@ DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_begin_local_root_descript
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_end_local_root_descriptor_table(
 	dxil_spv_converter converter);
 
+/* Opt-in collection of dxil_spv_converter_stats. Must be enabled before dxil_spv_converter_run. */
+DXIL_SPV_PUBLIC_API void dxil_spv_converter_set_stats_enabled(dxil_spv_converter converter, dxil_spv_bool enable);
+
+/* Structurizes the entry point and its leaf functions (hull shader control point and patch constant functions,
+ * or code wrapped for ROV) on up to num_threads threads, including the calling thread.
+ * The result is identical to structurizing them one by one. 0 or 1 (default) disables threading.
+ * If a thread allocator context is active, the worker threads use their own contexts. */
+DXIL_SPV_PUBLIC_API void dxil_spv_converter_set_structurizer_threads(dxil_spv_converter converter,
+                                                                    unsigned num_threads);
+
 /* After setting up converter, runs the converted to SPIR-V. */
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_run(dxil_spv_converter converter);
 
+/* After compilation. Requires dxil_spv_converter_set_stats_enabled. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_stats(dxil_spv_converter converter,
+                                                                 dxil_spv_converter_stats *stats);
+
+/* Per-pass breakdown of the structurizer runs. Same requirements as dxil_spv_converter_get_stats. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_structurizer_pass_stats(
+		dxil_spv_converter converter, dxil_spv_structurizer_pass pass, dxil_spv_structurizer_pass_stats *stats);
+
+/* Post-dominance frontier path queries in the structurizer served from its memo table vs. computed.
+ * Same requirements as dxil_spv_converter_get_stats. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_path_query_stats(dxil_spv_converter converter,
+                                                                           unsigned long long *hits,
+                                                                           unsigned long long *misses);
+
+/* Persistent on-disk cache of conversion results.
+ * The directory may be shared by concurrent processes. Entries are keyed on the DXIL, options,
+ * local root signature, entry point and the responses of every remapper callback.
+ * The least recently used entries are evicted once the directory exceeds max_size_bytes (0 means unbounded).
+ * Entries are tagged with the API version and a hash of the dxil-spirv sources taken at build time,
+ * so builds do not share results. If the build could not generate the hash,
+ * creating a cache fails with DXIL_SPV_ERROR_UNSUPPORTED_FEATURE.
+ * A cache may be used by multiple converters on different threads concurrently,
+ * and is not allocated from the thread allocator context. */
+typedef struct dxil_spv_conversion_cache_s *dxil_spv_conversion_cache;
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_create_conversion_cache(const char *directory,
+                                                                     unsigned long long max_size_bytes,
+                                                                     dxil_spv_conversion_cache *cache);
+DXIL_SPV_PUBLIC_API void dxil_spv_conversion_cache_free(dxil_spv_conversion_cache cache);
+
+/* Must outlive the converter. Remapper callbacks may be invoked to validate a cached result. */
+DXIL_SPV_PUBLIC_API void dxil_spv_converter_set_conversion_cache(dxil_spv_converter converter,
+                                                                 dxil_spv_conversion_cache cache);
+
+/* After compilation. Queries if the result was loaded from the conversion cache.
+ * If so, dxil_spv_converter_get_stats has nothing to report. */
+DXIL_SPV_PUBLIC_API dxil_spv_bool dxil_spv_converter_used_conversion_cache(dxil_spv_converter converter);
+
 /* Obtain final SPIR-V. */
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_compiled_spirv(dxil_spv_converter converter,
                                                                           dxil_spv_compiled_spirv *compiled);
@@ -776,6 +903,88 @@ DXIL_SPV_PUBLIC_API void dxil_spv_begin_thread_allocator_context(void);
 DXIL_SPV_PUBLIC_API void dxil_spv_end_thread_allocator_context(void);
 DXIL_SPV_PUBLIC_API void dxil_spv_reset_thread_allocator_context(void);
 
+/* Explicit form of the above. An allocator context is an arena which dxil_spv objects allocate from
+ * while the context is bound to the calling thread.
+ * A context can be unbound and bound on another thread, e.g. to move a conversion between worker threads,
+ * or several contexts can take turns on one thread. A context must be bound to at most one thread at a time,
+ * and dxil_spv objects must be destroyed while the context they were created with is bound.
+ * The begin/end/reset functions above operate on a context owned by the calling thread. */
+typedef struct dxil_spv_allocator_context_s *dxil_spv_allocator_context;
+
+/* Stage of a conversion which allocations from a context are attributed to. */
+typedef enum dxil_spv_allocator_tag
+{
+	DXIL_SPV_ALLOCATOR_TAG_OTHER = 0,
+	DXIL_SPV_ALLOCATOR_TAG_BITCODE_PARSE = 1,
+	DXIL_SPV_ALLOCATOR_TAG_CONVERTER = 2,
+	DXIL_SPV_ALLOCATOR_TAG_STRUCTURIZER = 3,
+	DXIL_SPV_ALLOCATOR_TAG_SPIRV_BUILDER = 4,
+	DXIL_SPV_ALLOCATOR_TAG_COUNT = 5,
+	DXIL_SPV_ALLOCATOR_TAG_INT_MAX = 0x7fffffff
+} dxil_spv_allocator_tag;
+
+/* Counted since the context was created or last reset.
+ * Allocations made by structurizer worker threads are included once dxil_spv_converter_run() returns.
+ * Their peaks are added to the peaks of the context, so peaks are an upper bound after parallel structurization. */
+typedef struct dxil_spv_allocator_context_stats
+{
+	unsigned long long requested_bytes;
+	unsigned long long allocation_count;
+	/* Memory which has not been freed yet. Memory which cannot be recycled stays in use until reset. */
+	unsigned long long in_use_bytes;
+	unsigned long long peak_in_use_bytes;
+	/* Memory held by the context, including memory retained for reuse. */
+	unsigned long long reserved_bytes;
+	unsigned long long peak_reserved_bytes;
+	/* Part of in_use_bytes taken by dedicated blocks for large allocations. */
+	unsigned long long huge_bytes;
+	unsigned long long peak_huge_bytes;
+} dxil_spv_allocator_context_stats;
+
+typedef struct dxil_spv_allocator_tag_stats
+{
+	/* E.g. "structurizer". */
+	const char *name;
+	unsigned long long requested_bytes;
+	unsigned long long allocation_count;
+} dxil_spv_allocator_tag_stats;
+
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_create_allocator_context(dxil_spv_allocator_context *context);
+/* Must not be bound to any thread. */
+DXIL_SPV_PUBLIC_API void dxil_spv_allocator_context_free(dxil_spv_allocator_context context);
+/* Releases all memory allocated from the context. Objects created with it must be destroyed first. */
+DXIL_SPV_PUBLIC_API void dxil_spv_allocator_context_reset(dxil_spv_allocator_context context);
+/* Freed memory is recycled through size-class free lists by default, so peak memory follows live data.
+ * Disabling recycling makes the context a pure bump allocator. */
+DXIL_SPV_PUBLIC_API void dxil_spv_allocator_context_set_recycling(dxil_spv_allocator_context context,
+                                                                  dxil_spv_bool enable);
+/* Memory the context keeps for reuse after a reset, or after large allocations are freed.
+ * Keeping blocks around avoids mapping fresh memory for every conversion. The default is 64 MiB. */
+DXIL_SPV_PUBLIC_API void dxil_spv_allocator_context_set_retention_budget(dxil_spv_allocator_context context,
+                                                                         unsigned long long size);
+/* Caps memory the context holds. 0 means no limit, which is the default.
+ * Once the cap is exceeded, the context is out of memory until it is reset,
+ * and parsing or dxil_spv_converter_run() on it fail with DXIL_SPV_ERROR_OUT_OF_MEMORY.
+ * Work is abandoned at safe points, e.g. between structurizer passes, so the cap can be overshot slightly.
+ * Structurizer threads (dxil_spv_converter_set_structurizer_threads) allocate from contexts of their own,
+ * but their memory is charged against this cap together with the context's own memory,
+ * so the cap covers the whole conversion regardless of thread count.
+ * Objects created with the context remain valid and can be freed as usual. */
+DXIL_SPV_PUBLIC_API void dxil_spv_allocator_context_set_memory_limit(dxil_spv_allocator_context context,
+                                                                     unsigned long long size);
+/* Must not be called while the context is bound to another thread. */
+DXIL_SPV_PUBLIC_API void dxil_spv_allocator_context_get_stats(dxil_spv_allocator_context context,
+                                                              dxil_spv_allocator_context_stats *stats);
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_allocator_context_get_tag_stats(dxil_spv_allocator_context context,
+                                                                             dxil_spv_allocator_tag tag,
+                                                                             dxil_spv_allocator_tag_stats *stats);
+/* Binds context to the calling thread and returns the previously bound context, or NULL.
+ * Binding NULL is the same as unbinding. */
+DXIL_SPV_PUBLIC_API dxil_spv_allocator_context dxil_spv_bind_thread_allocator_context(
+	dxil_spv_allocator_context context);
+/* Returns the context which was bound to the calling thread, or NULL. */
+DXIL_SPV_PUBLIC_API dxil_spv_allocator_context dxil_spv_unbind_thread_allocator_context(void);
+
 /* Converter API */
 
 #ifdef __cplusplus
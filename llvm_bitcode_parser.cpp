@@ -23,6 +23,8 @@
  */
 
 #include "llvm_bitcode_parser.hpp"
+#include "thread_local_allocator.hpp"
+#include <mutex>
 
 #ifdef HAVE_LLVMBC
 #include "context.hpp"
@@ -36,6 +38,9 @@ namespace dxil_spv
 {
 struct LLVMBCParser::Impl
 {
+	std::mutex materialize_lock;
+	// Function bodies are allocated from here. nullptr if the module was parsed without a context.
+	AllocatorContext *body_context = nullptr;
 	llvm::LLVMContext context;
 #ifdef HAVE_LLVMBC
 	llvm::Module *module = nullptr;
@@ -51,18 +56,33 @@ LLVMBCParser::LLVMBCParser()
 
 LLVMBCParser::~LLVMBCParser()
 {
+	// Freeing the bodies with the caller's context bound does nothing, the memory goes away with the context.
+	AllocatorContext *body_context = impl->body_context;
+	impl.reset();
+	destroy_allocator_context(body_context);
 }
 
-bool LLVMBCParser::parse(const void *data, size_t size)
+bool LLVMBCParser::parse(const void *data, size_t size, bool lazy_function_bodies)
 {
+	ScopedAllocatorTag tag(AllocatorTag::BitcodeParse);
 #ifdef HAVE_LLVMBC
-	impl->module = llvm::parseIR(impl->context, data, size);
+	impl->module = llvm::parseIR(impl->context, data, size, lazy_function_bodies);
 	if (!impl->module)
 		return false;
+
+	if (lazy_function_bodies && has_thread_allocator_context())
+	{
+		impl->body_context = create_allocator_context();
+		if (!impl->body_context)
+			return false;
+		share_allocator_context_memory_limit(impl->body_context, get_thread_allocator_context());
+	}
 #else
 	auto memory = llvm::WritableMemoryBuffer::getNewUninitMemBuffer(size);
 	memcpy(memory->getBufferStart(), data, size);
 
+	// LLVM always parses the full module here.
+	(void)lazy_function_bodies;
 	llvm::SMDiagnostic error;
 	impl->module = llvm::parseIR(*memory, error, impl->context);
 	if (!impl->module)
@@ -75,6 +95,43 @@ bool LLVMBCParser::parse(const void *data, size_t size)
 	return true;
 }
 
+#ifdef HAVE_LLVMBC
+template <typename Op>
+static bool materialize_in_body_context(std::mutex &lock, AllocatorContext *body_context, const Op &op)
+{
+	std::lock_guard<std::mutex> holder{ lock };
+	AllocatorContext *prev = bind_thread_allocator_context(body_context);
+	bool ret;
+	{
+		ScopedAllocatorTag tag(AllocatorTag::BitcodeParse);
+		ret = op() && !thread_allocator_out_of_memory();
+	}
+	bind_thread_allocator_context(prev);
+	return ret;
+}
+#endif
+
+bool LLVMBCParser::materialize(llvm::Function *func)
+{
+#ifdef HAVE_LLVMBC
+	return materialize_in_body_context(impl->materialize_lock, impl->body_context,
+	                                   [&]() { return impl->module->materialize(func); });
+#else
+	(void)func;
+	return true;
+#endif
+}
+
+bool LLVMBCParser::materialize_all()
+{
+#ifdef HAVE_LLVMBC
+	return materialize_in_body_context(impl->materialize_lock, impl->body_context,
+	                                   [&]() { return impl->module->materialize_all(); });
+#else
+	return true;
+#endif
+}
+
 llvm::Module &LLVMBCParser::get_module()
 {
 	return *impl->module;
@@ -25,6 +25,7 @@
 #pragma once
 
 #ifdef HAVE_LLVMBC
+#include "context.hpp"
 #include "module.hpp"
 #else
 #include <llvm/IR/LLVMContext.h>
@@ -41,7 +42,16 @@ class LLVMBCParser
 public:
 	LLVMBCParser();
 	~LLVMBCParser();
-	bool parse(const void *data, size_t size);
+	// With lazy_function_bodies, only module level state is parsed up front and data must outlive the parser.
+	// Function bodies are parsed on demand through materialize().
+	// If an allocator context is bound while parsing, the parser creates a context of its own for the bodies,
+	// which shares the memory limit of the bound context. That context must outlive the parser.
+	bool parse(const void *data, size_t size, bool lazy_function_bodies = false);
+	// Ensures the body of func and any function it calls is parsed.
+	// Thread safe, so that converters on different threads can share a parser. Bodies are never allocated
+	// from the calling thread's context, since that may be reset while the parser is still in use.
+	bool materialize(llvm::Function *func);
+	bool materialize_all();
 	llvm::Module &get_module();
 	const llvm::Module &get_module() const;
 
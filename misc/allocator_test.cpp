@@ -0,0 +1,182 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "thread_local_allocator.hpp"
+#include "small_vector.hpp"
+#include "logging.hpp"
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace dxil_spv;
+
+// Several contexts share the memory limit of one owner and allocate from separate threads
+// until they run out. Memory is never freed, so the final reserved bytes are the most
+// the contexts held at once, and must not exceed the limit.
+static bool run_shared_limit_round(unsigned num_threads, size_t limit, size_t alloc_size)
+{
+	AllocatorContext *owner = create_allocator_context();
+	set_allocator_context_memory_limit(owner, limit);
+
+	std::vector<AllocatorContext *> contexts(num_threads);
+	for (auto &ctx : contexts)
+	{
+		ctx = create_allocator_context();
+		share_allocator_context_memory_limit(ctx, owner);
+	}
+
+	std::atomic<unsigned> ready{ 0 };
+	std::vector<std::thread> threads;
+	std::vector<char> hit_limit(num_threads);
+	for (unsigned i = 0; i < num_threads; i++)
+	{
+		threads.emplace_back([&, i]() {
+			bind_thread_allocator_context(contexts[i]);
+
+			// Start together, so that contexts compete for the last bytes of the budget.
+			ready.fetch_add(1, std::memory_order_relaxed);
+			while (ready.load(std::memory_order_relaxed) != num_threads)
+				std::this_thread::yield();
+
+			while (allocate_in_thread(alloc_size))
+			{
+			}
+			hit_limit[i] = thread_allocator_out_of_memory();
+
+			bind_thread_allocator_context(nullptr);
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+
+	bool success = true;
+	size_t total_reserved = 0;
+	for (unsigned i = 0; i < num_threads; i++)
+	{
+		AllocatorStats stats;
+		get_allocator_context_stats(contexts[i], stats);
+		total_reserved += stats.reserved_bytes;
+		if (!hit_limit[i])
+		{
+			LOGE("Context %u stopped allocating without running out of memory.\n", i);
+			success = false;
+		}
+	}
+
+	if (total_reserved > limit)
+	{
+		LOGE("Contexts reserved %zu bytes with a shared limit of %zu.\n", total_reserved, limit);
+		success = false;
+	}
+
+	for (auto *ctx : contexts)
+		destroy_allocator_context(ctx);
+	destroy_allocator_context(owner);
+	return success;
+}
+
+// A SmallVector which is the most recent allocation of its context grows without moving.
+// Once something else is allocated behind it, it has to move.
+static bool run_grow_in_place()
+{
+	AllocatorContext *ctx = create_allocator_context();
+	bind_thread_allocator_context(ctx);
+
+	bool success = true;
+	{
+		SmallVector<uint32_t, 2> vec;
+		for (uint32_t i = 0; i < 3; i++)
+			vec.push_back(i);
+		const uint32_t *heap_data = vec.data();
+
+		for (uint32_t i = 3; i < 1000; i++)
+			vec.push_back(i);
+		if (vec.data() != heap_data)
+		{
+			LOGE("Tail allocation was moved when growing.\n");
+			success = false;
+		}
+
+		void *blocker = allocate_in_thread(16);
+		for (uint32_t i = 1000; i < 3000; i++)
+			vec.push_back(i);
+		if (vec.data() == heap_data)
+		{
+			LOGE("Allocation grew into memory handed out afterwards.\n");
+			success = false;
+		}
+		free_in_thread(blocker, 16);
+
+		for (uint32_t i = 0; i < 3000; i++)
+		{
+			if (vec[i] != i)
+			{
+				LOGE("Element %u was lost while growing.\n", i);
+				success = false;
+				break;
+			}
+		}
+	}
+
+	bind_thread_allocator_context(nullptr);
+	destroy_allocator_context(ctx);
+	return success;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned iterations = 1000;
+	unsigned num_threads = 8;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+			iterations = unsigned(strtoul(argv[++i], nullptr, 0));
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			num_threads = unsigned(strtoul(argv[++i], nullptr, 0));
+		else
+		{
+			LOGE("Usage: allocator-test [--iterations <count>] [--threads <count>]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!run_grow_in_place())
+		return EXIT_FAILURE;
+
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		if (!run_shared_limit_round(num_threads, 1024 * 1024, 40 * 1024))
+		{
+			LOGE("Shared memory limit was exceeded in iteration %u.\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	LOGI("Growing in place works, and shared memory limit held over %u iterations with %u threads.\n", iterations, num_threads);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "llvm_decoder.h"
+#include "logging.hpp"
+#include "thread_local_allocator.hpp"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace dxil_spv;
+
+static bool read_file(const char *path, Vector<uint8_t> &data)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long len = ftell(file);
+	rewind(file);
+
+	data.resize(len);
+	bool ret = len == 0 || fread(data.data(), 1, len, file) == size_t(len);
+	fclose(file);
+	return ret;
+}
+
+static size_t count_records(const LLVMBC::BlockOrRecord &block)
+{
+	size_t count = 1;
+	for (auto &child : block.children)
+		count += count_records(child);
+	return count;
+}
+
+struct CountingVisitor : LLVMBC::BitcodeVisitor
+{
+	size_t count = 0;
+
+	BlockAction EnterBlock(const LLVMBC::BlockOrRecord &) override
+	{
+		count++;
+		return BlockAction::Enter;
+	}
+
+	bool VisitRecord(const LLVMBC::BlockOrRecord &) override
+	{
+		count++;
+		return true;
+	}
+
+	bool LeaveBlock(const LLVMBC::BlockOrRecord &) override
+	{
+		return true;
+	}
+};
+
+static size_t decode(const Vector<uint8_t> &data, bool stream)
+{
+	LLVMBC::BitcodeReader reader(data.data(), data.size());
+	if (stream)
+	{
+		CountingVisitor visitor;
+		reader.VisitToplevelBlock(visitor);
+		return visitor.count;
+	}
+	else
+	{
+		auto toplevel = reader.ReadToplevelBlock();
+		return count_records(toplevel);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: bitcode-bench [--iterations <N>] [--stream] <raw LLVM bitcode> ...\n");
+		return EXIT_FAILURE;
+	}
+
+	unsigned iterations = 1000;
+	bool stream = false;
+	size_t total_bytes = 0;
+	double total_seconds = 0.0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+		{
+			iterations = unsigned(strtoul(argv[++i], nullptr, 0));
+			continue;
+		}
+		else if (strcmp(argv[i], "--stream") == 0)
+		{
+			stream = true;
+			continue;
+		}
+
+		Vector<uint8_t> data;
+		if (!read_file(argv[i], data))
+		{
+			LOGE("Failed to read file: %s.\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+
+		if (data.size() < 4 || memcmp(data.data(), "BC\xc0\xde", 4) != 0)
+		{
+			LOGE("%s is not raw LLVM bitcode, skipping.\n", argv[i]);
+			continue;
+		}
+
+		size_t records = 0;
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned iter = 0; iter < iterations; iter++)
+		{
+			begin_thread_allocator_context();
+			records = decode(data, stream);
+			end_thread_allocator_context();
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+		size_t bytes = data.size() * iterations;
+
+		printf("%s: %zu bytes, %zu blocks/records, %.3f us/decode, %.1f MB/s\n", argv[i], data.size(), records,
+		       1e6 * seconds / double(iterations), double(bytes) / (seconds * 1024.0 * 1024.0));
+
+		total_bytes += bytes;
+		total_seconds += seconds;
+	}
+
+	if (total_seconds > 0.0)
+		printf("Total: %.1f MB/s\n", double(total_bytes) / (total_seconds * 1024.0 * 1024.0));
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,694 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Runs CFGStructurizer on synthetic CFG families of increasing size, like structurize-test
+// does for hand-written CFGs, to track how the structurizer scales.
+
+#include "cfg_structurizer.hpp"
+#include "node.hpp"
+#include "node_pool.hpp"
+#include "spirv_module.hpp"
+#include "SpvBuilder.h"
+#include "logging.hpp"
+#include "thread_local_allocator.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+using namespace dxil_spv;
+
+namespace
+{
+// Plain description of a CFG. Blocks with more than two successors become switches,
+// where the first successor is the default case. Blocks without successors return.
+struct BenchBlock
+{
+	std::vector<int> succ;
+	bool sideeffect = false;
+};
+
+struct BenchGraph
+{
+	std::vector<BenchBlock> blocks;
+
+	int add_block()
+	{
+		blocks.emplace_back();
+		return int(blocks.size() - 1);
+	}
+
+	void branch(int from, int to)
+	{
+		blocks[from].succ = { to };
+	}
+
+	void selection(int from, int to0, int to1)
+	{
+		blocks[from].succ = { to0, to1 };
+	}
+};
+
+struct Random
+{
+	uint64_t state;
+
+	uint32_t next(uint32_t range)
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return uint32_t(state % range);
+	}
+};
+
+struct FamilyParams
+{
+	int depth = 8;
+	int width = 16;
+	uint64_t seed = 1;
+};
+
+// Single-entry loop with a conditional back edge from its continue block.
+// The body is either a nested loop or an if/else diamond.
+int emit_loop_nest(BenchGraph &g, int cur, int depth)
+{
+	int header = g.add_block();
+	int body = g.add_block();
+	g.branch(cur, header);
+	g.branch(header, body);
+
+	int body_end;
+	if (depth > 1)
+		body_end = emit_loop_nest(g, body, depth - 1);
+	else
+		body_end = body;
+
+	int t = g.add_block();
+	int f = g.add_block();
+	int join = g.add_block();
+	g.selection(body_end, t, f);
+	g.branch(t, join);
+	g.branch(f, join);
+	g.blocks[t].sideeffect = true;
+
+	int merge = g.add_block();
+	g.selection(join, header, merge);
+	return merge;
+}
+
+void generate_loop_nest(BenchGraph &g, int target, const FamilyParams &params)
+{
+	int cur = g.add_block();
+	while (int(g.blocks.size()) < target)
+		cur = emit_loop_nest(g, cur, params.depth);
+}
+
+// Switch with fallthrough between neighbouring cases and conditional early exits to the merge.
+void generate_switch(BenchGraph &g, int target, const FamilyParams &params)
+{
+	int cur = g.add_block();
+	while (int(g.blocks.size()) < target)
+	{
+		int header = g.add_block();
+		g.branch(cur, header);
+		int merge = g.add_block();
+
+		std::vector<int> cases;
+		for (int i = 0; i < params.width; i++)
+			cases.push_back(g.add_block());
+
+		g.blocks[header].succ = { merge };
+		g.blocks[header].succ.insert(g.blocks[header].succ.end(), cases.begin(), cases.end());
+
+		for (int i = 0; i < params.width; i++)
+		{
+			g.blocks[cases[i]].sideeffect = true;
+			int next = i + 1 < params.width ? cases[i + 1] : merge;
+			if (i % 3 == 0)
+				g.branch(cases[i], next);
+			else if (i % 3 == 1)
+				g.selection(cases[i], merge, next);
+			else
+				g.branch(cases[i], merge);
+		}
+
+		cur = merge;
+	}
+}
+
+struct LoopScope
+{
+	int header;
+	int continue_block;
+	int merge;
+};
+
+// Loop nest where inner blocks break out of, or continue, a random enclosing loop, or return.
+int emit_breaking_loop(BenchGraph &g, Random &rnd, std::vector<LoopScope> &scopes, int cur, int depth)
+{
+	LoopScope scope;
+	scope.header = g.add_block();
+	scope.continue_block = g.add_block();
+	scope.merge = g.add_block();
+	g.branch(cur, scope.header);
+	scopes.push_back(scope);
+
+	int body = g.add_block();
+	g.branch(scope.header, body);
+	if (depth > 1)
+		body = emit_breaking_loop(g, rnd, scopes, body, depth - 1);
+
+	for (int i = 0; i < 2; i++)
+	{
+		int next = g.add_block();
+		int target;
+		uint32_t kind = rnd.next(4);
+		auto &outer = scopes[rnd.next(uint32_t(scopes.size()))];
+
+		if (kind == 0)
+			target = outer.merge;
+		else if (kind == 1)
+			target = outer.continue_block;
+		else if (kind == 2)
+		{
+			target = g.add_block();
+			g.blocks[target].sideeffect = true;
+		}
+		else
+		{
+			target = g.add_block();
+			g.branch(target, scope.merge);
+		}
+
+		g.selection(body, next, target);
+		body = next;
+	}
+
+	g.branch(body, scope.continue_block);
+	g.selection(scope.continue_block, scope.header, scope.merge);
+	scopes.pop_back();
+	return scope.merge;
+}
+
+void generate_breaks(BenchGraph &g, int target, const FamilyParams &params)
+{
+	Random rnd = { params.seed * 0x9e3779b97f4a7c15ull + 1 };
+	std::vector<LoopScope> scopes;
+	int cur = g.add_block();
+	while (int(g.blocks.size()) < target)
+		cur = emit_breaking_loop(g, rnd, scopes, cur, params.depth);
+}
+
+// if / else if / else if ... chain where every arm branches to a common merge.
+void generate_if_ladder(BenchGraph &g, int target, const FamilyParams &params)
+{
+	int cur = g.add_block();
+	while (int(g.blocks.size()) < target)
+	{
+		int merge = g.add_block();
+		int cond = cur;
+		for (int i = 0; i < params.width; i++)
+		{
+			int arm = g.add_block();
+			int next = g.add_block();
+			g.blocks[arm].sideeffect = true;
+			g.branch(arm, merge);
+			g.selection(cond, arm, next);
+			cond = next;
+		}
+		g.branch(cond, merge);
+		cur = merge;
+	}
+}
+
+struct Family
+{
+	const char *name;
+	void (*generate)(BenchGraph &, int, const FamilyParams &);
+};
+
+const Family families[] = {
+	{ "loop-nest", generate_loop_nest },
+	{ "switch", generate_switch },
+	{ "breaks", generate_breaks },
+	{ "if-ladder", generate_if_ladder },
+};
+
+struct RunResult
+{
+	bool success;
+	uint64_t run_ns;
+	uint64_t allocated_bytes;
+	uint64_t peak_in_use_bytes;
+	uint64_t peak_reserved_bytes;
+	size_t nodes_created;
+	unsigned ladder_blocks;
+	unsigned path_query_hits;
+	unsigned path_query_misses;
+	StructurizerPassStats passes[unsigned(StructurizerPass::Count)];
+};
+
+RunResult structurize(const BenchGraph &g, bool phis)
+{
+	RunResult result = {};
+	SPIRVModule module;
+	CFGNodePool pool;
+	auto &builder = module.get_builder();
+	module.emit_entry_point(spv::ExecutionModelVertex, "main", false);
+
+	Vector<CFGNode *> nodes;
+	nodes.reserve(g.blocks.size());
+	for (size_t i = 0; i < g.blocks.size(); i++)
+	{
+		auto *node = pool.create_node();
+		node->ir.terminator.type = Terminator::Type::Return;
+		nodes.push_back(node);
+	}
+
+	std::vector<std::vector<int>> preds(g.blocks.size());
+
+	for (size_t i = 0; i < g.blocks.size(); i++)
+	{
+		auto &block = g.blocks[i];
+		auto *node = nodes[i];
+		auto &term = node->ir.terminator;
+
+		for (int succ : block.succ)
+		{
+			node->add_branch(nodes[succ]);
+			if (std::find(preds[succ].begin(), preds[succ].end(), int(i)) == preds[succ].end())
+				preds[succ].push_back(int(i));
+		}
+
+		if (block.succ.size() == 1)
+		{
+			term.type = Terminator::Type::Branch;
+			term.direct_block = nodes[block.succ[0]];
+		}
+		else if (block.succ.size() == 2)
+		{
+			term.type = Terminator::Type::Condition;
+			term.true_block = nodes[block.succ[0]];
+			term.false_block = nodes[block.succ[1]];
+			term.conditional_id = builder.makeBoolConstant(true, true);
+		}
+		else if (block.succ.size() > 2)
+		{
+			term.type = Terminator::Type::Switch;
+			term.conditional_id = builder.makeUintConstant(0, true);
+			for (size_t j = 0; j < block.succ.size(); j++)
+			{
+				Terminator::Case c = {};
+				c.node = nodes[block.succ[j]];
+				c.value = uint32_t(j);
+				c.is_default = j == 0;
+				term.cases.push_back(c);
+			}
+		}
+
+		if (block.sideeffect)
+		{
+			spv::Id var_id = builder.createVariable(spv::StorageClassFunction, builder.makeUintType(32));
+			auto *op = module.allocate_op(spv::OpStore);
+			op->add_id(var_id);
+			op->add_id(builder.makeUintConstant(0));
+			node->ir.operations.push_back(op);
+		}
+	}
+
+	if (phis)
+	{
+		for (size_t i = 0; i < g.blocks.size(); i++)
+		{
+			if (preds[i].size() < 2)
+				continue;
+
+			auto *node = nodes[i];
+			node->ir.phi.emplace_back();
+			auto &phi = node->ir.phi.back();
+			phi.type_id = builder.makeUintType(32);
+			phi.id = module.allocate_id();
+
+			for (int pred : preds[i])
+			{
+				IncomingValue value = {};
+				value.block = nodes[pred];
+				value.id = builder.makeUintConstant(uint32_t(pred), true);
+				phi.incoming.push_back(value);
+			}
+		}
+	}
+
+	size_t node_count = pool.get_node_count();
+	uint64_t allocated = get_thread_allocated_bytes();
+	auto start = std::chrono::steady_clock::now();
+
+	CFGStructurizer traverser(nodes.front(), pool, module);
+	result.success = traverser.run();
+
+	auto end = std::chrono::steady_clock::now();
+	result.run_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	result.allocated_bytes = get_thread_allocated_bytes() - allocated;
+	result.nodes_created = pool.get_node_count() - node_count;
+	result.ladder_blocks = traverser.get_num_ladder_blocks();
+	result.path_query_hits = traverser.get_num_path_query_hits();
+	result.path_query_misses = traverser.get_num_path_query_misses();
+	for (unsigned i = 0; i < unsigned(StructurizerPass::Count); i++)
+		result.passes[i] = traverser.get_pass_stats(StructurizerPass(i));
+	return result;
+}
+
+struct BenchResult
+{
+	const char *family;
+	size_t blocks;
+	unsigned iterations;
+	uint64_t run_ns_min;
+	uint64_t run_ns_mean;
+	RunResult last;
+};
+
+long get_peak_rss_kb()
+{
+	struct rusage usage = {};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+std::vector<int> parse_sizes(const char *str)
+{
+	std::vector<int> sizes;
+	while (*str)
+	{
+		char *end;
+		long size = strtol(str, &end, 0);
+		if (end == str)
+			break;
+		if (size > 0)
+			sizes.push_back(int(size));
+		str = *end == ',' ? end + 1 : end;
+	}
+	return sizes;
+}
+
+void write_json(FILE *file, const std::vector<BenchResult> &results, const FamilyParams &params, bool phis)
+{
+	fprintf(file, "{\n");
+	fprintf(file, "\t\"depth\": %d,\n", params.depth);
+	fprintf(file, "\t\"width\": %d,\n", params.width);
+	fprintf(file, "\t\"seed\": %llu,\n", static_cast<unsigned long long>(params.seed));
+	fprintf(file, "\t\"phis\": %s,\n", phis ? "true" : "false");
+	fprintf(file, "\t\"peak_rss_kb\": %ld,\n", get_peak_rss_kb());
+	fprintf(file, "\t\"results\": [");
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		auto &res = results[i];
+		fprintf(file, "%s\n\t\t{\n", i ? "," : "");
+		fprintf(file, "\t\t\t\"family\": \"%s\",\n", res.family);
+		fprintf(file, "\t\t\t\"blocks\": %zu,\n", res.blocks);
+		fprintf(file, "\t\t\t\"iterations\": %u,\n", res.iterations);
+		fprintf(file, "\t\t\t\"run_ns_min\": %llu,\n", static_cast<unsigned long long>(res.run_ns_min));
+		fprintf(file, "\t\t\t\"run_ns_mean\": %llu,\n", static_cast<unsigned long long>(res.run_ns_mean));
+		fprintf(file, "\t\t\t\"allocated_bytes\": %llu,\n",
+		        static_cast<unsigned long long>(res.last.allocated_bytes));
+		fprintf(file, "\t\t\t\"peak_in_use_bytes\": %llu,\n",
+		        static_cast<unsigned long long>(res.last.peak_in_use_bytes));
+		fprintf(file, "\t\t\t\"peak_reserved_bytes\": %llu,\n",
+		        static_cast<unsigned long long>(res.last.peak_reserved_bytes));
+		fprintf(file, "\t\t\t\"nodes_created\": %zu,\n", res.last.nodes_created);
+		fprintf(file, "\t\t\t\"ladder_blocks\": %u,\n", res.last.ladder_blocks);
+		fprintf(file, "\t\t\t\"path_query_hits\": %u,\n", res.last.path_query_hits);
+		fprintf(file, "\t\t\t\"path_query_misses\": %u,\n", res.last.path_query_misses);
+		fprintf(file, "\t\t\t\"passes\": [");
+		for (unsigned j = 0; j < unsigned(StructurizerPass::Count); j++)
+		{
+			auto &pass = res.last.passes[j];
+			fprintf(file, "%s\n\t\t\t\t{ \"name\": \"%s\", \"time_ns\": %llu, \"invocations\": %u, ", j ? "," : "",
+			        CFGStructurizer::get_pass_name(StructurizerPass(j)), static_cast<unsigned long long>(pass.time_ns),
+			        pass.invocations);
+			fprintf(file, "\"nodes_created\": %u, \"ladder_blocks\": %u, \"helper_blocks\": %u, ", pass.nodes_created,
+			        pass.ladder_blocks, pass.helper_blocks);
+			fprintf(file, "\"duplicated_nodes\": %u, \"recompute_cfg_calls\": %u, \"recompute_cfg_splices\": %u, ",
+			        pass.duplicated_nodes, pass.recompute_cfg_calls, pass.recompute_cfg_splices);
+			fprintf(file, "\"recompute_cfg_rebuilds\": %u }", pass.recompute_cfg_rebuilds);
+		}
+		fprintf(file, "\n\t\t\t]\n");
+		fprintf(file, "\t\t}");
+	}
+
+	fprintf(file, "\n\t]\n}\n");
+}
+
+void log_slowest_passes(FILE *log, const RunResult &res)
+{
+	unsigned order[unsigned(StructurizerPass::Count)];
+	for (unsigned i = 0; i < unsigned(StructurizerPass::Count); i++)
+		order[i] = i;
+	std::sort(std::begin(order), std::end(order),
+	          [&](unsigned a, unsigned b) { return res.passes[a].time_ns > res.passes[b].time_ns; });
+
+	for (unsigned i = 0; i < 5; i++)
+	{
+		auto &pass = res.passes[order[i]];
+		fprintf(log, "    %-40s %10.3f ms, %5u rounds, %6u nodes, %6u dup, %4u recompute (%u spliced, %u rebuilt)\n",
+		        CFGStructurizer::get_pass_name(StructurizerPass(order[i])), 1e-6 * double(pass.time_ns),
+		        pass.invocations, pass.nodes_created, pass.duplicated_nodes, pass.recompute_cfg_calls,
+		        pass.recompute_cfg_splices, pass.recompute_cfg_rebuilds);
+	}
+}
+
+// How every recompute_cfg() call of a run reused, patched or rebuilt the CFG analysis.
+void log_recompute_cfg(FILE *log, const RunResult &res)
+{
+	unsigned calls = 0, splices = 0, rebuilds = 0;
+	for (auto &pass : res.passes)
+	{
+		calls += pass.recompute_cfg_calls;
+		splices += pass.recompute_cfg_splices;
+		rebuilds += pass.recompute_cfg_rebuilds;
+	}
+
+	fprintf(log, "    recompute_cfg: %u calls, %u skipped, %u spliced, %u rebuilt\n", calls,
+	        calls - splices - rebuilds, splices, rebuilds);
+}
+
+void print_help()
+{
+	fprintf(stderr, "Usage: structurize-bench\n"
+	                "\t[--family <loop-nest | switch | breaks | if-ladder>] (can be repeated, default all)\n"
+	                "\t[--sizes <N,N,...>] (number of blocks, default 1000,2000,5000,10000,20000,50000)\n"
+	                "\t[--depth <N>] (loop nesting depth, default 8)\n"
+	                "\t[--width <N>] (switch cases and if-ladder arms, default 16)\n"
+	                "\t[--seed <N>]\n"
+	                "\t[--iterations <N>] (default 3)\n"
+	                "\t[--budget <seconds>] (skip larger sizes of a family once one run exceeds this, default 10)\n"
+	                "\t[--no-phi]\n"
+	                "\t[--passes] (log the slowest structurizer passes of each run)\n"
+	                "\t[--validate] (check CFG analysis against full rebuilds, fail on any error)\n"
+	                "\t[--memory-limit <bytes>] (memory limit of each run, skip larger sizes once a run hits it)\n"
+	                "\t[--json <path>] (- for stdout)\n");
+}
+
+void count_errors(void *userdata, LogLevel level, const char *msg)
+{
+	fprintf(stderr, "%s%s", level == LogLevel::Error ? "[ERROR]: " : level == LogLevel::Warn ? "[WARN]: " : "", msg);
+	if (level == LogLevel::Error)
+		++*static_cast<unsigned *>(userdata);
+}
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<const Family *> selected;
+	std::vector<int> sizes = { 1000, 2000, 5000, 10000, 20000, 50000 };
+	FamilyParams params;
+	unsigned iterations = 3;
+	double budget = 10.0;
+	bool phis = true;
+	bool log_passes = false;
+	bool validate = false;
+	size_t memory_limit = 0;
+	const char *json_path = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--family") == 0 && i + 1 < argc)
+		{
+			const char *name = argv[++i];
+			auto itr = std::find_if(std::begin(families), std::end(families),
+			                        [&](const Family &family) { return strcmp(family.name, name) == 0; });
+			if (itr == std::end(families))
+			{
+				LOGE("Unknown CFG family %s.\n", name);
+				return EXIT_FAILURE;
+			}
+			selected.push_back(itr);
+		}
+		else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc)
+			sizes = parse_sizes(argv[++i]);
+		else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+			params.depth = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+			params.width = std::max(2, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			params.seed = strtoull(argv[++i], nullptr, 0);
+		else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+			iterations = std::max(1u, unsigned(strtoul(argv[++i], nullptr, 0)));
+		else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+			budget = atof(argv[++i]);
+		else if (strcmp(argv[i], "--no-phi") == 0)
+			phis = false;
+		else if (strcmp(argv[i], "--passes") == 0)
+			log_passes = true;
+		else if (strcmp(argv[i], "--validate") == 0)
+			validate = true;
+		else if (strcmp(argv[i], "--memory-limit") == 0 && i + 1 < argc)
+			memory_limit = size_t(strtoull(argv[++i], nullptr, 0));
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			json_path = argv[++i];
+		else
+		{
+			print_help();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (selected.empty())
+		for (auto &family : families)
+			selected.push_back(&family);
+
+	// The structurizer picks this up on construction.
+	unsigned num_errors = 0;
+	unsigned num_failures = 0;
+	if (validate)
+	{
+		setenv("DXIL_SPIRV_VALIDATE_CFG", "1", 1);
+		set_thread_log_callback(count_errors, &num_errors);
+	}
+
+	// Keep stdout clean when JSON goes there.
+	FILE *log = json_path && strcmp(json_path, "-") == 0 ? stderr : stdout;
+	std::vector<BenchResult> results;
+
+	for (auto *family : selected)
+	{
+		for (int size : sizes)
+		{
+			BenchGraph graph;
+			family->generate(graph, size, params);
+
+			BenchResult res = {};
+			res.family = family->name;
+			res.blocks = graph.blocks.size();
+			res.iterations = iterations;
+			res.run_ns_min = UINT64_MAX;
+
+			uint64_t total_ns = 0;
+			bool out_of_memory = false;
+			for (unsigned iter = 0; iter < iterations && !out_of_memory; iter++)
+			{
+				begin_thread_allocator_context();
+				set_allocator_context_memory_limit(get_thread_allocator_context(), memory_limit);
+				res.last = structurize(graph, phis);
+				out_of_memory = thread_allocator_out_of_memory();
+				AllocatorStats memory;
+				get_allocator_context_stats(get_thread_allocator_context(), memory);
+				res.last.peak_in_use_bytes = memory.peak_in_use_bytes;
+				res.last.peak_reserved_bytes = memory.peak_reserved_bytes;
+				end_thread_allocator_context();
+
+				if (!res.last.success && !out_of_memory)
+				{
+					LOGE("Failed to structurize %s with %zu blocks.\n", res.family, res.blocks);
+					num_failures++;
+				}
+
+				res.run_ns_min = std::min(res.run_ns_min, res.last.run_ns);
+				total_ns += res.last.run_ns;
+			}
+
+			if (out_of_memory)
+			{
+				// Expected with a memory limit, as long as the structurizer failed cleanly.
+				if (res.last.success)
+				{
+					LOGE("Structurizer succeeded for %s with %zu blocks despite running out of memory.\n",
+					     res.family, res.blocks);
+					num_failures++;
+				}
+				fprintf(log, "%-10s %6zu blocks: out of memory with %8.1f KiB reserved, skipping larger sizes.\n",
+				        res.family, res.blocks, double(res.last.peak_reserved_bytes) / 1024.0);
+				break;
+			}
+
+			res.run_ns_mean = total_ns / iterations;
+			results.push_back(res);
+
+			fprintf(log, "%-10s %6zu blocks: %10.3f ms (min %10.3f ms), %8.1f KiB arena, %8.1f KiB peak, %6zu nodes created\n",
+			        res.family, res.blocks, 1e-6 * double(res.run_ns_mean), 1e-6 * double(res.run_ns_min),
+			        double(res.last.allocated_bytes) / 1024.0, double(res.last.peak_in_use_bytes) / 1024.0,
+			        res.last.nodes_created);
+			log_recompute_cfg(log, res.last);
+			if (log_passes)
+				log_slowest_passes(log, res.last);
+
+			if (1e-9 * double(res.run_ns_min) > budget)
+			{
+				fprintf(log, "%-10s exceeded time budget, skipping larger sizes.\n", family->name);
+				break;
+			}
+		}
+	}
+
+	if (json_path)
+	{
+		FILE *file = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+		if (!file)
+		{
+			LOGE("Failed to open %s for writing.\n", json_path);
+			return EXIT_FAILURE;
+		}
+
+		write_json(file, results, params, phis);
+		if (file != stdout)
+			fclose(file);
+	}
+
+	if (num_errors)
+	{
+		fprintf(stderr, "Validation failed with %u errors.\n", num_errors);
+		return EXIT_FAILURE;
+	}
+
+	if (num_failures)
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -36,11 +36,25 @@ CFGNode::CFGNode(CFGNodePool &pool_)
 {
 }
 
+CFGNodeVisitSet::CFGNodeVisitSet(CFGNodePool &pool_)
+	: pool(pool_)
+{
+	use_stamps = pool.begin_visit(slot, epoch);
+}
+
+CFGNodeVisitSet::~CFGNodeVisitSet()
+{
+	pool.end_visit();
+}
+
 void CFGNode::add_unique_pred(CFGNode *node)
 {
 	auto itr = std::find(pred.begin(), pred.end(), node);
 	if (itr == pred.end())
+	{
 		pred.push_back(node);
+		pool.invalidate_cfg();
+	}
 }
 
 void CFGNode::add_unique_fake_pred(CFGNode *node)
@@ -77,7 +91,10 @@ void CFGNode::add_unique_succ(CFGNode *node)
 	assert(std::find(fake_succ.begin(), fake_succ.end(), node) == fake_succ.end());
 	auto itr = std::find(succ.begin(), succ.end(), node);
 	if (itr == succ.end())
+	{
 		succ.push_back(node);
+		pool.invalidate_cfg();
+	}
 }
 
 void CFGNode::add_unique_fake_succ(CFGNode *node)
@@ -141,7 +158,7 @@ bool CFGNode::can_loop_merge_to(const CFGNode *other) const
 	return true;
 }
 
-bool CFGNode::can_backtrace_to(const CFGNode *parent, UnorderedSet<const CFGNode *> &node_cache) const
+bool CFGNode::can_backtrace_to(const CFGNode *parent, CFGNodeVisitSet &node_cache) const
 {
 	if (node_cache.count(this))
 		return false;
@@ -160,11 +177,11 @@ bool CFGNode::can_backtrace_to(const CFGNode *parent) const
 	if (parent->forward_post_visit_order < forward_post_visit_order)
 		return false;
 
-	UnorderedSet<const CFGNode *> node_cache;
+	CFGNodeVisitSet node_cache(pool);
 	return can_backtrace_to(parent, node_cache);
 }
 
-bool CFGNode::post_dominates_any_work(const CFGNode *parent, UnorderedSet<const CFGNode *> &node_cache) const
+bool CFGNode::post_dominates_any_work(const CFGNode *parent, CFGNodeVisitSet &node_cache) const
 {
 	// If we reached this node before and didn't terminate, it must have returned false.
 	if (node_cache.count(parent))
@@ -196,7 +213,7 @@ bool CFGNode::post_dominates_any_work() const
 	if (!start_node->ir.operations.empty() || !start_node->ir.phi.empty())
 		return true;
 
-	UnorderedSet<const CFGNode *> node_cache;
+	CFGNodeVisitSet node_cache(pool);
 	for (auto *p : start_node->pred)
 		if (start_node->post_dominates_any_work(p, node_cache))
 			return true;
@@ -227,7 +244,7 @@ bool CFGNode::post_dominates_perfect_structured_construct() const
 	return true;
 }
 
-bool CFGNode::dominates_all_reachable_exits(UnorderedSet<const CFGNode *> &completed, const CFGNode &header) const
+bool CFGNode::dominates_all_reachable_exits(CFGNodeVisitSet &completed, const CFGNode &header) const
 {
 	if (!completed.count(this))
 	{
@@ -246,7 +263,7 @@ bool CFGNode::dominates_all_reachable_exits(UnorderedSet<const CFGNode *> &compl
 
 bool CFGNode::dominates_all_reachable_exits() const
 {
-	UnorderedSet<const CFGNode *> completed;
+	CFGNodeVisitSet completed(pool);
 	return dominates_all_reachable_exits(completed, *this);
 }
 
@@ -411,6 +428,7 @@ void CFGNode::retarget_branch_pre_traversal(CFGNode *to_prev, CFGNode *to_next)
 	assert(std::find(succ.begin(), succ.end(), to_next) == succ.end());
 	assert(std::find(to_next->pred.begin(), to_next->pred.end(), this) == to_next->pred.end());
 
+	pool.invalidate_cfg();
 	to_prev->pred.erase(std::find(to_prev->pred.begin(), to_prev->pred.end(), this));
 
 	// Modify succ in place so we don't invalidate iterator in traverse_dominated_blocks_and_rewrite_branch.
@@ -463,6 +481,9 @@ void CFGNode::retarget_fake_succ(CFGNode *to_prev, CFGNode *to_next)
 	assert(std::find(fake_succ.begin(), fake_succ.end(), to_next) == fake_succ.end());
 	assert(std::find(to_next->fake_pred.begin(), to_next->fake_pred.end(), this) == to_next->fake_pred.end());
 
+	// A full rebuild regenerates fake edges and post-dominators, so analysis derived from the old ones is stale.
+	pool.invalidate_cfg();
+
 	// Modify fake_succ in place so we don't invalidate iterator in traverse_dominated_blocks_and_rewrite_branch.
 	*std::find(fake_succ.begin(), fake_succ.end(), to_prev) = to_next;
 	to_next->add_unique_fake_pred(this);
@@ -586,7 +607,7 @@ bool CFGNode::block_is_jump_thread_ladder() const
 	return ir.terminator.conditional_id == phi.id;
 }
 
-bool CFGNode::reaches_backward_visited_node(UnorderedSet<const dxil_spv::CFGNode *> &completed) const
+bool CFGNode::reaches_backward_visited_node(CFGNodeVisitSet &completed) const
 {
 	if (completed.count(this))
 		return false;
@@ -608,7 +629,7 @@ bool CFGNode::reaches_backward_visited_node(UnorderedSet<const dxil_spv::CFGNode
 
 bool CFGNode::reaches_backward_visited_node() const
 {
-	UnorderedSet<const CFGNode *> visit;
+	CFGNodeVisitSet visit(pool);
 	return reaches_backward_visited_node(visit);
 }
 } // namespace dxil_spv
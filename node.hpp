@@ -26,22 +26,18 @@
 
 #include "thread_local_allocator.hpp"
 #include "ir.hpp"
+#include "node_pool.hpp"
 
 #include <algorithm>
 #include <stdint.h>
 
 namespace dxil_spv
 {
-class CFGNodePool;
+class CFGNodeVisitSet;
 
 struct CFGNode
 {
 public:
-	String name;
-	uint32_t id = 0;
-	void *userdata = nullptr;
-	IRBlock ir;
-
 	void add_branch(CFGNode *to);
 	void add_fake_branch(CFGNode *to);
 
@@ -52,38 +48,51 @@ private:
 	friend class CFGStructurizer;
 	friend struct LoopBacktracer;
 	friend struct LoopMergeTracer;
+	friend class CFGNodeVisitSet;
 	explicit CFGNode(CFGNodePool &pool);
 
-	CFGNodePool &pool;
+	// Hot state, touched by CFG traversals and dominator walks. Keep this up front.
 	uint32_t forward_post_visit_order = 0;
 	uint32_t backward_post_visit_order = 0;
 	bool visited = false;
 	bool backward_visited = false;
 	bool traversing = false;
 	bool freeze_structured_analysis = false;
-
 	MergeType merge = MergeType::None;
-	CFGNode *loop_merge_block = nullptr;
-	CFGNode *loop_ladder_block = nullptr;
-	CFGNode *selection_merge_block = nullptr;
-	CFGNode *split_merge_block_candidate = nullptr;
-	Vector<CFGNode *> headers;
 
 	CFGNode *immediate_dominator = nullptr;
 	CFGNode *immediate_post_dominator = nullptr;
-	Vector<CFGNode *> succ;
-	Vector<CFGNode *> pred;
+	CFGNode *pred_back_edge = nullptr;
+	CFGNode *succ_back_edge = nullptr;
+	CFGNodeList succ;
+	CFGNodeList pred;
 
 	// Fake successors and predecessors which only serve to make the flipped CFG reducible.
 	// This makes post-domination analysis not strictly correct in all cases, but it is
 	// fine for the purposes we need post-domination analysis for.
 	// If a continue block is not reachable in the flipped CFG, we will
 	// add fake successors from the continue block.
-	Vector<CFGNode *> fake_succ;
-	Vector<CFGNode *> fake_pred;
+	CFGNodeList fake_succ;
+	CFGNodeList fake_pred;
 
-	CFGNode *pred_back_edge = nullptr;
-	CFGNode *succ_back_edge = nullptr;
+	mutable uint32_t visit_stamps[CFGNodePool::MaxVisitDepth] = {};
+	CFGNodePool &pool;
+
+public:
+	String name;
+	uint32_t id = 0;
+	void *userdata = nullptr;
+	IRBlock ir;
+
+private:
+	// Cold structurizer state.
+	CFGNode *loop_merge_block = nullptr;
+	CFGNode *loop_ladder_block = nullptr;
+	CFGNode *selection_merge_block = nullptr;
+	CFGNode *split_merge_block_candidate = nullptr;
+	CFGNodeList headers;
+	CFGNodeList dominance_frontier;
+	CFGNodeList post_dominance_frontier;
 
 	void add_unique_succ(CFGNode *node);
 	void add_unique_pred(CFGNode *node);
@@ -102,9 +111,9 @@ private:
 	static CFGNode *find_common_post_dominator(CFGNode *a, CFGNode *b);
 	CFGNode *get_immediate_dominator_loop_header();
 	bool can_backtrace_to(const CFGNode *parent) const;
-	bool can_backtrace_to(const CFGNode *parent, UnorderedSet<const CFGNode *> &node_cache) const;
+	bool can_backtrace_to(const CFGNode *parent, CFGNodeVisitSet &node_cache) const;
 	bool post_dominates_any_work() const;
-	bool post_dominates_any_work(const CFGNode *parent, UnorderedSet<const CFGNode *> &node_cache) const;
+	bool post_dominates_any_work(const CFGNode *parent, CFGNodeVisitSet &node_cache) const;
 	bool reaches_backward_visited_node() const;
 
 	void retarget_branch(CFGNode *to_prev, CFGNode *to_next);
@@ -125,20 +134,52 @@ private:
 	CFGNode *get_outer_selection_dominator();
 	CFGNode *get_outer_header_dominator();
 
-	Vector<CFGNode *> dominance_frontier;
-	Vector<CFGNode *> post_dominance_frontier;
-
 	bool block_is_jump_thread_ladder() const;
 
 private:
-	bool dominates_all_reachable_exits(UnorderedSet<const CFGNode *>& completed, const CFGNode &header) const;
+	bool dominates_all_reachable_exits(CFGNodeVisitSet &completed, const CFGNode &header) const;
 
 	template <typename Op>
-	void traverse_dominated_blocks(UnorderedSet<const CFGNode *> &completed,
-	                                    const CFGNode &header, const Op &op) const;
+	void traverse_dominated_blocks(CFGNodeVisitSet &completed,
+	                               const CFGNode &header, const Op &op) const;
 
 	void retarget_fake_succ(CFGNode *from, CFGNode *to);
-	bool reaches_backward_visited_node(UnorderedSet<const CFGNode *> &completed) const;
+	bool reaches_backward_visited_node(CFGNodeVisitSet &completed) const;
+};
+
+// Allocation-free visited set for CFG walks.
+// Membership is an epoch stamp on each node, so lookups are O(1).
+// Sets on the same pool may nest, but must be destroyed in reverse order of construction.
+class CFGNodeVisitSet
+{
+public:
+	explicit CFGNodeVisitSet(CFGNodePool &pool);
+	~CFGNodeVisitSet();
+	CFGNodeVisitSet(const CFGNodeVisitSet &) = delete;
+	void operator=(const CFGNodeVisitSet &) = delete;
+
+	bool count(const CFGNode *node) const
+	{
+		if (use_stamps)
+			return node->visit_stamps[slot] == epoch;
+		else
+			return fallback.count(node) != 0;
+	}
+
+	void insert(const CFGNode *node)
+	{
+		if (use_stamps)
+			node->visit_stamps[slot] = epoch;
+		else
+			fallback.insert(node);
+	}
+
+private:
+	CFGNodePool &pool;
+	UnorderedSet<const CFGNode *> fallback;
+	uint32_t slot = 0;
+	uint32_t epoch = 0;
+	bool use_stamps = false;
 };
 
 template <typename Op>
@@ -152,7 +193,7 @@ void CFGNode::walk_cfg_from(const Op &op) const
 }
 
 template <typename Op>
-void CFGNode::traverse_dominated_blocks(UnorderedSet<const CFGNode *> &completed,
+void CFGNode::traverse_dominated_blocks(CFGNodeVisitSet &completed,
                                         const CFGNode &header, const Op &op) const
 {
 	for (auto *node : succ)
@@ -172,7 +213,7 @@ void CFGNode::traverse_dominated_blocks(UnorderedSet<const CFGNode *> &completed
 template <typename Op>
 void CFGNode::traverse_dominated_blocks(const Op &op) const
 {
-	UnorderedSet<const CFGNode *> completed;
+	CFGNodeVisitSet completed(pool);
 	traverse_dominated_blocks(completed, *this, op);
 }
 } // namespace dxil_spv
@@ -24,7 +24,8 @@
 
 #include "node_pool.hpp"
 #include "node.hpp"
-#include <utility>
+#include <assert.h>
+#include <new>
 
 namespace dxil_spv
 {
@@ -34,14 +35,47 @@ CFGNodePool::CFGNodePool()
 
 CFGNodePool::~CFGNodePool()
 {
+	for (auto *node : nodes)
+		node->~CFGNode();
+	for (auto *slab : slabs)
+		free_in_thread(slab, NodesPerSlab * sizeof(CFGNode));
 }
 
 CFGNode *CFGNodePool::create_node()
 {
-	auto node = std::unique_ptr<CFGNode>(new CFGNode(*this));
-	auto *ret = node.get();
-	nodes.push_back(std::move(node));
-	return ret;
+	size_t index = nodes.size() % NodesPerSlab;
+	if (index == 0)
+		slabs.push_back(static_cast<CFGNode *>(allocate_in_thread_or_abort(NodesPerSlab * sizeof(CFGNode))));
+
+	auto *node = ::new (slabs.back() + index) CFGNode(*this);
+	nodes.push_back(node);
+	invalidate_cfg();
+	return node;
+}
+
+bool CFGNodePool::begin_visit(uint32_t &slot, uint32_t &epoch)
+{
+	slot = visit_depth++;
+	if (slot >= MaxVisitDepth)
+		return false;
+
+	epoch = ++visit_epochs[slot];
+
+	// Stale stamps would alias after wrap-around, so start over.
+	if (epoch == 0)
+	{
+		for (auto &node : nodes)
+			node->visit_stamps[slot] = 0;
+		epoch = visit_epochs[slot] = 1;
+	}
+
+	return true;
+}
+
+void CFGNodePool::end_visit()
+{
+	assert(visit_depth != 0);
+	visit_depth--;
 }
 
 } // namespace dxil_spv
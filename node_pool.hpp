@@ -25,12 +25,16 @@
 #pragma once
 
 #include "thread_local_allocator.hpp"
-#include <memory>
+#include "small_vector.hpp"
+#include <stdint.h>
 
 namespace dxil_spv
 {
 struct CFGNode;
 
+// Adjacency lists are nearly always tiny, so keep the first couple of edges inline.
+using CFGNodeList = SmallVector<CFGNode *, 2>;
+
 class CFGNodePool
 {
 public:
@@ -38,17 +42,47 @@ public:
 
 	CFGNodePool();
 	~CFGNodePool();
+	CFGNodePool(const CFGNodePool &) = delete;
+	void operator=(const CFGNodePool &) = delete;
 
 	CFGNode *create_node();
+	size_t get_node_count() const
+	{
+		return nodes.size();
+	}
+
+	// Bumped whenever nodes or edges are added or rewritten.
+	// Lets the structurizer reuse CFG analysis when nothing changed.
+	uint64_t get_cfg_generation() const
+	{
+		return cfg_generation;
+	}
+
+	void invalidate_cfg()
+	{
+		cfg_generation++;
+	}
+
+	// Visit stamp slots for CFGNodeVisitSet. One slot per nesting level of live sets.
+	enum { MaxVisitDepth = 4 };
+	bool begin_visit(uint32_t &slot, uint32_t &epoch);
+	void end_visit();
 
 	template <typename Op>
 	void for_each_node(const Op &op)
 	{
-		for (auto &node : nodes)
+		for (auto *node : nodes)
 			op(*node);
 	}
 
 private:
-	Vector<std::unique_ptr<CFGNode>> nodes;
+	// Nodes live in small fixed-size slabs so addresses stay stable and
+	// neighbouring nodes share pages, while bounding the slack per function.
+	enum { NodesPerSlab = 16 };
+	Vector<CFGNode *> nodes;
+	Vector<CFGNode *> slabs;
+	uint64_t cfg_generation = 0;
+	uint32_t visit_epochs[MaxVisitDepth] = {};
+	uint32_t visit_depth = 0;
 };
 } // namespace dxil_spv
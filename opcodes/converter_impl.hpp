@@ -31,6 +31,7 @@
 #include "scratch_pool.hpp"
 #include "descriptor_qa.hpp"
 #include "opcodes.hpp"
+#include "value_map.hpp"
 
 #include "GLSL.std.450.h"
 
@@ -157,6 +158,14 @@ struct Converter::Impl
 	LLVMBCParser &bitcode_parser;
 	LLVMBCParser *bitcode_reflection_parser;
 	SPIRVModule &spirv_module;
+	ConverterStats *stats = nullptr;
+
+	// Metadata kinds queried per instruction, interned once per conversion.
+	struct
+	{
+		unsigned precise = 0;
+		unsigned nonuniform = 0;
+	} metadata_kinds;
 
 	struct BlockMeta
 	{
@@ -172,15 +181,13 @@ struct Converter::Impl
 	};
 	Vector<std::unique_ptr<BlockMeta>> metas;
 	UnorderedMap<const llvm::BasicBlock *, BlockMeta *> bb_map;
-	UnorderedMap<const llvm::Value *, spv::Id> value_map;
+	LLVMValueMap<spv::Id> value_map;
 	UnorderedMap<spv::Id, spv::Id> phi_incoming_rewrite;
 
 	ConvertedFunction convert_entry_point();
 	CFGNode *convert_function(llvm::Function *func, CFGNodePool &pool);
-	CFGNode *build_hull_main(llvm::Function *func, CFGNodePool &pool,
-	                         Vector<ConvertedFunction::LeafFunction> &leaves);
-	CFGNode *build_rov_main(llvm::Function *func, CFGNodePool &pool,
-	                        Vector<ConvertedFunction::LeafFunction> &leaves);
+	CFGNode *build_hull_main(llvm::Function *func, ConvertedFunction &result);
+	CFGNode *build_rov_main(llvm::Function *func, ConvertedFunction &result);
 	spv::Id get_id_for_value(const llvm::Value *value, unsigned forced_integer_width = 0);
 	spv::Id get_id_for_constant(const llvm::Constant *constant, unsigned forced_width);
 	spv::Id get_id_for_undef(const llvm::UndefValue *undef);
@@ -236,11 +243,11 @@ struct Converter::Impl
 	UnorderedMap<uint32_t, AccessTracking> cbv_access_tracking;
 	UnorderedMap<uint32_t, AccessTracking> srv_access_tracking;
 	UnorderedMap<uint32_t, AccessTracking> uav_access_tracking;
-	UnorderedMap<const llvm::Value *, uint32_t> llvm_value_to_cbv_resource_index_map;
-	UnorderedMap<const llvm::Value *, uint32_t> llvm_value_to_srv_resource_index_map;
-	UnorderedMap<const llvm::Value *, uint32_t> llvm_value_to_uav_resource_index_map;
-	UnorderedSet<const llvm::Value *> llvm_values_using_update_counter;
-	UnorderedMap<const llvm::Value *, spv::Id> llvm_value_actual_type;
+	LLVMValueMap<uint32_t> llvm_value_to_cbv_resource_index_map;
+	LLVMValueMap<uint32_t> llvm_value_to_srv_resource_index_map;
+	LLVMValueMap<uint32_t> llvm_value_to_uav_resource_index_map;
+	LLVMValueSet llvm_values_using_update_counter;
+	LLVMValueMap<spv::Id> llvm_value_actual_type;
 	UnorderedSet<uint32_t> llvm_attribute_at_vertex_indices;
 
 	struct
@@ -276,7 +283,7 @@ struct Converter::Impl
 		// Forces a composite to be treated as a struct instead of vector or scalar.
 		bool forced_struct = false;
 	};
-	UnorderedMap<const llvm::Value *, CompositeMeta> llvm_composite_meta;
+	LLVMValueMap<CompositeMeta> llvm_composite_meta;
 
 	bool composite_is_accessed(const llvm::Value *composite) const;
 
@@ -288,7 +295,7 @@ struct Converter::Impl
 		const llvm::GlobalVariable *variable;
 		bool non_uniform;
 	};
-	UnorderedMap<const llvm::Value *, ResourceMetaReference> llvm_global_variable_to_resource_mapping;
+	LLVMValueMap<ResourceMetaReference> llvm_global_variable_to_resource_mapping;
 	UnorderedSet<const llvm::GlobalVariable *> llvm_active_global_resource_variables;
 
 	struct ResourceVariableMeta
@@ -386,7 +393,7 @@ struct Converter::Impl
 		spv::Id offset_buffer_id;
 	};
 	UnorderedMap<const llvm::Value *, AnnotateHandleReference> llvm_annotate_handle_uses;
-	UnorderedSet<const llvm::Value *> llvm_annotate_handle_lib_uses;
+	LLVMValueSet llvm_annotate_handle_lib_uses;
 
 	Vector<ResourceReference> srv_index_to_reference;
 	Vector<spv::Id> srv_index_to_offset;
@@ -434,9 +441,9 @@ struct Converter::Impl
 	};
 	UnorderedMap<spv::Id, ResourceMeta> handle_to_resource_meta;
 	UnorderedMap<spv::Id, spv::Id> id_to_type;
-	UnorderedMap<const llvm::Value *, unsigned> handle_to_root_member_offset;
-	UnorderedMap<const llvm::Value *, spv::StorageClass> handle_to_storage_class;
-	UnorderedSet<const llvm::Value *> needs_temp_storage_copy;
+	LLVMValueMap<unsigned> handle_to_root_member_offset;
+	LLVMValueMap<spv::StorageClass> handle_to_storage_class;
+	LLVMValueSet needs_temp_storage_copy;
 
 	struct TempPayloadEntry
 	{
@@ -699,7 +706,7 @@ struct Converter::Impl
 	UnorderedMap<const llvm::BasicBlock *, Vector<const llvm::Instruction *>> bb_to_sinks;
 	UnorderedSet<const llvm::CallInst *> wave_op_forced_helper_lanes;
 
-	UnorderedSet<const llvm::Value *> llvm_used_ssa_values;
+	LLVMValueSet llvm_used_ssa_values;
 
 	bool type_can_relax_precision(const llvm::Type *type, bool known_integer_sign) const;
 	void decorate_relaxed_precision(const llvm::Type *type, spv::Id id, bool known_integer_sign);
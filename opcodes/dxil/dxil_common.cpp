@@ -497,6 +497,20 @@ void build_exploded_composite_from_vector(Converter::Impl &impl, const llvm::Ins
 	}
 }
 
+bool function_is_dxil_op(const llvm::Function *func)
+{
+#ifdef HAVE_LLVMBC
+	return func->get_intrinsic_kind() == llvm::Function::IntrinsicKind::DXILOp;
+#else
+	return strncmp(func->getName().data(), "dx.op", 5) == 0;
+#endif
+}
+
+bool function_is_llvm_intrinsic(const llvm::Function *func)
+{
+	return func->isIntrinsic();
+}
+
 bool value_is_dx_op_instrinsic(const llvm::Value *value, DXIL::Op op)
 {
 	auto *call = llvm::dyn_cast<llvm::CallInst>(value);
@@ -504,7 +518,7 @@ bool value_is_dx_op_instrinsic(const llvm::Value *value, DXIL::Op op)
 		return false;
 
 	auto *func = call->getCalledFunction();
-	if (strncmp(func->getName().data(), "dx.op", 5) != 0)
+	if (!function_is_dxil_op(func))
 		return false;
 
 	// The opcode is encoded as a constant integer.
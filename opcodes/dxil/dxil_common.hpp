@@ -69,4 +69,8 @@ bool emit_store_clip_cull_distance(
 void build_exploded_composite_from_vector(Converter::Impl &impl, const llvm::Instruction *inst, unsigned active_lanes);
 
 bool value_is_dx_op_instrinsic(const llvm::Value *value, DXIL::Op op);
+
+// With LLVMBC, the callee kind is resolved once at parse time instead of comparing names per call.
+bool function_is_dxil_op(const llvm::Function *func);
+bool function_is_llvm_intrinsic(const llvm::Function *func);
 }
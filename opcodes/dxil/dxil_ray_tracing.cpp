@@ -348,7 +348,7 @@ static bool ray_query_operand_is_alloca(Converter::Impl &impl, const llvm::Value
 		uint32_t op = 0;
 		if (!get_constant_operand(alloca, 0, &op))
 			return false;
-		if (strncmp(alloca->getCalledFunction()->getName().data(), "dx.op", 5) != 0)
+		if (!function_is_dxil_op(alloca->getCalledFunction()))
 			return false;
 		if (DXIL::Op(op) != DXIL::Op::AllocateRayQuery)
 			return false;
@@ -284,7 +284,7 @@ static bool value_is_wave_lane(const llvm::Value *value)
 	auto *dxil_op = llvm::dyn_cast<llvm::CallInst>(value);
 	if (!dxil_op)
 		return false;
-	if (strncmp(dxil_op->getCalledFunction()->getName().data(), "dx.op", 5) != 0)
+	if (!function_is_dxil_op(dxil_op->getCalledFunction()))
 		return false;
 
 	uint32_t op;
@@ -1103,7 +1103,7 @@ bool analyze_dxil_instruction(Converter::Impl &impl, const llvm::CallInst *instr
 
 	case DXIL::Op::LegacyF16ToF32:
 		// Very specific check for HZD invariance. See f32_to_f16 code for details.
-		if (instruction->hasMetadata("dx.precise") || impl.options.force_precise)
+		if (instruction->hasMetadata(impl.metadata_kinds.precise) || impl.options.force_precise)
 			impl.shader_analysis.precise_f16_to_f32_observed = true;
 		break;
 
@@ -51,7 +51,7 @@ static bool instruction_is_ballot(const llvm::Value *aggregate)
 	if (const auto *call_inst = llvm::dyn_cast<llvm::CallInst>(aggregate))
 	{
 		auto *called_function = call_inst->getCalledFunction();
-		if (strncmp(called_function->getName().data(), "dx.op", 5) == 0)
+		if (function_is_dxil_op(called_function))
 		{
 			auto *constant = llvm::dyn_cast<llvm::ConstantInt>(call_inst->getOperand(0));
 			if (constant)
@@ -909,12 +909,12 @@ bool emit_cast_instruction(Converter::Impl &impl, const llvm::CastInst *instruct
 	return emit_cast_instruction_impl(impl, instruction) != 0;
 }
 
-static bool elementptr_is_nonuniform(const llvm::GetElementPtrInst *inst)
+static bool elementptr_is_nonuniform(Converter::Impl &impl, const llvm::GetElementPtrInst *inst)
 {
-	return inst->hasMetadata("dx.nonuniform");
+	return inst->hasMetadata(impl.metadata_kinds.nonuniform);
 }
 
-static bool elementptr_is_nonuniform(const llvm::ConstantExpr *)
+static bool elementptr_is_nonuniform(Converter::Impl &, const llvm::ConstantExpr *)
 {
 	return false;
 }
@@ -940,7 +940,7 @@ static bool emit_getelementptr_resource(Converter::Impl &impl, const Inst *instr
 
 	auto indexed_meta = meta;
 	indexed_meta.offset = instruction->getOperand(2);
-	indexed_meta.non_uniform = elementptr_is_nonuniform(instruction);
+	indexed_meta.non_uniform = elementptr_is_nonuniform(impl, instruction);
 	impl.llvm_global_variable_to_resource_mapping[instruction] = indexed_meta;
 	return true;
 }
@@ -0,0 +1,146 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "thread_local_allocator.hpp"
+
+#ifdef HAVE_LLVMBC
+#include "value.hpp"
+#else
+#include <llvm/IR/Value.h>
+#endif
+
+#include <assert.h>
+#include <utility>
+
+namespace dxil_spv
+{
+#ifdef HAVE_LLVMBC
+// Side table keyed by llvm::Value, indexed by Value::get_dense_id() instead of hashing pointers.
+// Supports the subset of the UnorderedMap interface the converter uses.
+// Entries live in fixed size chunks which are never reallocated,
+// so references and iterators stay valid across insertions like they do for UnorderedMap.
+// All keys must come from the same LLVMContext.
+template <typename T>
+class DenseValueMap
+{
+public:
+	using value_type = std::pair<const llvm::Value *, T>;
+	using iterator = value_type *;
+	using const_iterator = const value_type *;
+
+	iterator find(const llvm::Value *value)
+	{
+		auto *entry = lookup(value->get_dense_id());
+		return entry && entry->first == value ? entry : nullptr;
+	}
+
+	const_iterator find(const llvm::Value *value) const
+	{
+		return const_cast<DenseValueMap *>(this)->find(value);
+	}
+
+	iterator end()
+	{
+		return nullptr;
+	}
+
+	const_iterator end() const
+	{
+		return nullptr;
+	}
+
+	size_t count(const llvm::Value *value) const
+	{
+		return find(value) ? 1 : 0;
+	}
+
+	T &operator[](const llvm::Value *value)
+	{
+		uint32_t id = value->get_dense_id();
+		uint32_t chunk = id >> ChunkBits;
+		if (chunk >= chunks.size())
+			chunks.resize(chunk + 1);
+		if (chunks[chunk].empty())
+			chunks[chunk].resize(ChunkSize);
+
+		auto &entry = chunks[chunk][id & ChunkMask];
+		assert(!entry.first || entry.first == value);
+		entry.first = value;
+		return entry.second;
+	}
+
+	void erase(iterator itr)
+	{
+		*itr = {};
+	}
+
+private:
+	enum
+	{
+		ChunkBits = 8,
+		ChunkSize = 1 << ChunkBits,
+		ChunkMask = ChunkSize - 1
+	};
+
+	// Moving the outer vector moves the chunk storage along with it, so entries never move.
+	Vector<Vector<value_type>> chunks;
+
+	value_type *lookup(uint32_t id)
+	{
+		uint32_t chunk = id >> ChunkBits;
+		if (chunk >= chunks.size() || chunks[chunk].empty())
+			return nullptr;
+		return &chunks[chunk][id & ChunkMask];
+	}
+};
+
+class DenseValueSet
+{
+public:
+	size_t count(const llvm::Value *value) const
+	{
+		return values.count(value);
+	}
+
+	void insert(const llvm::Value *value)
+	{
+		values[value] = true;
+	}
+
+private:
+	DenseValueMap<bool> values;
+};
+
+template <typename T>
+using LLVMValueMap = DenseValueMap<T>;
+using LLVMValueSet = DenseValueSet;
+#else
+// LLVM values have no dense IDs we can use, so fall back to hashing pointers.
+template <typename T>
+using LLVMValueMap = UnorderedMap<const llvm::Value *, T>;
+using LLVMValueSet = UnorderedSet<const llvm::Value *>;
+#endif
+} // namespace dxil_spv
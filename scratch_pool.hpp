@@ -26,6 +26,8 @@
 #define DXIL_SPV_SCRATCH_POOL_H_
 
 #include "thread_local_allocator.hpp"
+#include <algorithm>
+#include <memory>
 
 namespace dxil_spv
 {
@@ -38,10 +40,13 @@ public:
 		static_assert(std::is_trivially_destructible<T>::value, "T must be trivially destructible.");
 	}
 
+	// Returns nullptr if a new block cannot be allocated, see allocate_in_thread().
 	template <typename... P>
 	T *allocate(P &&... p)
 	{
 		T *t = allocate_raw();
+		if (!t)
+			return nullptr;
 		return new (t) T(std::forward<P>(p)...);
 	}
 
@@ -54,13 +59,11 @@ public:
 		new_block.size = next_allocate_size;
 		new_block.base = static_cast<T *>(allocate_in_thread(sizeof(T) * next_allocate_size));
 		if (!new_block.base)
-		{
-			// If we fail to allocate this little memory, we are hosed anyways.
-			std::terminate();
-		}
+			return nullptr;
 
 		blocks.emplace_back(new_block.base);
-		next_allocate_size *= 2;
+		// Bound the growth, so the pool cannot overshoot a context's memory limit by much.
+		next_allocate_size = std::min<size_t>(next_allocate_size * 2, MaxBlockSize);
 
 		current = new_block;
 		current.offset = 1;
@@ -82,6 +85,7 @@ private:
 		size_t offset;
 		size_t size;
 	};
+	enum { MaxBlockSize = 16 * 1024 };
 	Block current = {};
 	size_t next_allocate_size = 64;
 	Vector<std::unique_ptr<T, MallocDeleter>> blocks;
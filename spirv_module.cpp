@@ -102,6 +102,10 @@ struct SPIRVModule::Impl : BlockEmissionInterface
 
 	spv::Id get_type_for_builtin(spv::BuiltIn builtin, bool &requires_flat_decoration);
 	ScratchPool<Operation> operation_pool;
+	// Handed out once operation_pool fails, so callers need not check. The module cannot be finalized after that.
+	Operation discarded_op;
+	bool operation_pool_failed = false;
+	Operation *discard_op(const Operation &op);
 
 	bool spirv_requires_14() const;
 	bool builtin_requires_volatile(spv::BuiltIn builtin) const;
@@ -1278,6 +1282,12 @@ bool SPIRVModule::Impl::finalize_spirv(Vector<uint32_t> &spirv)
 {
 	spirv.clear();
 
+	if (operation_pool_failed)
+	{
+		LOGE("Failed to allocate operations.\n");
+		return false;
+	}
+
 	mark_error = false;
 	builder.dump(spirv);
 	if (spirv.size() >= 2)
@@ -1614,6 +1624,7 @@ void SPIRVModule::Impl::emit_basic_block(CFGNode *node)
 
 bool SPIRVModule::finalize_spirv(Vector<uint32_t> &spirv) const
 {
+	ScopedAllocatorTag tag(AllocatorTag::SPIRVBuilder);
 	return impl->finalize_spirv(spirv);
 }
 
@@ -1671,11 +1682,13 @@ spv::Id SPIRVModule::Impl::create_variable_with_initializer(spv::StorageClass st
 
 void SPIRVModule::emit_entry_point_function_body(CFGStructurizer &structurizer)
 {
+	ScopedAllocatorTag tag(AllocatorTag::SPIRVBuilder);
 	impl->emit_entry_point_function_body(structurizer);
 }
 
 void SPIRVModule::emit_leaf_function_body(spv::Function *func, CFGStructurizer &structurizer)
 {
+	ScopedAllocatorTag tag(AllocatorTag::SPIRVBuilder);
 	impl->emit_leaf_function_body(func, structurizer);
 }
 
@@ -1749,19 +1762,29 @@ bool SPIRVModule::query_builtin_shader_output(spv::Id id, spv::BuiltIn *builtin)
 	return impl->query_builtin_shader_output(id, builtin);
 }
 
+Operation *SPIRVModule::Impl::discard_op(const Operation &op)
+{
+	operation_pool_failed = true;
+	discarded_op = op;
+	return &discarded_op;
+}
+
 Operation *SPIRVModule::allocate_op()
 {
-	return impl->operation_pool.allocate();
+	auto *ret = impl->operation_pool.allocate();
+	return ret ? ret : impl->discard_op(Operation());
 }
 
 Operation *SPIRVModule::allocate_op(spv::Op op)
 {
-	return impl->operation_pool.allocate(op);
+	auto *ret = impl->operation_pool.allocate(op);
+	return ret ? ret : impl->discard_op(Operation(op));
 }
 
 Operation *SPIRVModule::allocate_op(spv::Op op, spv::Id id, spv::Id type_id)
 {
-	return impl->operation_pool.allocate(op, id, type_id);
+	auto *ret = impl->operation_pool.allocate(op, id, type_id);
+	return ret ? ret : impl->discard_op(Operation(op, id, type_id));
 }
 
 spv::Id SPIRVModule::create_variable(spv::StorageClass storage, spv::Id type, const char *name)
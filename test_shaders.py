@@ -233,6 +233,10 @@ def cross_compile_dxil(shader, args, paths, is_asm):
     if '.partitioned.' in shader:
         hlsl_cmd += ['--subgroup-partitioned-nv']
 
+    # Output must not depend on whether functions are structurized in parallel.
+    if args.structurizer_threads:
+        hlsl_cmd += ['--structurizer-threads', str(args.structurizer_threads)]
+
     subprocess.check_call(hlsl_cmd)
     if is_asm:
         return glsl_path
@@ -376,6 +380,10 @@ def main():
             help = 'Explicit path to dxil-spirv')
     parser.add_argument('--subfolder',
             help = 'Only test specific subfolder')
+    parser.add_argument('--structurizer-threads',
+            type = int,
+            default = 0,
+            help = 'Structurize functions in parallel with this many threads. References are shared with serial runs.')
 
     args = parser.parse_args()
     if not args.folder:
@@ -31,89 +31,90 @@ namespace LLVMBC
 {
 #define MAKE_FOURCC(a, b, c, d) (((a) << 0) | ((b) << 8) | ((c) << 16) | ((d) << 24))
 using byte = uint8_t;
+
+// Reads the bitstream through a 64-bit bit buffer which is refilled a whole word at a time.
+// Reads which would go past the end of the stream return 0 and leave the reader at the end of the
+// stream, same as reading bits one byte at a time would.
 class BitReader
 {
 public:
   BitReader(const byte *bits, size_t length)
-      : m_Bits(bits), m_Start(bits), m_End(bits + length), m_Offset(0)
+      : m_Next(bits), m_Start(bits), m_End(bits + length), m_Buffer(0), m_BufferBits(0)
   {
   }
-  size_t ByteOffset() const { return m_Bits - m_Start; }
-  size_t BitOffset() const { return ByteOffset() * 8 + m_Offset; }
+  size_t ByteOffset() const { return BitOffset() / 8; }
+  size_t BitOffset() const { return size_t(m_Next - m_Start) * 8 - m_BufferBits; }
   size_t ByteLength() const { return m_End - m_Start; }
   size_t BitLength() const { return (m_End - m_Start) * 8; }
-  bool AtEndOfStream() const { return m_Bits >= m_End; }
-  void SeekByte(size_t byteOffset)
-  {
-    m_Bits = m_Start + byteOffset;
-    m_Offset = 0;
-  }
+  bool AtEndOfStream() const { return BitOffset() >= BitLength(); }
+  void SeekByte(size_t byteOffset) { SeekBit(byteOffset * 8); }
   void SeekBit(size_t bitOffset)
   {
-    m_Bits = m_Start + (bitOffset / 8);
-    m_Offset = (bitOffset % 8);
+    m_Next = m_Start + (bitOffset / 8);
+    m_Buffer = 0;
+    m_BufferBits = 0;
+
+    if(bitOffset % 8)
+    {
+      Refill();
+      // seeking to a partial byte past the end of the stream leaves us at the byte boundary
+      if(m_BufferBits >= bitOffset % 8)
+        Consume(bitOffset % 8);
+    }
   }
+
   char c6()
   {
-    byte scratch[8];
-    scratch[0] = 0;
-    byte &c = scratch[0];
-
-    ReadBits(6, &c);
-
-    if(c <= 25)
-      return char('a' + c);
-    else if(c <= 51)
-      return char('A' + c - 26);
-    else if(c <= 61)
-      return char('0' + c - 52);
-    else if(c == 62)
-      return '.';
-    else if(c == 63)
-      return '_';
-
-    return '?';
+    static const char table[64 + 1] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._";
+    return table[ReadBits(6)];
   }
 
   template <typename T>
   T fixed(const size_t bitWidth)
   {
-    byte scratch[8] = {};
-
     assert(bitWidth <= 64);
-
-    ReadBits(bitWidth, scratch);
+    uint64_t bits = ReadBits(bitWidth);
 
     T ret;
-    memcpy(&ret, scratch, sizeof(T));
+    memcpy(&ret, &bits, sizeof(T));
     return ret;
   }
 
   template <typename T>
   T vbr(const size_t groupBitSize)
   {
-    uint64_t ret = 0;
-
     assert(groupBitSize > 1 && "chunk size must be greater than 1");
     assert(groupBitSize <= 8 && "Only chunk sizes up to 8 supported");
 
-    // Avoid false positive warning.
-    byte scratch[8] = {};
+    const uint64_t hibit = 1ull << (groupBitSize - 1);
+    const uint64_t lobits = hibit - 1;
 
-    const byte hibit = 1 << (groupBitSize - 1);
-    const byte lobits = hibit - 1;
+    // Fast path, the entire value is a single chunk which is already in the buffer.
+    if(m_BufferBits >= groupBitSize)
+    {
+      uint64_t chunk = m_Buffer & (2 * hibit - 1);
+      if((chunk & hibit) == 0)
+      {
+        Consume(groupBitSize);
+        return T(chunk);
+      }
+    }
 
+    uint64_t ret = 0;
     uint64_t shift = 0;
+    uint64_t chunk;
+
     do
     {
-      ReadBits(groupBitSize, scratch);
+      chunk = ReadBits(groupBitSize);
 
       assert(shift <= 63);
 
-      ret += (uint64_t(scratch[0] & lobits) << shift);
+      ret += (chunk & lobits) << shift;
 
       shift += uint64_t(groupBitSize - 1);
-    } while(scratch[0] & hibit);
+    } while(chunk & hibit);
 
 #ifndef NDEBUG
     // check for overflow of the return type
@@ -124,6 +125,20 @@ public:
     return T(ret);
   }
 
+  // VBR6 is by far the most common encoding, used for all operands of unabbreviated records.
+  template <typename T>
+  T vbr6()
+  {
+    if(m_BufferBits >= 6 && (m_Buffer & 0x20) == 0)
+    {
+      T ret = T(m_Buffer & 0x1f);
+      Consume(6);
+      return ret;
+    }
+
+    return vbr<T>(6);
+  }
+
   template <typename T>
   T svbr(size_t groupBitSize)
   {
@@ -145,12 +160,11 @@ public:
   template <typename T>
   T Read()
   {
-    byte scratch[sizeof(T)] = {};
-
-    ReadBits(sizeof(T) * 8, scratch);
+    static_assert(sizeof(T) <= sizeof(uint64_t), "Cannot read more than 64 bits at a time.");
+    uint64_t bits = ReadBits(sizeof(T) * 8);
 
     T ret;
-    memcpy(&ret, scratch, sizeof(T));
+    memcpy(&ret, &bits, sizeof(T));
     return ret;
   }
 
@@ -162,180 +176,110 @@ public:
     // align to dword boundary
     align32bits();
 
-    // the blob is at m_Bits now
-    blobptr = m_Bits;
+    // the blob is at the current byte now
+    blobptr = m_Start + ByteOffset();
 
     // advance by the length, and align up as well
-    m_Bits += bloblen;
+    SeekByte(ByteOffset() + bloblen);
     align32bits();
   }
 
   void align32bits()
   {
-    // skip the rest of the current byte, if we're part-way through
-    if(m_Offset > 0)
-      Advance(8 - m_Offset);
-
-    const size_t byteOffs = ByteOffset();
-    const size_t alignedByteOffs = (byteOffs + 0x3) & ~0x3;
+    const size_t bitOffs = BitOffset();
+    const size_t alignedBitOffs = (bitOffs + 31) & ~size_t(31);
 
-    // advance by N bytes to dword align the stream
-    m_Bits += (alignedByteOffs - byteOffs);
+    // skip within the buffer if we can, otherwise seek and drop the buffer
+    if(alignedBitOffs - bitOffs <= m_BufferBits)
+      Consume(alignedBitOffs - bitOffs);
+    else
+      SeekBit(alignedBitOffs);
   }
 
 private:
-  const byte *m_Bits, *m_Start, *m_End;
-  size_t m_Offset;
+  // m_Next is the next byte to be loaded into the buffer.
+  // The low m_BufferBits bits of m_Buffer are the next bits in the stream.
+  const byte *m_Next, *m_Start, *m_End;
+  uint64_t m_Buffer;
+  size_t m_BufferBits;
 
-  void Advance(size_t N)
-  {
-    m_Offset += N;
-    // shouldn't read more than this byte
-    assert(m_Offset <= 8);
+  static uint64_t BitMask(size_t bits) { return bits >= 64 ? ~0ull : ((1ull << bits) - 1); }
 
-    // roll over to next byte after consuming all 8 bits
-    if(m_Offset == 8)
-    {
-      m_Bits++;
-      m_Offset = 0;
-    }
+  void Consume(size_t bits)
+  {
+    assert(bits <= m_BufferBits);
+    m_Buffer = bits >= 64 ? 0 : (m_Buffer >> bits);
+    m_BufferBits -= bits;
   }
 
-  void ReadBits(size_t bitsToRead, byte *dst)
+  // Loads as many whole bytes as there is space for in the buffer.
+  void Refill()
   {
-    if(BitOffset() + bitsToRead > BitLength())
-    {
-      // read 0s off the end of the stream.
-      // set any whole bytes to 0:
-      while(bitsToRead >= 8)
-      {
-        *dst = 0;
-        dst++;
-        bitsToRead -= 8;
-      }
-
-      // set any remaining bits to 0:
-      if(bitsToRead)
-        *dst &= ~((1 << bitsToRead) - 1);
-
-      m_Bits = m_End;
-      m_Offset = 0;
+    if(m_Next >= m_End)
       return;
-    }
 
-    size_t dstoffs = 0;
+    size_t avail = size_t(m_End - m_Next);
+    size_t bytes = (64 - m_BufferBits) / 8;
+    if(bytes > avail)
+      bytes = avail;
 
-    // if we're already partway through a byte, read as many bits as we need and we can
-    if(m_Offset != 0)
+    uint64_t word = 0;
+    if(bytes == 8)
     {
-      const size_t avail = 8 - m_Offset;
-
-      if(avail == bitsToRead)
-      {
-        // if we have just enough in this byte, great! shift and mask off, and update the offset
-
-        // grab the bits into the low end
-        *dst = (*m_Bits >> m_Offset);
-
-        Advance(bitsToRead);
-
-        return;
-      }
-      else if(avail > bitsToRead)
-      {
-        // we have more than enough. Similar to above but we need to mask out only the bits we need.
-
-        // grab the bits into the low end and mask
-        *dst = (*m_Bits >> m_Offset) & ((1 << bitsToRead) - 1);
-
-        Advance(bitsToRead);
-
-        return;
-      }
-      else
-      {
-        // we don't have enough. Consume what we can then continue
-        *dst = (*m_Bits >> m_Offset);
-
-        dstoffs = avail;
-        bitsToRead -= avail;
-
-        Advance(avail);
-      }
+      memcpy(&word, m_Next, sizeof(word));
     }
     else
     {
-      // ensure if we didn't read any bits that the byte is zeroed out, so we can OR on bits below
-      // without needing to worry
-      *dst = 0;
+      for(size_t i = 0; i < bytes; i++)
+        word |= uint64_t(m_Next[i]) << (8 * i);
     }
 
-    // we're now at the start of a byte since we read any remainder above.
-    assert(m_Offset == 0);
+    m_Buffer |= m_BufferBits ? (word << m_BufferBits) : word;
+    m_BufferBits += bytes * 8;
+    m_Next += bytes;
+  }
 
-    // if we have to read whole bytes, do that here.
-    if(bitsToRead >= 8)
+  uint64_t ReadBits(size_t bitsToRead)
+  {
+    if(bitsToRead <= m_BufferBits)
     {
-      if(dstoffs == 0)
-      {
-        // if dstoffs is 0 then it's an easy case, we can just copy all the whole bytes into *dst
-        memcpy(dst, m_Bits, bitsToRead / 8);
-
-        // manual advance
-        m_Bits += (bitsToRead / 8);
-        dst += (bitsToRead / 8);
-
-        // make sure we read any sub-byte remainder
-        bitsToRead &= 0x7;
-      }
-      else
-      {
-        while(bitsToRead >= 8)
-        {
-          // manual advance
-          const byte cur = *m_Bits;
-          m_Bits++;
-
-          bitsToRead -= 8;
-
-          // dstoffs doesn't change because we wrap around to the same offset in the next byte.
-          // However we do need to shuffle the bits in cur around to add what will fit into the
-          // current byte, and then the remainder into the next byte.
-          *dst |= (cur << dstoffs);
-          dst++;
-          *dst = (cur >> (8 - dstoffs));
-        }
-      }
+      uint64_t ret = m_Buffer & BitMask(bitsToRead);
+      Consume(bitsToRead);
+      return ret;
     }
 
-    // if nothing remains, return
-    if(bitsToRead == 0)
-      return;
-
-    // we should now have no more than than 7 bits to read
-    assert(bitsToRead < 8);
-
-    // this is the mask to get only the bits we want
-    const byte mask = ((1 << bitsToRead) - 1);
+    return ReadBitsSlow(bitsToRead);
+  }
 
-    // take the bits that we want from the next byte (knowing we want the low-order bits), and shift
-    // them into where they should go.
-    byte data = *m_Bits & mask;
+  uint64_t ReadBitsSlow(size_t bitsToRead)
+  {
+    size_t remainingBits = m_BufferBits;
+    if(m_Next < m_End)
+      remainingBits += size_t(m_End - m_Next) * 8;
 
-    // check if we overlap into the next destination byte
-    if(dstoffs + bitsToRead <= 8)
+    if(bitsToRead > remainingBits)
     {
-      *dst |= data << dstoffs;
-    }
-    else
-    {
-      *dst |= data << dstoffs;
-      dst++;
-      *dst = data >> (8 - dstoffs);
+      // read 0s off the end of the stream.
+      m_Next = m_End;
+      m_Buffer = 0;
+      m_BufferBits = 0;
+      return 0;
     }
 
-    // consume the bits we used
-    Advance(bitsToRead);
+    // drain what we have, then refill with a whole word
+    uint64_t ret = m_Buffer;
+    size_t got = m_BufferBits;
+    m_Buffer = 0;
+    m_BufferBits = 0;
+
+    Refill();
+
+    size_t needed = bitsToRead - got;
+    assert(needed <= m_BufferBits);
+
+    ret |= (m_Buffer & BitMask(needed)) << got;
+    Consume(needed);
+    return ret;
   }
 };
 
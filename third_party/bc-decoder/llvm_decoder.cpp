@@ -50,6 +50,8 @@ struct AbbrevDesc
   dxil_spv::Vector<AbbrevParam> params;
 };
 
+struct BlockInfo;
+
 // the temporary context while pushing/popping blocks
 struct BlockContext
 {
@@ -57,6 +59,8 @@ struct BlockContext
   BlockContext(size_t size = 2) : abbrevSize(size) {}
   size_t abbrevSize;
   dxil_spv::Vector<AbbrevDesc> abbrevs;
+  // cached BLOCKINFO for this block id, looked up on first abbreviated record
+  const BlockInfo *info = NULL;
 };
 
 // the permanent block info defined by BLOCKINFO
@@ -96,18 +100,66 @@ BitcodeReader::~BitcodeReader()
     delete it->second;
 }
 
+namespace
+{
+// Builds the full BlockOrRecord tree.
+struct TreeBuilder : BitcodeVisitor
+{
+  BlockOrRecord root;
+  // parents are never appended to while a child is open, so pointers stay valid
+  dxil_spv::Vector<BlockOrRecord *> stack;
+
+  BlockAction EnterBlock(const BlockOrRecord &block) override
+  {
+    if(stack.empty())
+    {
+      root = block;
+      stack.push_back(&root);
+    }
+    else
+    {
+      stack.back()->children.push_back(block);
+      stack.push_back(&stack.back()->children.back());
+    }
+    return BlockAction::Enter;
+  }
+
+  bool VisitRecord(const BlockOrRecord &record) override
+  {
+    stack.back()->children.push_back(record);
+    return true;
+  }
+
+  bool LeaveBlock(const BlockOrRecord &) override
+  {
+    stack.pop_back();
+    return true;
+  }
+};
+}
+
 BlockOrRecord BitcodeReader::ReadToplevelBlock()
 {
-  BlockOrRecord ret;
+  TreeBuilder builder;
+  VisitToplevelBlock(builder);
+  return std::move(builder.root);
+}
 
+bool BitcodeReader::VisitToplevelBlock(BitcodeVisitor &visitor)
+{
   // should hit ENTER_SUBBLOCK first for top-level block
   uint32_t abbrevID = b.fixed<uint32_t>(abbrevSize());
   (void)abbrevID;
   assert(abbrevID == ENTER_SUBBLOCK);
 
-  ReadBlockContents(ret);
+  return VisitBlockContents(visitor);
+}
 
-  return ret;
+bool BitcodeReader::VisitBlockAt(size_t blockBitOffset, BitcodeVisitor &visitor)
+{
+  assert(blockStack.empty());
+  b.SeekBit(blockBitOffset);
+  return VisitBlockContents(visitor);
 }
 
 bool BitcodeReader::AtEndOfStream()
@@ -115,17 +167,32 @@ bool BitcodeReader::AtEndOfStream()
   return b.AtEndOfStream();
 }
 
-void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
+bool BitcodeReader::VisitBlockContents(BitcodeVisitor &visitor)
 {
+  BlockOrRecord block;
+  block.blockBitOffset = b.BitOffset();
   block.id = b.vbr<uint32_t>(8);
-
-  blockStack.push_back(new BlockContext(b.vbr<size_t>(4)));
+  size_t blockAbbrevSize = b.vbr<size_t>(4);
 
   b.align32bits();
   block.blockDwordLength = b.Read<uint32_t>();
 
+  auto action = visitor.EnterBlock(block);
+  if(action == BitcodeVisitor::BlockAction::Stop)
+    return false;
+
+  if(action == BitcodeVisitor::BlockAction::Skip && block.id != 0)
+  {
+    // abbreviations defined inside the block are local to it, so we can jump straight past it
+    b.SeekByte(b.ByteOffset() + size_t(block.blockDwordLength) * 4);
+    return true;
+  }
+
+  blockStack.push_back(new BlockContext(blockAbbrevSize));
+
   // used for blockinfo only
   BlockInfo *curBlockInfo = NULL;
+  bool ok = true;
 
   uint32_t abbrevID = ~0U;
   do
@@ -138,11 +205,7 @@ void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
     }
     else if(abbrevID == ENTER_SUBBLOCK)
     {
-      BlockOrRecord sub;
-
-      ReadBlockContents(sub);
-
-      block.children.push_back(sub);
+      ok = VisitBlockContents(visitor);
     }
     else if(abbrevID == DEFINE_ABBREV)
     {
@@ -181,12 +244,14 @@ void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
     }
     else if(abbrevID == UNABBREV_RECORD)
     {
-      BlockOrRecord r;
-      r.id = b.vbr<uint32_t>(6);
-      uint32_t numops = b.vbr<uint32_t>(6);
+      BlockOrRecord &r = record;
+      r.id = b.vbr6<uint32_t>();
+      uint32_t numops = b.vbr6<uint32_t>();
       r.ops.resize(numops);
       for(uint32_t i = 0; i < numops; i++)
-        r.ops[i] = b.vbr<uint64_t>(6);
+        r.ops[i] = b.vbr6<uint64_t>();
+      r.blob = NULL;
+      r.blobLength = 0;
 
       if(block.id == 0)    // BLOCKINFO is block 0
       {
@@ -224,13 +289,16 @@ void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
         }
       }
 
-      block.children.push_back(r);
+      ok = visitor.VisitRecord(r);
     }
     else
     {
       const AbbrevDesc &a = getAbbrev(block.id, abbrevID);
 
-      BlockOrRecord r;
+      BlockOrRecord &r = record;
+      r.ops.clear();
+      r.blob = NULL;
+      r.blobLength = 0;
 
       // should have at least one param for the code itself
       assert(!a.params.empty());
@@ -251,7 +319,7 @@ void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
           assert(i + 1 == a.params.size() - 1);
           const AbbrevParam &elType = a.params[i + 1];
 
-          size_t arrayLen = b.vbr<size_t>(6);
+          size_t arrayLen = b.vbr6<size_t>();
 
           for(size_t el = 0; el < arrayLen; el++)
             r.ops.push_back(decodeAbbrevParam(elType));
@@ -272,12 +340,14 @@ void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
         }
       }
 
-      block.children.push_back(r);
+      ok = visitor.VisitRecord(r);
     }
-  } while(abbrevID != END_BLOCK);
+  } while(ok && abbrevID != END_BLOCK);
 
   delete blockStack.back();
   blockStack.erase(blockStack.begin() + (blockStack.size() - 1));
+
+  return ok && visitor.LeaveBlock(block);
 }
 
 uint64_t BitcodeReader::decodeAbbrevParam(const AbbrevParam &param)
@@ -287,7 +357,8 @@ uint64_t BitcodeReader::decodeAbbrevParam(const AbbrevParam &param)
   switch(param.encoding)
   {
     case AbbrevEncoding::Fixed: return b.fixed<uint64_t>((size_t)param.value);
-    case AbbrevEncoding::VBR: return b.vbr<uint64_t>((size_t)param.value);
+    case AbbrevEncoding::VBR:
+      return param.value == 6 ? b.vbr6<uint64_t>() : b.vbr<uint64_t>((size_t)param.value);
     case AbbrevEncoding::Char6: return b.c6();
     case AbbrevEncoding::Literal: return param.value;
   
@@ -308,7 +379,17 @@ size_t BitcodeReader::abbrevSize() const
 
 const AbbrevDesc &BitcodeReader::getAbbrev(uint32_t blockId, uint32_t abbrevID)
 {
-  const BlockInfo *info = blockInfo[blockId];
+  assert(!blockStack.empty());
+  BlockContext *ctx = blockStack.back();
+
+  if(!ctx->info)
+  {
+    auto itr = blockInfo.find(blockId);
+    if(itr != blockInfo.end())
+      ctx->info = itr->second;
+  }
+
+  const BlockInfo *info = ctx->info;
 
   // IDs start at the first application specified ID. Rebase to that to get 0-base indices
   assert(abbrevID >= APPLICATION_ABBREV);
@@ -34,6 +34,8 @@ struct BlockOrRecord
 {
   uint32_t id;
   uint32_t blockDwordLength = 0;    // 0 for records
+  // if a block, bit offset of its header. can be passed to BitcodeReader::VisitBlockAt
+  size_t blockBitOffset = 0;
 
   bool IsBlock() const { return blockDwordLength > 0; }
   bool IsRecord() const { return blockDwordLength == 0; }
@@ -55,24 +57,55 @@ struct AbbrevDesc;
 struct BlockContext;
 struct BlockInfo;
 
+// Receives blocks and records in stream order as they are decoded.
+// The BlockOrRecord passed to VisitRecord() is reused for every record, so
+// visitors must copy out anything they want to keep.
+// Block entries only carry id and blockDwordLength, never children.
+class BitcodeVisitor
+{
+public:
+  enum class BlockAction
+  {
+    Enter,
+    Skip,
+    Stop
+  };
+
+  virtual ~BitcodeVisitor() = default;
+  // BLOCKINFO is always entered since it defines abbreviations for other blocks.
+  virtual BlockAction EnterBlock(const BlockOrRecord &block) = 0;
+  // Returning false stops decoding.
+  virtual bool VisitRecord(const BlockOrRecord &record) = 0;
+  virtual bool LeaveBlock(const BlockOrRecord &block) = 0;
+};
+
 class BitcodeReader
 {
 public:
   BitcodeReader(const byte *bitcode, size_t length);
   ~BitcodeReader();
+  // Materializes the entire block tree.
   BlockOrRecord ReadToplevelBlock();
+  // Streams the top-level block through visitor. Returns false if the visitor stopped decoding.
+  bool VisitToplevelBlock(BitcodeVisitor &visitor);
+  // Re-decodes a single block previously seen by a visitor, e.g. one it skipped.
+  // BLOCKINFO abbreviations from the earlier pass are reused, so this must only be called after it.
+  bool VisitBlockAt(size_t blockBitOffset, BitcodeVisitor &visitor);
   bool AtEndOfStream();
 
 private:
   BitReader b;
 
-  void ReadBlockContents(BlockOrRecord &block);
+  bool VisitBlockContents(BitcodeVisitor &visitor);
   const AbbrevDesc &getAbbrev(uint32_t blockId, uint32_t abbrevID);
   size_t abbrevSize() const;
   uint64_t decodeAbbrevParam(const AbbrevParam &param);
 
   dxil_spv::Vector<BlockContext *> blockStack;
   dxil_spv::UnorderedMap<uint32_t, BlockInfo *> blockInfo;
+
+  // Scratch record which is handed to the visitor, ops storage is recycled between records.
+  BlockOrRecord record;
 };
 
 };    // namespace LLVMBC
@@ -51,6 +51,24 @@
 
 namespace spv {
 
+namespace {
+
+// FNV-1a style hash of the words which identify a type or constant.
+struct InstructionKey {
+    explicit InstructionKey(unsigned word) { add(word); }
+    void add(unsigned word) { hash = (hash ^ word) * 0x100000001b3ull; }
+    void add(const dxil_spv::Vector<Id>& words)
+    {
+        add((unsigned)words.size());
+        for (Id word : words)
+            add(word);
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+};
+
+}
+
 Builder::Builder(unsigned int magicNumber, SpvBuildLogger* buildLogger) :
     source(SourceLanguageUnknown),
     sourceVersion(0),
@@ -175,13 +193,25 @@ Id Builder::makeRayQueryType()
     return type->getResultId();
 }
 
+const dxil_spv::Vector<Instruction*>& Builder::lookupInstructions(const InstructionLookup& lookup, uint64_t hash)
+{
+    static const dxil_spv::Vector<Instruction*> empty;
+    auto itr = lookup.find(hash);
+    return itr != lookup.end() ? itr->second : empty;
+}
+
 Id Builder::makePointer(StorageClass storageClass, Id pointee)
 {
+    InstructionKey key(OpTypePointer);
+    key.add(storageClass);
+    key.add(pointee);
+
     // try to find it
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypePointer].size(); ++t) {
-        type = groupedTypes[OpTypePointer][t];
-        if (type->getImmediateOperand(0) == (unsigned)storageClass &&
+    for (Instruction* candidate : lookupInstructions(typeLookup, key.hash)) {
+        type = candidate;
+        if (type->getOpCode() == OpTypePointer &&
+            type->getImmediateOperand(0) == (unsigned)storageClass &&
             type->getIdOperand(1) == pointee)
             return type->getResultId();
     }
@@ -191,6 +221,7 @@ Id Builder::makePointer(StorageClass storageClass, Id pointee)
     type->addImmediateOperand(storageClass);
     type->addIdOperand(pointee);
     groupedTypes[OpTypePointer].push_back(type);
+    typeLookup[key.hash].push_back(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -199,11 +230,16 @@ Id Builder::makePointer(StorageClass storageClass, Id pointee)
 
 Id Builder::makeIntegerType(int width, bool hasSign)
 {
+    InstructionKey key(OpTypeInt);
+    key.add(width);
+    key.add(hasSign ? 1u : 0u);
+
     // try to find it
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypeInt].size(); ++t) {
-        type = groupedTypes[OpTypeInt][t];
-        if (type->getImmediateOperand(0) == (unsigned)width &&
+    for (Instruction* candidate : lookupInstructions(typeLookup, key.hash)) {
+        type = candidate;
+        if (type->getOpCode() == OpTypeInt &&
+            type->getImmediateOperand(0) == (unsigned)width &&
             type->getImmediateOperand(1) == (hasSign ? 1u : 0u))
             return type->getResultId();
     }
@@ -213,6 +249,7 @@ Id Builder::makeIntegerType(int width, bool hasSign)
     type->addImmediateOperand(width);
     type->addImmediateOperand(hasSign ? 1 : 0);
     groupedTypes[OpTypeInt].push_back(type);
+    typeLookup[key.hash].push_back(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -233,11 +270,15 @@ Id Builder::makeIntegerType(int width, bool hasSign)
 
 Id Builder::makeFloatType(int width)
 {
+    InstructionKey key(OpTypeFloat);
+    key.add(width);
+
     // try to find it
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypeFloat].size(); ++t) {
-        type = groupedTypes[OpTypeFloat][t];
-        if (type->getImmediateOperand(0) == (unsigned)width)
+    for (Instruction* candidate : lookupInstructions(typeLookup, key.hash)) {
+        type = candidate;
+        if (type->getOpCode() == OpTypeFloat &&
+            type->getImmediateOperand(0) == (unsigned)width)
             return type->getResultId();
     }
 
@@ -245,6 +286,7 @@ Id Builder::makeFloatType(int width)
     type = new Instruction(getUniqueId(), NoType, OpTypeFloat);
     type->addImmediateOperand(width);
     groupedTypes[OpTypeFloat].push_back(type);
+    typeLookup[key.hash].push_back(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -277,6 +319,9 @@ Id Builder::makeStructType(const dxil_spv::Vector<Id>& members, const char* name
     for (int op = 0; op < (int)members.size(); ++op)
         type->addIdOperand(members[op]);
     groupedTypes[OpTypeStruct].push_back(type);
+    InstructionKey key(OpTypeStruct);
+    key.add(members);
+    typeLookup[key.hash].push_back(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
     addName(type->getResultId(), name);
@@ -288,11 +333,16 @@ Id Builder::makeStructType(const dxil_spv::Vector<Id>& members, const char* name
 // checking for duplication.
 Id Builder::makeStructResultType(Id type0, Id type1)
 {
+    InstructionKey key(OpTypeStruct);
+    key.add(2u);
+    key.add(type0);
+    key.add(type1);
+
     // try to find it
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypeStruct].size(); ++t) {
-        type = groupedTypes[OpTypeStruct][t];
-        if (type->getNumOperands() != 2)
+    for (Instruction* candidate : lookupInstructions(typeLookup, key.hash)) {
+        type = candidate;
+        if (type->getOpCode() != OpTypeStruct || type->getNumOperands() != 2)
             continue;
         if (type->getIdOperand(0) != type0 ||
             type->getIdOperand(1) != type1)
@@ -310,11 +360,16 @@ Id Builder::makeStructResultType(Id type0, Id type1)
 
 Id Builder::makeVectorType(Id component, int size)
 {
+    InstructionKey key(OpTypeVector);
+    key.add(component);
+    key.add(size);
+
     // try to find it
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypeVector].size(); ++t) {
-        type = groupedTypes[OpTypeVector][t];
-        if (type->getIdOperand(0) == component &&
+    for (Instruction* candidate : lookupInstructions(typeLookup, key.hash)) {
+        type = candidate;
+        if (type->getOpCode() == OpTypeVector &&
+            type->getIdOperand(0) == component &&
             type->getImmediateOperand(1) == (unsigned)size)
             return type->getResultId();
     }
@@ -324,6 +379,7 @@ Id Builder::makeVectorType(Id component, int size)
     type->addIdOperand(component);
     type->addImmediateOperand(size);
     groupedTypes[OpTypeVector].push_back(type);
+    typeLookup[key.hash].push_back(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -336,11 +392,16 @@ Id Builder::makeMatrixType(Id component, int cols, int rows)
 
     Id column = makeVectorType(component, rows);
 
+    InstructionKey key(OpTypeMatrix);
+    key.add(column);
+    key.add(cols);
+
     // try to find it
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypeMatrix].size(); ++t) {
-        type = groupedTypes[OpTypeMatrix][t];
-        if (type->getIdOperand(0) == column &&
+    for (Instruction* candidate : lookupInstructions(typeLookup, key.hash)) {
+        type = candidate;
+        if (type->getOpCode() == OpTypeMatrix &&
+            type->getIdOperand(0) == column &&
             type->getImmediateOperand(1) == (unsigned)cols)
             return type->getResultId();
     }
@@ -350,6 +411,7 @@ Id Builder::makeMatrixType(Id component, int cols, int rows)
     type->addIdOperand(column);
     type->addImmediateOperand(cols);
     groupedTypes[OpTypeMatrix].push_back(type);
+    typeLookup[key.hash].push_back(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -362,12 +424,17 @@ Id Builder::makeMatrixType(Id component, int cols, int rows)
 // 'size' is an Id of a constant or specialization constant of the array size
 Id Builder::makeArrayType(Id element, Id sizeId, int stride)
 {
+    InstructionKey key(OpTypeArray);
+    key.add(element);
+    key.add(sizeId);
+
     Instruction* type;
     if (stride == 0) {
         // try to find existing type
-        for (int t = 0; t < (int)groupedTypes[OpTypeArray].size(); ++t) {
-            type = groupedTypes[OpTypeArray][t];
-            if (type->getIdOperand(0) == element &&
+        for (Instruction* candidate : lookupInstructions(typeLookup, key.hash)) {
+            type = candidate;
+            if (type->getOpCode() == OpTypeArray &&
+                type->getIdOperand(0) == element &&
                 type->getIdOperand(1) == sizeId)
                 return type->getResultId();
         }
@@ -378,6 +445,7 @@ Id Builder::makeArrayType(Id element, Id sizeId, int stride)
     type->addIdOperand(element);
     type->addIdOperand(sizeId);
     groupedTypes[OpTypeArray].push_back(type);
+    typeLookup[key.hash].push_back(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -396,11 +464,15 @@ Id Builder::makeRuntimeArray(Id element)
 
 Id Builder::makeFunctionType(Id returnType, const dxil_spv::Vector<Id>& paramTypes)
 {
+    InstructionKey key(OpTypeFunction);
+    key.add(returnType);
+    key.add(paramTypes);
+
     // try to find it
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypeFunction].size(); ++t) {
-        type = groupedTypes[OpTypeFunction][t];
-        if (type->getIdOperand(0) != returnType || (int)paramTypes.size() != type->getNumOperands() - 1)
+    for (Instruction* candidate : lookupInstructions(typeLookup, key.hash)) {
+        type = candidate;
+        if (type->getOpCode() != OpTypeFunction || type->getIdOperand(0) != returnType || (int)paramTypes.size() != type->getNumOperands() - 1)
             continue;
         bool mismatch = false;
         for (int p = 0; p < (int)paramTypes.size(); ++p) {
@@ -419,6 +491,7 @@ Id Builder::makeFunctionType(Id returnType, const dxil_spv::Vector<Id>& paramTyp
     for (int p = 0; p < (int)paramTypes.size(); ++p)
         type->addIdOperand(paramTypes[p]);
     groupedTypes[OpTypeFunction].push_back(type);
+    typeLookup[key.hash].push_back(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -429,11 +502,21 @@ Id Builder::makeImageType(Id sampledType, Dim dim, bool depth, bool arrayed, boo
 {
     assert(sampled == 1 || sampled == 2);
 
+    InstructionKey key(OpTypeImage);
+    key.add(sampledType);
+    key.add(dim);
+    key.add(depth ? 1u : 0u);
+    key.add(arrayed ? 1u : 0u);
+    key.add(ms ? 1u : 0u);
+    key.add(sampled);
+    key.add(format);
+
     // try to find it
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypeImage].size(); ++t) {
-        type = groupedTypes[OpTypeImage][t];
-        if (type->getIdOperand(0) == sampledType &&
+    for (Instruction* candidate : lookupInstructions(typeLookup, key.hash)) {
+        type = candidate;
+        if (type->getOpCode() == OpTypeImage &&
+            type->getIdOperand(0) == sampledType &&
             type->getImmediateOperand(1) == (unsigned int)dim &&
             type->getImmediateOperand(2) == (  depth ? 1u : 0u) &&
             type->getImmediateOperand(3) == (arrayed ? 1u : 0u) &&
@@ -454,6 +537,7 @@ Id Builder::makeImageType(Id sampledType, Dim dim, bool depth, bool arrayed, boo
     type->addImmediateOperand((unsigned int)format);
 
     groupedTypes[OpTypeImage].push_back(type);
+    typeLookup[key.hash].push_back(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -508,11 +592,15 @@ Id Builder::makeImageType(Id sampledType, Dim dim, bool depth, bool arrayed, boo
 
 Id Builder::makeSampledImageType(Id imageType)
 {
+    InstructionKey key(OpTypeSampledImage);
+    key.add(imageType);
+
     // try to find it
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypeSampledImage].size(); ++t) {
-        type = groupedTypes[OpTypeSampledImage][t];
-        if (type->getIdOperand(0) == imageType)
+    for (Instruction* candidate : lookupInstructions(typeLookup, key.hash)) {
+        type = candidate;
+        if (type->getOpCode() == OpTypeSampledImage &&
+            type->getIdOperand(0) == imageType)
             return type->getResultId();
     }
 
@@ -521,6 +609,7 @@ Id Builder::makeSampledImageType(Id imageType)
     type->addIdOperand(imageType);
 
     groupedTypes[OpTypeSampledImage].push_back(type);
+    typeLookup[key.hash].push_back(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -648,11 +737,17 @@ Id Builder::getContainedTypeId(Id typeId) const
 // can be reused rather than duplicated.  (Required by the specification).
 Id Builder::findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned value) const
 {
+    InstructionKey key(typeClass);
+    key.add(opcode);
+    key.add(typeId);
+    key.add(value);
+
     Instruction* constant;
-    for (int i = 0; i < (int)groupedConstants[typeClass].size(); ++i) {
-        constant = groupedConstants[typeClass][i];
+    for (Instruction* candidate : lookupInstructions(scalarConstantLookup, key.hash)) {
+        constant = candidate;
         if (constant->getOpCode() == opcode &&
             constant->getTypeId() == typeId &&
+            constant->getNumOperands() == 1 &&
             constant->getImmediateOperand(0) == value)
             return constant->getResultId();
     }
@@ -663,11 +758,18 @@ Id Builder::findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned valu
 // Version of findScalarConstant (see above) for scalars that take two operands (e.g. a 'double' or 'int64').
 Id Builder::findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned v1, unsigned v2) const
 {
+    InstructionKey key(typeClass);
+    key.add(opcode);
+    key.add(typeId);
+    key.add(v1);
+    key.add(v2);
+
     Instruction* constant;
-    for (int i = 0; i < (int)groupedConstants[typeClass].size(); ++i) {
-        constant = groupedConstants[typeClass][i];
+    for (Instruction* candidate : lookupInstructions(scalarConstantLookup, key.hash)) {
+        constant = candidate;
         if (constant->getOpCode() == opcode &&
             constant->getTypeId() == typeId &&
+            constant->getNumOperands() == 2 &&
             constant->getImmediateOperand(0) == v1 &&
             constant->getImmediateOperand(1) == v2)
             return constant->getResultId();
@@ -676,6 +778,16 @@ Id Builder::findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned v1,
     return 0;
 }
 
+void Builder::addScalarConstantLookup(Op typeClass, Instruction* constant)
+{
+    InstructionKey key(typeClass);
+    key.add(constant->getOpCode());
+    key.add(constant->getTypeId());
+    for (int op = 0; op < constant->getNumOperands(); ++op)
+        key.add(constant->getImmediateOperand(op));
+    scalarConstantLookup[key.hash].push_back(constant);
+}
+
 // Return true if consuming 'opcode' means consuming a constant.
 // "constant" here means after final transform to executable code,
 // the value consumed will be a constant, so includes specialization.
@@ -732,10 +844,14 @@ Id Builder::makeBoolConstant(bool b, bool specConstant)
 
     // See if we already made it. Applies only to regular constants, because specialization constants
     // must remain distinct for the purpose of applying a SpecId decoration.
+    InstructionKey key(OpTypeBool);
+    key.add(opcode);
+    key.add(typeId);
+
     if (! specConstant) {
         Id existing = 0;
-        for (int i = 0; i < (int)groupedConstants[OpTypeBool].size(); ++i) {
-            constant = groupedConstants[OpTypeBool][i];
+        for (Instruction* candidate : lookupInstructions(scalarConstantLookup, key.hash)) {
+            constant = candidate;
             if (constant->getTypeId() == typeId && constant->getOpCode() == opcode)
                 existing = constant->getResultId();
         }
@@ -747,7 +863,7 @@ Id Builder::makeBoolConstant(bool b, bool specConstant)
     // Make it
     Instruction* c = new Instruction(getUniqueId(), typeId, opcode);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
-    groupedConstants[OpTypeBool].push_back(c);
+    scalarConstantLookup[key.hash].push_back(c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -768,7 +884,7 @@ Id Builder::makeIntConstant(Id typeId, unsigned value, bool specConstant)
     Instruction* c = new Instruction(getUniqueId(), typeId, opcode);
     c->addImmediateOperand(value);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
-    groupedConstants[OpTypeInt].push_back(c);
+    addScalarConstantLookup(OpTypeInt, c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -793,7 +909,7 @@ Id Builder::makeInt64Constant(Id typeId, unsigned long long value, bool specCons
     c->addImmediateOperand(op1);
     c->addImmediateOperand(op2);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
-    groupedConstants[OpTypeInt].push_back(c);
+    addScalarConstantLookup(OpTypeInt, c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -818,7 +934,7 @@ Id Builder::makeFloatConstant(float f, bool specConstant)
     Instruction* c = new Instruction(getUniqueId(), typeId, opcode);
     c->addImmediateOperand(value);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
-    groupedConstants[OpTypeFloat].push_back(c);
+    addScalarConstantLookup(OpTypeFloat, c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -846,7 +962,7 @@ Id Builder::makeDoubleConstant(double d, bool specConstant)
     c->addImmediateOperand(op1);
     c->addImmediateOperand(op2);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
-    groupedConstants[OpTypeFloat].push_back(c);
+    addScalarConstantLookup(OpTypeFloat, c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -871,7 +987,7 @@ Id Builder::makeFloat16Constant(uint16_t f16, bool specConstant)
     Instruction* c = new Instruction(getUniqueId(), typeId, opcode);
     c->addImmediateOperand(value);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
-    groupedConstants[OpTypeFloat].push_back(c);
+    addScalarConstantLookup(OpTypeFloat, c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -880,13 +996,16 @@ Id Builder::makeFloat16Constant(uint16_t f16, bool specConstant)
 
 Id Builder::findCompositeConstant(Op typeClass, const dxil_spv::Vector<Id>& comps) const
 {
+    InstructionKey key(typeClass);
+    key.add(comps);
+
     Instruction* constant = 0;
     bool found = false;
-    for (int i = 0; i < (int)groupedConstants[typeClass].size(); ++i) {
-        constant = groupedConstants[typeClass][i];
+    for (Instruction* candidate : lookupInstructions(compositeConstantLookup, key.hash)) {
+        constant = candidate;
 
         // same shape?
-        if (constant->getNumOperands() != (int)comps.size())
+        if (getTypeClass(constant->getTypeId()) != typeClass || constant->getNumOperands() != (int)comps.size())
             continue;
 
         // same contents?
@@ -934,7 +1053,9 @@ Id Builder::makeCompositeConstant(Id typeId, const dxil_spv::Vector<Id>& members
     for (int op = 0; op < (int)members.size(); ++op)
         c->addIdOperand(members[op]);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
-    groupedConstants[typeClass].push_back(c);
+    InstructionKey key(typeClass);
+    key.add(members);
+    compositeConstantLookup[key.hash].push_back(c);
     module.mapInstruction(c);
 
     return c->getResultId();
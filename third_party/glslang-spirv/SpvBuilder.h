@@ -608,6 +608,9 @@ protected:
     Id findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned value) const;
     Id findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned v1, unsigned v2) const;
     Id findCompositeConstant(Op typeClass, const dxil_spv::Vector<Id>& comps) const;
+    typedef dxil_spv::UnorderedMap<uint64_t, dxil_spv::Vector<Instruction*> > InstructionLookup;
+    static const dxil_spv::Vector<Instruction*>& lookupInstructions(const InstructionLookup& lookup, uint64_t hash);
+    void addScalarConstantLookup(Op typeClass, Instruction* constant);
     Id collapseAccessChain();
     void transferAccessChainSwizzle(bool dynamic);
     void simplifyAccessChainSwizzle();
@@ -649,8 +652,13 @@ protected:
     dxil_spv::Vector<std::unique_ptr<Function> > functions;
 
     // not output, internally used for quick & dirty canonical (unique) creation
-    dxil_spv::Vector<Instruction*> groupedConstants[OpConstant];  // all types appear before OpConstant
-    dxil_spv::Vector<Instruction*> groupedTypes[OpConstant];
+    dxil_spv::Vector<Instruction*> groupedTypes[OpConstant];  // all types appear before OpConstant
+
+    // Types and constants bucketed by a hash of the operands which identify them.
+    // Buckets are in creation order, so the first match is the same one a linear search would find.
+    InstructionLookup typeLookup;
+    InstructionLookup scalarConstantLookup;
+    InstructionLookup compositeConstantLookup;
     Instruction *acceleration_structure_type = nullptr;
     Instruction *ray_query_type = nullptr;
 
@@ -0,0 +1,143 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "bitset_union.hpp"
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define DXIL_SPV_BITSET_NEON
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define DXIL_SPV_BITSET_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define DXIL_SPV_BITSET_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DXIL_SPV_TARGET_AVX2
+#else
+#define DXIL_SPV_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#endif
+
+namespace dxil_spv
+{
+static void bitset_union_words_scalar(uint64_t *dst, const uint64_t *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] |= src[i];
+}
+
+#ifdef DXIL_SPV_BITSET_NEON
+static void bitset_union_words_neon(uint64_t *dst, const uint64_t *src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		uint64x2_t a0 = vorrq_u64(vld1q_u64(dst + i), vld1q_u64(src + i));
+		uint64x2_t a1 = vorrq_u64(vld1q_u64(dst + i + 2), vld1q_u64(src + i + 2));
+		vst1q_u64(dst + i, a0);
+		vst1q_u64(dst + i + 2, a1);
+	}
+	bitset_union_words_scalar(dst + i, src + i, count - i);
+}
+#endif
+
+#ifdef DXIL_SPV_BITSET_SSE2
+static void bitset_union_words_sse2(uint64_t *dst, const uint64_t *src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		auto *d = reinterpret_cast<__m128i *>(dst + i);
+		auto *s = reinterpret_cast<const __m128i *>(src + i);
+		_mm_storeu_si128(d, _mm_or_si128(_mm_loadu_si128(d), _mm_loadu_si128(s)));
+		_mm_storeu_si128(d + 1, _mm_or_si128(_mm_loadu_si128(d + 1), _mm_loadu_si128(s + 1)));
+	}
+	bitset_union_words_scalar(dst + i, src + i, count - i);
+}
+#endif
+
+#ifdef DXIL_SPV_BITSET_AVX2
+DXIL_SPV_TARGET_AVX2
+static void bitset_union_words_avx2(uint64_t *dst, const uint64_t *src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		auto *d = reinterpret_cast<__m256i *>(dst + i);
+		auto *s = reinterpret_cast<const __m256i *>(src + i);
+		_mm256_storeu_si256(d, _mm256_or_si256(_mm256_loadu_si256(d), _mm256_loadu_si256(s)));
+		_mm256_storeu_si256(d + 1, _mm256_or_si256(_mm256_loadu_si256(d + 1), _mm256_loadu_si256(s + 1)));
+	}
+	bitset_union_words_sse2(dst + i, src + i, count - i);
+}
+
+static bool cpu_supports_avx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// AVX2 also needs the OS to save YMM state.
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+using BitsetUnionFunc = void (*)(uint64_t *, const uint64_t *, size_t);
+
+static BitsetUnionFunc select_bitset_union()
+{
+#if defined(DXIL_SPV_BITSET_NEON)
+	return bitset_union_words_neon;
+#elif defined(DXIL_SPV_BITSET_SSE2)
+#ifdef DXIL_SPV_BITSET_AVX2
+	if (cpu_supports_avx2())
+		return bitset_union_words_avx2;
+#endif
+	return bitset_union_words_sse2;
+#else
+	return bitset_union_words_scalar;
+#endif
+}
+
+void bitset_union_words(uint64_t *dst, const uint64_t *src, size_t count)
+{
+	static const BitsetUnionFunc func = select_bitset_union();
+	func(dst, src, count);
+}
+}
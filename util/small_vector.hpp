@@ -0,0 +1,259 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "thread_local_allocator.hpp"
+#include <assert.h>
+#include <string.h>
+#include <type_traits>
+
+namespace dxil_spv
+{
+// Vector with inline storage for the first N elements.
+// Only meant for trivially copyable types, e.g. the adjacency lists of CFG nodes,
+// where most lists are tiny and a heap allocation per list dominates.
+// Same footprint as Vector<T> when N * sizeof(T) <= 2 * sizeof(T *).
+template <typename T, size_t N>
+class SmallVector
+{
+public:
+	static_assert(std::is_trivially_copyable<T>::value, "SmallVector requires trivially copyable types.");
+	static_assert(N > 0 && N * sizeof(T) >= sizeof(T *), "Inline storage must be able to hold a pointer.");
+
+	using value_type = T;
+	using iterator = T *;
+	using const_iterator = const T *;
+
+	SmallVector() = default;
+
+	SmallVector(const SmallVector &other)
+	{
+		*this = other;
+	}
+
+	SmallVector(SmallVector &&other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	~SmallVector()
+	{
+		if (is_heap())
+			free_in_thread(storage.heap, capacity * sizeof(T));
+	}
+
+	SmallVector &operator=(const SmallVector &other)
+	{
+		if (this != &other)
+		{
+			count = 0;
+			reserve(other.count);
+			memcpy(data(), other.data(), other.count * sizeof(T));
+			count = other.count;
+		}
+		return *this;
+	}
+
+	SmallVector &operator=(SmallVector &&other) noexcept
+	{
+		if (this != &other)
+		{
+			if (is_heap())
+				free_in_thread(storage.heap, capacity * sizeof(T));
+
+			storage = other.storage;
+			count = other.count;
+			capacity = other.capacity;
+
+			other.count = 0;
+			other.capacity = N;
+		}
+		return *this;
+	}
+
+	T *data()
+	{
+		return is_heap() ? storage.heap : storage.inline_data;
+	}
+
+	const T *data() const
+	{
+		return is_heap() ? storage.heap : storage.inline_data;
+	}
+
+	iterator begin()
+	{
+		return data();
+	}
+
+	iterator end()
+	{
+		return data() + count;
+	}
+
+	const_iterator begin() const
+	{
+		return data();
+	}
+
+	const_iterator end() const
+	{
+		return data() + count;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	T &operator[](size_t index)
+	{
+		assert(index < count);
+		return data()[index];
+	}
+
+	const T &operator[](size_t index) const
+	{
+		assert(index < count);
+		return data()[index];
+	}
+
+	T &front()
+	{
+		return (*this)[0];
+	}
+
+	const T &front() const
+	{
+		return (*this)[0];
+	}
+
+	T &back()
+	{
+		return (*this)[count - 1];
+	}
+
+	const T &back() const
+	{
+		return (*this)[count - 1];
+	}
+
+	void reserve(size_t new_capacity)
+	{
+		if (new_capacity <= capacity)
+			return;
+
+		if (is_heap() && try_grow_in_place(storage.heap, capacity * sizeof(T), new_capacity * sizeof(T)))
+		{
+			capacity = uint32_t(new_capacity);
+			return;
+		}
+
+		auto *new_data = static_cast<T *>(allocate_in_thread_or_abort(new_capacity * sizeof(T)));
+		memcpy(new_data, data(), count * sizeof(T));
+		if (is_heap())
+			free_in_thread(storage.heap, capacity * sizeof(T));
+		storage.heap = new_data;
+		capacity = uint32_t(new_capacity);
+	}
+
+	void push_back(const T &value)
+	{
+		// value may alias our own storage.
+		T copy = value;
+		if (count == capacity)
+			reserve(2 * capacity);
+		data()[count++] = copy;
+	}
+
+	void pop_back()
+	{
+		assert(count != 0);
+		count--;
+	}
+
+	void clear()
+	{
+		count = 0;
+	}
+
+	void resize(size_t new_count)
+	{
+		reserve(new_count);
+		for (size_t i = count; i < new_count; i++)
+			data()[i] = T();
+		count = uint32_t(new_count);
+	}
+
+	iterator insert(const_iterator pos, const T &value)
+	{
+		size_t index = pos - begin();
+		assert(index <= count);
+		T copy = value;
+		if (count == capacity)
+			reserve(2 * capacity);
+		T *ptr = data();
+		memmove(ptr + index + 1, ptr + index, (count - index) * sizeof(T));
+		ptr[index] = copy;
+		count++;
+		return ptr + index;
+	}
+
+	iterator erase(const_iterator first, const_iterator last)
+	{
+		size_t index = first - begin();
+		size_t end_index = last - begin();
+		assert(index <= end_index && end_index <= count);
+		T *ptr = data();
+		memmove(ptr + index, ptr + end_index, (count - end_index) * sizeof(T));
+		count -= uint32_t(end_index - index);
+		return ptr + index;
+	}
+
+	iterator erase(const_iterator pos)
+	{
+		return erase(pos, pos + 1);
+	}
+
+private:
+	union Storage
+	{
+		T inline_data[N];
+		T *heap;
+	} storage;
+	uint32_t count = 0;
+	uint32_t capacity = N;
+
+	bool is_heap() const
+	{
+		return capacity > N;
+	}
+};
+}
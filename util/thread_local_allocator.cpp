@@ -23,140 +23,810 @@
  */
 
 #include "thread_local_allocator.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <atomic>
 #include <assert.h>
 #include <stdint.h>
 #include <memory>
+#include <new>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 namespace dxil_spv
 {
-static constexpr size_t BLOCK_SIZE = 64 * 1024;
+// Chain blocks grow geometrically from MIN_BLOCK_SIZE, so large conversions need few blocks,
+// while small conversions stay small. Allocations above HUGE_ALLOCATION_SIZE get dedicated blocks.
+static constexpr size_t MIN_BLOCK_SIZE = 64 * 1024;
+static constexpr size_t MAX_BLOCK_SIZE = 2 * 1024 * 1024;
+static constexpr size_t HUGE_ALLOCATION_SIZE = MAX_BLOCK_SIZE / 4;
+// Blocks at least this large are mapped directly and backed by transparent huge pages where supported.
+static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+// Memory an idle context keeps around for the next conversion, by default.
+static constexpr size_t DEFAULT_RETENTION_BUDGET = 64 * 1024 * 1024;
+
+// Freed allocations are recycled through per-size-class free lists.
+// Up to 512 bytes, classes are 16 bytes apart, which matches the bump allocator's alignment.
+// Above that, every power of two is split in 4 classes. Larger allocations are not rounded up to their class,
+// since many equally sized arrays laid out back to back alias badly in the cache. Instead, free blocks
+// remember their size, and are only reused for allocations which fit.
+static constexpr size_t SMALL_CLASS_LIMIT = 512;
+static constexpr unsigned NUM_SMALL_CLASSES = SMALL_CLASS_LIMIT / 16;
+static constexpr unsigned NUM_SIZE_CLASSES = NUM_SMALL_CLASSES + 4 * 10;
+
+static inline unsigned floor_log2(size_t v)
+{
+	unsigned result = 0;
+	while (v >>= 1)
+		result++;
+	return result;
+}
+
+static inline unsigned get_size_class(size_t size)
+{
+	if (size <= SMALL_CLASS_LIMIT)
+		return unsigned((size + 15) / 16) - 1;
+
+	unsigned log2 = floor_log2(size - 1);
+	unsigned sub_class = unsigned((size - 1) >> (log2 - 2)) & 3;
+	return NUM_SMALL_CLASSES + (log2 - 9) * 4 + sub_class;
+}
+
+static_assert(HUGE_ALLOCATION_SIZE == size_t(1) << 19, "Size classes must cover HUGE_ALLOCATION_SIZE.");
+
+static inline size_t align_size(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static uint8_t *allocate_pages(size_t size)
+{
+#ifdef __linux__
+	if (size >= HUGE_PAGE_SIZE)
+	{
+		// Huge pages can only back aligned ranges, and mmap only guarantees page alignment.
+		// Over-allocate and trim the unaligned head and tail.
+		size_t mapped_size = size + HUGE_PAGE_SIZE;
+		void *ptr = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return nullptr;
+
+		auto *base = static_cast<uint8_t *>(ptr);
+		auto *aligned = reinterpret_cast<uint8_t *>(align_size(reinterpret_cast<uintptr_t>(base), HUGE_PAGE_SIZE));
+		size_t head = aligned - base;
+		size_t tail = mapped_size - head - size;
+		if (head)
+			munmap(base, head);
+		if (tail)
+			munmap(aligned + size, tail);
+#ifdef MADV_HUGEPAGE
+		madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+		return aligned;
+	}
+#endif
+	return static_cast<uint8_t *>(malloc(size));
+}
+
+static void free_pages(uint8_t *ptr, size_t size)
+{
+#ifdef __linux__
+	if (size >= HUGE_PAGE_SIZE)
+	{
+		munmap(ptr, size);
+		return;
+	}
+#endif
+	(void)size;
+	::free(ptr);
+}
 
 class ChainAllocator
 {
 public:
+	ChainAllocator() = default;
+	~ChainAllocator();
+	ChainAllocator(const ChainAllocator &) = delete;
+	void operator=(const ChainAllocator &) = delete;
+
 	void reset();
-	void *allocate(size_t size);
+	// Unless ignore_limit is set, fails instead of taking a new block over the memory limit.
+	void *allocate(size_t size, bool ignore_limit);
+	void free(void *ptr, size_t size);
+	bool try_grow_in_place(void *ptr, size_t old_size, size_t new_size);
+	void set_recycling(bool enable);
+	void set_retention_budget(size_t size);
+	size_t get_retention_budget() const;
+	void set_memory_limit(size_t size);
+	void set_budget_owner(ChainAllocator *owner);
+	bool is_out_of_memory() const;
 
-private:
-	struct MallocDeleter
-	{
-		void operator()(void *ptr)
-		{
-			free(ptr);
-		}
-	};
+	void set_tag(AllocatorTag tag);
+	AllocatorTag get_tag() const;
+	const AllocatorStats &get_stats() const;
+	void add_stats(const AllocatorStats &other, bool other_out_of_memory);
 
+private:
 	struct Block
 	{
-		explicit Block(size_t size);
 		void *allocate(size_t size);
+		bool contains(const void *ptr) const;
 
-		std::unique_ptr<uint8_t, MallocDeleter> block;
-		size_t offset = 0;
-		size_t block_size = 0;
+		uint8_t *base;
+		size_t offset;
+		size_t size;
 	};
 	std::vector<Block> blocks;
 	std::vector<Block> huge_blocks;
+	// Dedicated blocks which are no longer used, kept for reuse.
+	std::vector<Block> free_huge_blocks;
+	size_t free_huge_bytes = 0;
+	size_t retention_budget = DEFAULT_RETENTION_BUDGET;
 	unsigned block_index = 0;
 
-	bool ensure_block();
-	void *allocate_huge(size_t size);
+	// Sorted by address, so ownership of a freed pointer can be checked quickly.
+	// Memory from other contexts or malloc is never recycled.
+	struct BlockRange
+	{
+		uintptr_t begin, end;
+	};
+	std::vector<BlockRange> block_ranges;
+
+	struct FreeNode
+	{
+		FreeNode *next;
+		size_t size;
+	};
+	FreeNode *free_lists[NUM_SIZE_CLASSES] = {};
+	bool recycling = true;
+
+	AllocatorStats stats = {};
+	AllocatorTag tag = AllocatorTag::Other;
+	size_t memory_limit = 0;
+	// Reserved bytes are charged against the memory limit of the budget owner, which is this by default.
+	// Other allocators can share the budget, so this counts their reserved bytes as well.
+	ChainAllocator *budget_owner = nullptr;
+	std::atomic<size_t> budget_reserved_bytes{ 0 };
+	ChainAllocator &get_budget_owner();
+	const ChainAllocator &get_budget_owner() const;
+	bool out_of_memory = false;
+
+	uint8_t *acquire_pages(size_t size, bool ignore_limit);
+	void release_pages(uint8_t *ptr, size_t size);
+	void note_allocation(size_t size, size_t in_use_size);
+	void *allocate_chained(size_t size, bool ignore_limit);
+	bool add_block(size_t min_size, bool ignore_limit);
+	void *allocate_huge(size_t size, bool ignore_limit);
+	bool free_huge(void *ptr);
+	void release_huge_block(const Block &block);
+	void rebuild_block_ranges();
+	bool owns(const void *ptr) const;
+	void *pop_free_block(size_t size);
 };
 
-ChainAllocator::Block::Block(size_t size)
-	: block(static_cast<uint8_t *>(malloc(size))), block_size(size)
+void *ChainAllocator::Block::allocate(size_t alloc_size)
 {
+	offset = align_size(offset, 16);
+	if (offset + alloc_size <= size)
+	{
+		void *ret = base + offset;
+		offset += alloc_size;
+		return ret;
+	}
+	else
+		return nullptr;
+}
+
+bool ChainAllocator::Block::contains(const void *ptr) const
+{
+	auto *p = static_cast<const uint8_t *>(ptr);
+	return p >= base && p < base + size;
 }
 
-void *ChainAllocator::Block::allocate(size_t size)
+ChainAllocator &ChainAllocator::get_budget_owner()
 {
-	offset = (offset + 15) & ~size_t(15);
-	if (offset + size <= block_size)
+	return budget_owner ? *budget_owner : *this;
+}
+
+const ChainAllocator &ChainAllocator::get_budget_owner() const
+{
+	return budget_owner ? *budget_owner : *this;
+}
+
+// Several allocators on different threads may share the budget, so it is reserved before the pages are taken.
+static bool try_reserve_budget(std::atomic<size_t> &reserved, size_t size, size_t limit)
+{
+	size_t current = reserved.load(std::memory_order_relaxed);
+	do
 	{
-		void *ret = block.get() + offset;
-		offset += size;
-		return ret;
+		if (limit && current + size > limit)
+			return false;
+	} while (!reserved.compare_exchange_weak(current, current + size, std::memory_order_relaxed));
+	return true;
+}
+
+uint8_t *ChainAllocator::acquire_pages(size_t size, bool ignore_limit)
+{
+	auto &owner = get_budget_owner();
+	size_t limit = owner.memory_limit;
+	if (!try_reserve_budget(owner.budget_reserved_bytes, size, limit))
+	{
+		// Give back idle blocks before giving up.
+		for (auto &block : free_huge_blocks)
+			release_pages(block.base, block.size);
+		free_huge_blocks.clear();
+		free_huge_bytes = 0;
+
+		if (!try_reserve_budget(owner.budget_reserved_bytes, size, limit))
+		{
+			out_of_memory = true;
+			if (!ignore_limit)
+				return nullptr;
+			owner.budget_reserved_bytes.fetch_add(size, std::memory_order_relaxed);
+		}
+	}
+
+	uint8_t *ptr = allocate_pages(size);
+	if (!ptr)
+	{
+		out_of_memory = true;
+		owner.budget_reserved_bytes.fetch_sub(size, std::memory_order_relaxed);
 	}
 	else
-		return nullptr;
+	{
+		stats.reserved_bytes += size;
+		stats.peak_reserved_bytes = std::max(stats.peak_reserved_bytes, stats.reserved_bytes);
+	}
+	return ptr;
 }
 
-static thread_local ChainAllocator *allocator;
+void ChainAllocator::release_pages(uint8_t *ptr, size_t size)
+{
+	free_pages(ptr, size);
+	stats.reserved_bytes -= size;
+	get_budget_owner().budget_reserved_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+ChainAllocator::~ChainAllocator()
+{
+	for (auto &block : blocks)
+		free_pages(block.base, block.size);
+	for (auto &block : huge_blocks)
+		free_pages(block.base, block.size);
+	for (auto &block : free_huge_blocks)
+		free_pages(block.base, block.size);
+	get_budget_owner().budget_reserved_bytes.fetch_sub(stats.reserved_bytes, std::memory_order_relaxed);
+}
 
 void ChainAllocator::reset()
 {
+	for (auto &list : free_lists)
+		list = nullptr;
+
+	// Keep the first blocks of the chain up to the retention budget.
+	// The remaining budget goes to the largest dedicated blocks.
+	// Retained memory counts against the memory limit, so it must fit as well.
+	size_t budget = get_retention_budget();
+	size_t retained = 0;
+	size_t kept_blocks = 0;
 	for (auto &block : blocks)
+	{
+		if (retained + block.size > budget)
+			break;
+		retained += block.size;
 		block.offset = 0;
+		kept_blocks++;
+	}
+
+	for (size_t i = kept_blocks; i < blocks.size(); i++)
+		release_pages(blocks[i].base, blocks[i].size);
+	blocks.resize(kept_blocks);
 	block_index = 0;
+
+	free_huge_blocks.insert(free_huge_blocks.end(), huge_blocks.begin(), huge_blocks.end());
 	huge_blocks.clear();
+	std::sort(free_huge_blocks.begin(), free_huge_blocks.end(),
+	          [](const Block &a, const Block &b) { return a.size > b.size; });
+
+	free_huge_bytes = 0;
+	size_t kept_huge_blocks = 0;
+	for (auto &block : free_huge_blocks)
+	{
+		if (retained + block.size > budget)
+			release_pages(block.base, block.size);
+		else
+		{
+			retained += block.size;
+			free_huge_bytes += block.size;
+			free_huge_blocks[kept_huge_blocks++] = block;
+		}
+	}
+	free_huge_blocks.resize(kept_huge_blocks);
+
+	rebuild_block_ranges();
+
+	size_t reserved_bytes = stats.reserved_bytes;
+	stats = {};
+	stats.reserved_bytes = reserved_bytes;
+	stats.peak_reserved_bytes = reserved_bytes;
+	out_of_memory = false;
+}
+
+void ChainAllocator::set_recycling(bool enable)
+{
+	recycling = enable;
+	for (auto &list : free_lists)
+		list = nullptr;
+}
+
+void ChainAllocator::set_retention_budget(size_t size)
+{
+	retention_budget = size;
+}
+
+size_t ChainAllocator::get_retention_budget() const
+{
+	size_t limit = get_budget_owner().memory_limit;
+	return limit ? std::min(retention_budget, limit) : retention_budget;
+}
+
+void ChainAllocator::set_memory_limit(size_t size)
+{
+	memory_limit = size;
 }
 
-bool ChainAllocator::ensure_block()
+void ChainAllocator::set_budget_owner(ChainAllocator *owner)
 {
-	blocks.emplace_back(BLOCK_SIZE);
-	return bool(blocks.back().block);
+	// Only while nothing is reserved, so the budgets stay balanced.
+	assert(stats.reserved_bytes == 0);
+	budget_owner = owner != this ? owner : nullptr;
 }
 
-void *ChainAllocator::allocate_huge(size_t size)
+bool ChainAllocator::is_out_of_memory() const
 {
-	huge_blocks.emplace_back(size);
-	return huge_blocks.back().block.get();
+	return out_of_memory;
 }
 
-void *ChainAllocator::allocate(size_t size)
+void ChainAllocator::set_tag(AllocatorTag tag_)
 {
-	if (size > BLOCK_SIZE)
-		return allocate_huge(size);
+	tag = tag_;
+}
 
-	if (block_index >= blocks.size() && !ensure_block())
+AllocatorTag ChainAllocator::get_tag() const
+{
+	return tag;
+}
+
+const AllocatorStats &ChainAllocator::get_stats() const
+{
+	return stats;
+}
+
+void ChainAllocator::add_stats(const AllocatorStats &other, bool other_out_of_memory)
+{
+	out_of_memory = out_of_memory || other_out_of_memory;
+	stats.requested_bytes += other.requested_bytes;
+	stats.allocation_count += other.allocation_count;
+	stats.in_use_bytes += other.in_use_bytes;
+	stats.peak_in_use_bytes += other.peak_in_use_bytes;
+	stats.peak_reserved_bytes += other.peak_reserved_bytes;
+	stats.huge_bytes += other.huge_bytes;
+	stats.peak_huge_bytes += other.peak_huge_bytes;
+	for (int i = 0; i < int(AllocatorTag::Count); i++)
+	{
+		stats.tag_requested_bytes[i] += other.tag_requested_bytes[i];
+		stats.tag_allocation_count[i] += other.tag_allocation_count[i];
+	}
+}
+
+void ChainAllocator::note_allocation(size_t size, size_t in_use_size)
+{
+	stats.requested_bytes += size;
+	stats.allocation_count++;
+	stats.tag_requested_bytes[int(tag)] += size;
+	stats.tag_allocation_count[int(tag)]++;
+	stats.in_use_bytes += in_use_size;
+	stats.peak_in_use_bytes = std::max(stats.peak_in_use_bytes, stats.in_use_bytes);
+}
+
+void ChainAllocator::rebuild_block_ranges()
+{
+	block_ranges.clear();
+	for (auto &block : blocks)
+	{
+		auto begin = reinterpret_cast<uintptr_t>(block.base);
+		block_ranges.push_back({ begin, begin + block.size });
+	}
+	std::sort(block_ranges.begin(), block_ranges.end(),
+	          [](const BlockRange &a, const BlockRange &b) { return a.begin < b.begin; });
+}
+
+bool ChainAllocator::add_block(size_t min_size, bool ignore_limit)
+{
+	size_t size = blocks.size() < 5 ? MIN_BLOCK_SIZE << blocks.size() : MAX_BLOCK_SIZE;
+	size = std::max(size, align_size(min_size, MIN_BLOCK_SIZE));
+
+	Block block = {};
+	block.base = acquire_pages(size, ignore_limit);
+	block.size = size;
+	if (!block.base)
+		return false;
+
+	blocks.push_back(block);
+	BlockRange range = {};
+	range.begin = reinterpret_cast<uintptr_t>(block.base);
+	range.end = range.begin + size;
+	auto itr = std::upper_bound(block_ranges.begin(), block_ranges.end(), range,
+	                            [](const BlockRange &a, const BlockRange &b) { return a.begin < b.begin; });
+	block_ranges.insert(itr, range);
+	return true;
+}
+
+void *ChainAllocator::allocate_huge(size_t size, bool ignore_limit)
+{
+	// Best fit among retained blocks.
+	size_t best = free_huge_blocks.size();
+	for (size_t i = 0; i < free_huge_blocks.size(); i++)
+		if (free_huge_blocks[i].size >= size && (best == free_huge_blocks.size() ||
+		                                         free_huge_blocks[i].size < free_huge_blocks[best].size))
+			best = i;
+
+	Block block = {};
+	if (best < free_huge_blocks.size())
+	{
+		block = free_huge_blocks[best];
+		free_huge_blocks.erase(free_huge_blocks.begin() + best);
+		free_huge_bytes -= block.size;
+	}
+	else
+	{
+		block.size = align_size(size, size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : MIN_BLOCK_SIZE);
+		block.base = acquire_pages(block.size, ignore_limit);
+		if (!block.base)
+			return nullptr;
+	}
+
+	huge_blocks.push_back(block);
+	stats.huge_bytes += block.size;
+	stats.peak_huge_bytes = std::max(stats.peak_huge_bytes, stats.huge_bytes);
+	note_allocation(size, block.size);
+	return block.base;
+}
+
+void ChainAllocator::release_huge_block(const Block &block)
+{
+	if (free_huge_bytes + block.size <= get_retention_budget())
+	{
+		free_huge_blocks.push_back(block);
+		free_huge_bytes += block.size;
+	}
+	else
+		release_pages(block.base, block.size);
+}
+
+bool ChainAllocator::free_huge(void *ptr)
+{
+	// Huge allocations are rare, and the most recent ones are the most likely to be freed.
+	for (size_t i = huge_blocks.size(); i; i--)
+	{
+		if (huge_blocks[i - 1].base == ptr)
+		{
+			stats.huge_bytes -= huge_blocks[i - 1].size;
+			stats.in_use_bytes -= huge_blocks[i - 1].size;
+			release_huge_block(huge_blocks[i - 1]);
+			huge_blocks[i - 1] = huge_blocks.back();
+			huge_blocks.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ChainAllocator::owns(const void *ptr) const
+{
+	auto p = reinterpret_cast<uintptr_t>(ptr);
+	auto itr = std::upper_bound(block_ranges.begin(), block_ranges.end(), p,
+	                            [](uintptr_t v, const BlockRange &range) { return v < range.begin; });
+	return itr != block_ranges.begin() && p < (itr - 1)->end;
+}
+
+void *ChainAllocator::pop_free_block(size_t size)
+{
+	unsigned size_class = get_size_class(size);
+	auto *node = free_lists[size_class];
+
+	// Blocks in the next class are always large enough.
+	if ((!node || node->size < size) && size_class + 1 < NUM_SIZE_CLASSES)
+	{
+		size_class++;
+		node = free_lists[size_class];
+	}
+
+	if (!node || node->size < size)
 		return nullptr;
 
-	void *ptr = blocks[block_index].allocate(size);
+	free_lists[size_class] = node->next;
+	return node;
+}
+
+void *ChainAllocator::allocate(size_t size, bool ignore_limit)
+{
+	if (size > HUGE_ALLOCATION_SIZE)
+		return allocate_huge(size, ignore_limit);
+
+	size_t aligned_size = align_size(std::max<size_t>(size, 1), 16);
+	void *ptr = allocate_chained(aligned_size, ignore_limit);
 	if (ptr)
-		return ptr;
+		note_allocation(size, aligned_size);
+	return ptr;
+}
+
+void *ChainAllocator::allocate_chained(size_t size, bool ignore_limit)
+{
+	if (recycling)
+		if (void *ptr = pop_free_block(size))
+			return ptr;
+
+	// Move on once a block cannot fit the allocation. Retained blocks are reused in order after a reset.
+	for (; block_index < blocks.size(); block_index++)
+		if (void *ptr = blocks[block_index].allocate(size))
+			return ptr;
 
-	block_index++;
-	if (block_index >= blocks.size() && !ensure_block())
+	if (!add_block(size, ignore_limit))
 		return nullptr;
 
 	return blocks[block_index].allocate(size);
 }
 
+void ChainAllocator::free(void *ptr, size_t size)
+{
+	if (!ptr || !recycling)
+		return;
+
+	if (size > HUGE_ALLOCATION_SIZE)
+	{
+		free_huge(ptr);
+		return;
+	}
+
+	size = align_size(std::max<size_t>(size, 1), 16);
+
+	// If this was the last allocation, roll it back, so LIFO temporaries do not leave holes behind.
+	if (block_index < blocks.size())
+	{
+		auto &block = blocks[block_index];
+		if (block.contains(ptr) && static_cast<uint8_t *>(ptr) + size == block.base + block.offset)
+		{
+			block.offset -= size;
+			stats.in_use_bytes -= size;
+			return;
+		}
+	}
+
+	// Memory of another context, which keeps it until that context is reset or destroyed.
+	if (!owns(ptr))
+		return;
+
+	stats.in_use_bytes -= size;
+	unsigned size_class = get_size_class(size);
+	auto *node = static_cast<FreeNode *>(ptr);
+	node->size = size;
+	node->next = free_lists[size_class];
+	free_lists[size_class] = node;
+}
+
+bool ChainAllocator::try_grow_in_place(void *ptr, size_t old_size, size_t new_size)
+{
+	// Huge allocations have dedicated blocks.
+	if (!ptr || old_size > HUGE_ALLOCATION_SIZE || new_size > HUGE_ALLOCATION_SIZE || block_index >= blocks.size())
+		return false;
+
+	// Only the most recent allocation in the current block can be extended.
+	auto &block = blocks[block_index];
+	auto *p = static_cast<uint8_t *>(ptr);
+	size_t old_aligned_size = align_size(std::max<size_t>(old_size, 1), 16);
+	if (!block.contains(ptr) || p + old_aligned_size != block.base + block.offset)
+		return false;
+
+	size_t new_aligned_size = align_size(new_size, 16);
+	size_t new_end = size_t(p - block.base) + new_aligned_size;
+	if (new_aligned_size < old_aligned_size || new_end > block.size)
+		return false;
+
+	block.offset = new_end;
+	stats.requested_bytes += new_size - old_size;
+	stats.tag_requested_bytes[int(tag)] += new_size - old_size;
+	stats.in_use_bytes += new_aligned_size - old_aligned_size;
+	stats.peak_in_use_bytes = std::max(stats.peak_in_use_bytes, stats.in_use_bytes);
+	return true;
+}
+
+struct AllocatorContext
+{
+	ChainAllocator allocator;
+	bool bound = false;
+};
+
+static thread_local AllocatorContext *context;
+
 void *allocate_in_thread(size_t size)
 {
-	if (!allocator)
+	if (!context)
 		return malloc(size);
 
-	return allocator->allocate(size);
+	return context->allocator.allocate(size, false);
+}
+
+void *allocate_in_thread_or_abort(size_t size)
+{
+	void *ptr = context ? context->allocator.allocate(size, true) : malloc(std::max<size_t>(size, 1));
+	if (!ptr)
+	{
+		LOGE("Failed to allocate %zu bytes.\n", size);
+		abort();
+	}
+	return ptr;
 }
 
 void free_in_thread(void *ptr)
 {
-	if (!allocator)
+	if (!context)
+	{
+		free(ptr);
+		return;
+	}
+
+	// Without the size, the allocation cannot be recycled.
+}
+
+void free_in_thread(void *ptr, size_t size)
+{
+	if (!context)
 	{
 		free(ptr);
 		return;
 	}
 
-	// Don't bother freeing ...
+	context->allocator.free(ptr, size);
+}
+
+bool try_grow_in_place(void *ptr, size_t old_size, size_t new_size)
+{
+	if (!context)
+		return false;
+
+	return context->allocator.try_grow_in_place(ptr, old_size, new_size);
+}
+
+AllocatorContext *create_allocator_context()
+{
+	return new (std::nothrow) AllocatorContext;
+}
+
+void destroy_allocator_context(AllocatorContext *ctx)
+{
+	assert(!ctx || !ctx->bound);
+	delete ctx;
+}
+
+void reset_allocator_context(AllocatorContext *ctx)
+{
+	ctx->allocator.reset();
+}
+
+void set_allocator_context_recycling(AllocatorContext *ctx, bool enable)
+{
+	ctx->allocator.set_recycling(enable);
+}
+
+void set_allocator_context_retention_budget(AllocatorContext *ctx, size_t size)
+{
+	ctx->allocator.set_retention_budget(size);
+}
+
+void set_allocator_context_memory_limit(AllocatorContext *ctx, size_t size)
+{
+	ctx->allocator.set_memory_limit(size);
+}
+
+void share_allocator_context_memory_limit(AllocatorContext *ctx, AllocatorContext *owner)
+{
+	ctx->allocator.set_budget_owner(owner ? &owner->allocator : nullptr);
+}
+
+bool thread_allocator_out_of_memory()
+{
+	return context && context->allocator.is_out_of_memory();
+}
+
+void get_allocator_context_stats(const AllocatorContext *ctx, AllocatorStats &stats)
+{
+	stats = ctx->allocator.get_stats();
+}
+
+void add_allocator_context_stats(AllocatorContext *ctx, const AllocatorContext *other)
+{
+	ctx->allocator.add_stats(other->allocator.get_stats(), other->allocator.is_out_of_memory());
+}
+
+const char *get_allocator_tag_name(AllocatorTag tag)
+{
+	switch (tag)
+	{
+	case AllocatorTag::Other:
+		return "other";
+	case AllocatorTag::BitcodeParse:
+		return "bitcode_parse";
+	case AllocatorTag::Converter:
+		return "converter";
+	case AllocatorTag::Structurizer:
+		return "structurizer";
+	case AllocatorTag::SPIRVBuilder:
+		return "spirv_builder";
+	default:
+		return "";
+	}
+}
+
+AllocatorTag set_thread_allocator_tag(AllocatorTag tag)
+{
+	if (!context)
+		return AllocatorTag::Other;
+
+	AllocatorTag prev = context->allocator.get_tag();
+	context->allocator.set_tag(tag);
+	return prev;
+}
+
+AllocatorContext *bind_thread_allocator_context(AllocatorContext *ctx)
+{
+	auto *prev = context;
+	if (prev)
+		prev->bound = false;
+
+	if (ctx)
+	{
+		assert(!ctx->bound && "Allocator context is bound to another thread.");
+		ctx->bound = true;
+	}
+
+	context = ctx;
+	return prev;
+}
+
+AllocatorContext *get_thread_allocator_context()
+{
+	return context;
 }
 
 void begin_thread_allocator_context()
 {
-	assert(!allocator);
-	allocator = new ChainAllocator;
+	assert(!context);
+	bind_thread_allocator_context(create_allocator_context());
 }
 
 void end_thread_allocator_context()
 {
-	assert(allocator);
-	delete allocator;
-	allocator = nullptr;
+	assert(context);
+	destroy_allocator_context(bind_thread_allocator_context(nullptr));
 }
 
 void reset_thread_allocator_context()
 {
-	assert(allocator);
-	allocator->reset();
+	assert(context);
+	reset_allocator_context(context);
+}
+
+bool has_thread_allocator_context()
+{
+	return context != nullptr;
+}
+
+uint64_t get_thread_allocated_bytes()
+{
+	// Contexts count requested bytes anyway, so allocations do not need a counter of their own.
+	return context ? context->allocator.get_stats().requested_bytes : 0;
 }
 }
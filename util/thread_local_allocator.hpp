@@ -38,8 +38,19 @@
 
 namespace dxil_spv
 {
+// Fails if the system is out of memory, or if a new block would take the bound context over its memory limit.
 void *allocate_in_thread(std::size_t size);
+// For callers which have no way to report failure, like containers.
+// Goes over the memory limit rather than failing, but the context is still out of memory after.
+// Aborts if the system is out of memory.
+void *allocate_in_thread_or_abort(std::size_t size);
 void free_in_thread(void *ptr);
+// Allocator contexts can only recycle memory if they know the size of the allocation.
+void free_in_thread(void *ptr, std::size_t size);
+// Extends ptr to new_size bytes without moving it, which only works for the most recent allocation
+// of the bound context. On failure, the caller has to allocate and copy instead.
+// std::vector allocates the new buffer before releasing the old one, so only containers which call this benefit.
+bool try_grow_in_place(void *ptr, std::size_t old_size, std::size_t new_size);
 
 template <typename T>
 class ThreadLocalAllocator
@@ -53,12 +64,12 @@ public:
 
 	value_type *allocate(size_t n)
 	{
-		return static_cast<value_type *>(allocate_in_thread(sizeof(T) * n));
+		return static_cast<value_type *>(allocate_in_thread_or_abort(sizeof(T) * n));
 	}
 
-	void deallocate(value_type *p, std::size_t)
+	void deallocate(value_type *p, std::size_t n)
 	{
-		free_in_thread(p);
+		free_in_thread(p, sizeof(T) * n);
 	}
 
 	using is_always_equal = std::true_type;
@@ -91,9 +102,106 @@ using StringStream = std::basic_ostringstream<char, std::char_traits<char>, Thre
 template <typename Key, typename Value, typename Hash = std::hash<Key>>
 using UnorderedMap = std::unordered_map<Key, Value, Hash, std::equal_to<Key>, ThreadLocalAllocator<std::pair<const Key, Value>>>;
 
+// Arena which Vector, String, UnorderedMap, etc. allocate from while it is bound to the calling thread.
+// A context is not tied to a thread. It can be unbound and bound again on another thread,
+// as long as it is bound to at most one thread at a time. Memory allocated from a context
+// should be freed while the same context is bound. Freeing it while another context is bound is a no-op,
+// and the memory is released when its own context is reset or destroyed, so containers may be handed
+// between threads with different contexts. Memory from a context must not be freed with no context bound.
+struct AllocatorContext;
+AllocatorContext *create_allocator_context();
+void destroy_allocator_context(AllocatorContext *context);
+// Releases everything allocated from the context at once.
+void reset_allocator_context(AllocatorContext *context);
+// Freed memory is recycled through size-class free lists by default.
+// Disabling recycling makes the context a pure bump allocator.
+void set_allocator_context_recycling(AllocatorContext *context, bool enable);
+// Upper bound on memory a context keeps for reuse when it is reset or when large allocations are freed.
+void set_allocator_context_retention_budget(AllocatorContext *context, size_t size);
+// Once a new block would take the context over size bytes, it is out of memory until reset. 0 means no limit.
+// allocate_in_thread() fails instead of taking the block. Containers cannot observe failure without exceptions,
+// so they still go over the limit, and stages which can allocate without bound poll thread_allocator_out_of_memory().
+void set_allocator_context_memory_limit(AllocatorContext *context, size_t size);
+// Charges memory held by context against the memory limit of owner, together with owner's own memory.
+// Must be called before context allocates anything, and owner must outlive context.
+void share_allocator_context_memory_limit(AllocatorContext *context, AllocatorContext *owner);
+
+// Stage of a conversion which allocations are attributed to.
+enum class AllocatorTag : uint8_t
+{
+	Other,
+	BitcodeParse,
+	Converter,
+	Structurizer,
+	SPIRVBuilder,
+	Count
+};
+
+// Counted since the context was created or last reset.
+struct AllocatorStats
+{
+	uint64_t requested_bytes;
+	uint64_t allocation_count;
+	// Memory handed out and not freed yet. Memory freed without a size, or while recycling is disabled,
+	// cannot be reused, so it stays in use until reset.
+	size_t in_use_bytes;
+	size_t peak_in_use_bytes;
+	// Memory the context holds, including blocks retained for reuse.
+	size_t reserved_bytes;
+	size_t peak_reserved_bytes;
+	// Part of in_use_bytes in dedicated blocks for large allocations.
+	size_t huge_bytes;
+	size_t peak_huge_bytes;
+	uint64_t tag_requested_bytes[int(AllocatorTag::Count)];
+	uint64_t tag_allocation_count[int(AllocatorTag::Count)];
+};
+
+void get_allocator_context_stats(const AllocatorContext *context, AllocatorStats &stats);
+// Folds the stats of other into context, e.g. for a worker thread's context.
+// Peaks are summed, so they become an upper bound. If other is out of memory, so is context.
+void add_allocator_context_stats(AllocatorContext *context, const AllocatorContext *other);
+const char *get_allocator_tag_name(AllocatorTag tag);
+
+// Returns the previously bound context. Binding nullptr falls back to malloc.
+AllocatorContext *bind_thread_allocator_context(AllocatorContext *context);
+AllocatorContext *get_thread_allocator_context();
+
+// Convenience wrappers which create, reset and destroy a context bound to the calling thread.
 void begin_thread_allocator_context();
 void end_thread_allocator_context();
 void reset_thread_allocator_context();
+bool has_thread_allocator_context();
+
+// Bytes requested from the context bound to this thread since it was created or last reset.
+// Without a bound context, allocations are not counted and this returns 0.
+uint64_t get_thread_allocated_bytes();
+
+// True if the context bound to this thread went over its memory limit, or failed to get memory from the system.
+bool thread_allocator_out_of_memory();
+
+// Attributes allocations from the context bound to this thread to tag. Returns the previous tag.
+// Without a bound context, this does nothing.
+AllocatorTag set_thread_allocator_tag(AllocatorTag tag);
+
+class ScopedAllocatorTag
+{
+public:
+	explicit ScopedAllocatorTag(AllocatorTag tag)
+	    : prev(set_thread_allocator_tag(tag))
+	{
+	}
+
+	~ScopedAllocatorTag()
+	{
+		set_thread_allocator_tag(prev);
+	}
+
+	ScopedAllocatorTag(const ScopedAllocatorTag &) = delete;
+	void operator=(const ScopedAllocatorTag &) = delete;
+
+private:
+	AllocatorTag prev;
+};
 
 template <typename T>
 static inline String to_string(T&& t)
@@ -120,7 +228,7 @@ struct hash<dxil_spv::String>
 }
 
 #define DXIL_SPV_OVERRIDE_NEW_DELETE \
-	void *operator new(size_t size) { return ::dxil_spv::allocate_in_thread(size); } \
-	void operator delete(void *ptr) { ::dxil_spv::free_in_thread(ptr); } \
-	void *operator new[](size_t size) { return ::dxil_spv::allocate_in_thread(size); } \
-	void operator delete[](void *ptr) { ::dxil_spv::free_in_thread(ptr); }
+	void *operator new(size_t size) { return ::dxil_spv::allocate_in_thread_or_abort(size); } \
+	void operator delete(void *ptr, size_t size) { ::dxil_spv::free_in_thread(ptr, size); } \
+	void *operator new[](size_t size) { return ::dxil_spv::allocate_in_thread_or_abort(size); } \
+	void operator delete[](void *ptr, size_t size) { ::dxil_spv::free_in_thread(ptr, size); }
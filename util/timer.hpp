@@ -0,0 +1,59 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+
+namespace dxil_spv
+{
+static inline uint64_t get_current_time_nsecs()
+{
+	auto t = std::chrono::steady_clock::now().time_since_epoch();
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(t).count());
+}
+
+// Adds elapsed wall time to a counter on scope exit. A null counter disables timing entirely.
+class ScopedTimer
+{
+public:
+	explicit ScopedTimer(uint64_t *counter_)
+		: counter(counter_), start(counter_ ? get_current_time_nsecs() : 0)
+	{
+	}
+
+	~ScopedTimer()
+	{
+		if (counter)
+			*counter += get_current_time_nsecs() - start;
+	}
+
+	ScopedTimer(const ScopedTimer &) = delete;
+	void operator=(const ScopedTimer &) = delete;
+
+private:
+	uint64_t *counter;
+	uint64_t start;
+};
+}